@@ -0,0 +1,130 @@
+// Output formats on a document of 341 sections: encoded size and
+// serialize time of each, then what a client pays to read it back, parsing
+// JSON, CBOR and MessagePack against opening and walking FLAT in place.
+
+#include "flat_document.hpp"
+#include "output_format.hpp"
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+    // a section tree shaped like a long report, its text kept alive in deques
+    struct report {
+        std::deque<PDF_Section> sections;
+        std::deque<std::string> texts;
+        std::deque<std::vector<std::string_view>> keywords;
+        std::mt19937 random{24};
+        PDF_Section_Node root;
+
+        report() {
+            build(root, nullptr, 4);
+        }
+
+        std::string_view text(int words) {
+            std::string s;
+            for (int i = 0; i < words; ++i) {
+                if (!s.empty()) {
+                    s += ' ';
+                }
+                for (int n = 2 + random() % 8; n > 0; --n) {
+                    s += static_cast<char>('a' + random() % 26);
+                }
+            }
+            texts.push_back(std::move(s));
+            return texts.back();
+        }
+
+        void build(PDF_Section_Node& node, PDF_Section_Node* parent, int depth) {
+            sections.emplace_back();
+            node.main_section = &sections.back();
+            node.parent_node = parent;
+            node.main_section->title = text(6);
+            for (int p = 0; p < 6; ++p) {
+                PDF_Paragraph paragraph{};
+                paragraph.paragraph = text(60);
+                keywords.emplace_back();
+                for (int k = random() % 4; k > 0; --k) {
+                    keywords.back().push_back(text(1));
+                }
+                paragraph.emphasized_words = PDF_Word_List{keywords.back().data(), keywords.back().size()};
+                node.main_section->paragraphs.push_back(paragraph);
+            }
+            if (depth > 0) {
+                node.sub_sections.emplace();
+                for (int c = 0; c < 4; ++c) {
+                    node.sub_sections->emplace_back();
+                    build(node.sub_sections->back(), &node, depth - 1);
+                }
+            }
+        }
+    };
+
+    template <typename F>
+    double milliseconds_per_call(int iterations, F&& f) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            f();
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count() / iterations;
+    }
+
+    std::size_t sink = 0;
+
+    // touches every string of a flat document, as a client reading all of it would
+    std::size_t walk(PDF_Flat_Document const& document) {
+        std::size_t bytes = 0;
+        for (std::uint32_t i = 0; i < document.header().section_count; ++i) {
+            bytes += document.text(document.section(i).title).size();
+        }
+        for (std::uint32_t i = 0; i < document.header().paragraph_count; ++i) {
+            bytes += document.text(document.paragraph(i).text).size();
+        }
+        for (std::uint32_t i = 0; i < document.header().keyword_count; ++i) {
+            bytes += document.text(document.keyword(i)).size();
+        }
+        return bytes;
+    }
+
+} // namespace
+
+int main() {
+    report r;
+    std::vector<unsigned int> pages = {0, 1, 2, 3, 4, 5, 6, 7};
+    const int ITERATIONS = 50;
+
+    std::printf("%zu sections\n", r.sections.size());
+    std::string encoded[4];
+    for (OUTPUT_FORMAT format : {OUTPUT_FORMAT::JSON, OUTPUT_FORMAT::CBOR, OUTPUT_FORMAT::MSGPACK, OUTPUT_FORMAT::FLAT}) {
+        std::string& out = encoded[static_cast<int>(format)];
+        double ms = milliseconds_per_call(ITERATIONS, [&r, &pages, &out, format]() {
+            out = format_pdf_document(r.root, format, false, pages);
+        });
+        std::printf("  serialize %-36s %9zu bytes %8.3f ms\n", format_content_type(format), out.size(), ms);
+    }
+
+    double json_ms = milliseconds_per_call(ITERATIONS, [&encoded]() {
+        sink += nlohmann::json::parse(encoded[static_cast<int>(OUTPUT_FORMAT::JSON)]).size();
+    });
+    double cbor_ms = milliseconds_per_call(ITERATIONS, [&encoded]() {
+        sink += nlohmann::json::from_cbor(encoded[static_cast<int>(OUTPUT_FORMAT::CBOR)]).size();
+    });
+    double msgpack_ms = milliseconds_per_call(ITERATIONS, [&encoded]() {
+        sink += nlohmann::json::from_msgpack(encoded[static_cast<int>(OUTPUT_FORMAT::MSGPACK)]).size();
+    });
+    double flat_ms = milliseconds_per_call(ITERATIONS, [&encoded]() {
+        std::optional<PDF_Flat_Document> document = PDF_Flat_Document::open(encoded[static_cast<int>(OUTPUT_FORMAT::FLAT)]);
+        sink += document ? walk(document.value()) : 0;
+    });
+    std::printf("  read json                 %8.3f ms\n", json_ms);
+    std::printf("  read cbor                 %8.3f ms\n", cbor_ms);
+    std::printf("  read msgpack              %8.3f ms\n", msgpack_ms);
+    std::printf("  read flat, open and walk  %8.3f ms\n", flat_ms);
+    return sink == 0;
+}
@@ -0,0 +1,110 @@
+// Compares query_string and url_decode with the std::regex / istringstream
+// parser they replaced, on request targets as the service receives them.
+
+#include "query_string.hpp"
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+    // the previous http_worker::parse
+    std::map<std::string, std::string> regex_parse(const std::string& query) {
+        std::map<std::string, std::string> data;
+        std::regex pattern("([\\w+%]+)=([^&]*)");
+        auto words_begin = std::sregex_iterator(query.begin(), query.end(), pattern);
+        auto words_end = std::sregex_iterator();
+
+        for (std::sregex_iterator i = words_begin; i != words_end; i++) {
+            std::string key = (*i)[1].str();
+            std::string value = (*i)[2].str();
+            data[key] = value;
+        }
+        return data;
+    }
+
+    // the previous http_worker::url_decode
+    bool istringstream_url_decode(const std::string& in, std::string& out) {
+        out.clear();
+        out.reserve(in.size());
+        for (std::size_t i = 0; i < in.size(); ++i) {
+            if (in[i] == '%') {
+                if (i + 3 <= in.size()) {
+                    int value = 0;
+                    std::istringstream is(in.substr(i + 1, 2));
+                    if (is >> std::hex >> value) {
+                        out += static_cast<char>(value);
+                        i += 2;
+                    } else {
+                        return false;
+                    }
+                } else {
+                    return false;
+                }
+            } else if (in[i] == '+') {
+                out += ' ';
+            } else {
+                out += in[i];
+            }
+        }
+        return true;
+    }
+
+    const std::vector<std::string> TARGETS = {
+        "/?path=%2Fdata%2Fdocuments%2Freport%202021.pdf",
+        "/?path=%2Fdata%2Fdocuments%2Fannual%2Freport.pdf&stream=sections&budget_ms=2000",
+        "/?path=%2Fsrv%2Fpdf%2Fa+b+c.pdf&pages=1-5,10,20-&max_pages=50&format=cbor",
+        "/jobs?path=%2Fmnt%2Fshare%2F%E6%96%87%E6%9B%B8.pdf&budget_ms=500",
+    };
+
+    template <typename F>
+    double nanoseconds_per_call(std::size_t iterations, F&& f) {
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < iterations; ++i) {
+            f(TARGETS[i % TARGETS.size()]);
+        }
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count() / iterations;
+    }
+
+} // namespace
+
+int main() {
+    // both parsers must agree before their timings mean anything
+    for (const std::string& target : TARGETS) {
+        std::map<std::string, std::string> expected = regex_parse(target);
+        query_string params(target);
+        for (auto const& [key, value] : expected) {
+            std::string old_decoded, new_decoded;
+            bool old_ok = istringstream_url_decode(value, old_decoded);
+            bool new_ok = url_decode(params.find(key).value_or(""), new_decoded);
+            if (!params.contains(key) || old_ok != new_ok || old_decoded != new_decoded) {
+                std::fprintf(stderr, "mismatch on %s, parameter %s\n", target.c_str(), key.c_str());
+                return 1;
+            }
+        }
+    }
+
+    std::size_t sink = 0;
+    double before = nanoseconds_per_call(20000, [&sink](const std::string& target) {
+        std::map<std::string, std::string> params = regex_parse(target);
+        std::string path;
+        istringstream_url_decode(params.at("path"), path);
+        sink += path.size();
+    });
+    std::string path;
+    double after = nanoseconds_per_call(2000000, [&sink, &path](const std::string& target) {
+        query_string params(target);
+        url_decode(params.find("path").value_or(""), path);
+        sink += path.size();
+    });
+
+    std::printf("regex + istringstream   %10.1f ns/request\n", before);
+    std::printf("query_string            %10.1f ns/request\n", after);
+    std::printf("speedup                 %10.1fx\n", before / after);
+    return sink == 0;
+}
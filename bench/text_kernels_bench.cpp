@@ -0,0 +1,134 @@
+// Text kernels at every level this CPU runs, against the string_utils.hpp
+// code they replaced: per-codepoint UTF-8 encoding, std::isspace trimming
+// and std::islower case tests.
+
+#include "string_utils.hpp"
+#include "text_kernels.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+    // the previous trim of string_utils.hpp
+    void isspace_trim(std::string& s) {
+        s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](int ch) {
+            return !std::isspace(ch);
+        }));
+        s.erase(std::find_if(s.rbegin(), s.rend(), [](int ch) {
+            return !std::isspace(ch);
+        }).base(), s.end());
+    }
+
+    // the previous is_all_upper_case of string_utils.hpp
+    bool islower_all_upper_case(const std::string& s) {
+        return std::none_of(s.begin(), s.end(), &::islower);
+    }
+
+    std::vector<int> codepoints_of(const char32_t* text, std::size_t repeat) {
+        std::vector<int> codepoints;
+        for (std::size_t i = 0; i < repeat; ++i) {
+            for (const char32_t* c = text; *c; ++c) {
+                codepoints.push_back(static_cast<int>(*c));
+            }
+        }
+        return codepoints;
+    }
+
+    struct sample {
+        const char* name;
+        std::vector<int> codepoints;
+    };
+
+    const std::vector<sample> SAMPLES = {
+        {"ascii", codepoints_of(U"The quick brown fox jumps over the lazy dog. Section 2.1 covers the details. ", 64)},
+        {"latin-1", codepoints_of(U"Le système de café coûte très cher à l'été, déjà réglé par la société. ", 64)},
+        {"cyrillic", codepoints_of(U"Съешь же ещё этих мягких французских булок, да выпей чаю. ", 64)},
+        {"cjk", codepoints_of(U"文書の構造を解析して段落と見出しを抽出します。", 64)},
+    };
+
+    const std::vector<std::string> TITLES = {
+        "   INTRODUCTION   ", "\t2.1 Scope of the document\n", "APPENDIX A: DEFINITIONS AND ABBREVIATIONS",
+        "  Terms and conditions of the agreement between the parties  ", "IV. GENERAL PROVISIONS\r\n",
+    };
+
+    template <typename F>
+    double nanoseconds_per_call(std::size_t iterations, F&& f) {
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < iterations; ++i) {
+            f(i);
+        }
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count() / iterations;
+    }
+
+    std::size_t sink = 0;
+
+    void bench_encoding(const char* kernels) {
+        std::string out;
+        for (const sample& s : SAMPLES) {
+            out.reserve(s.codepoints.size() * 4);
+            double ns = nanoseconds_per_call(2000, [&s, &out](std::size_t) {
+                out.clear();
+                append_utf8(out, s.codepoints.data(), s.codepoints.size());
+                sink += out.size();
+            });
+            std::printf("  utf8 %-9s %-9s %8.3f ns/codepoint\n", s.name, kernels, ns / s.codepoints.size());
+        }
+    }
+
+    void bench_titles(const char* kernels) {
+        std::vector<std::string> titles = TITLES;
+        std::string title;
+        double trim_ns = nanoseconds_per_call(2000000, [&title](std::size_t i) {
+            title = TITLES[i % TITLES.size()];
+            trim(title);
+            sink += title.size();
+        });
+        double case_ns = nanoseconds_per_call(2000000, [&titles](std::size_t i) {
+            sink += is_all_upper_case(titles[i % titles.size()]);
+        });
+        std::printf("  trim              %-9s %8.2f ns/title\n", kernels, trim_ns);
+        std::printf("  is_all_upper_case %-9s %8.2f ns/title\n", kernels, case_ns);
+    }
+
+} // namespace
+
+int main() {
+    // string_utils.hpp before the kernels
+    std::string out;
+    for (const sample& s : SAMPLES) {
+        out.reserve(s.codepoints.size() * 4);
+        double ns = nanoseconds_per_call(2000, [&s, &out](std::size_t) {
+            out.clear();
+            for (int codepoint : s.codepoints) {
+                append_utf8(out, codepoint);
+            }
+            sink += out.size();
+        });
+        std::printf("  utf8 %-9s %-9s %8.3f ns/codepoint\n", s.name, "before", ns / s.codepoints.size());
+    }
+    std::string title;
+    double trim_ns = nanoseconds_per_call(2000000, [&title](std::size_t i) {
+        title = TITLES[i % TITLES.size()];
+        isspace_trim(title);
+        sink += title.size();
+    });
+    double case_ns = nanoseconds_per_call(2000000, [](std::size_t i) {
+        sink += islower_all_upper_case(TITLES[i % TITLES.size()]);
+    });
+    std::printf("  trim              %-9s %8.2f ns/title\n", "before", trim_ns);
+    std::printf("  is_all_upper_case %-9s %8.2f ns/title\n", "before", case_ns);
+
+    for (const char* kernels : {"scalar", "sse4.2", "avx2"}) {
+        if (!use_text_kernels(kernels)) {
+            continue;
+        }
+        bench_encoding(kernels);
+        bench_titles(kernels);
+    }
+    return sink == 0;
+}
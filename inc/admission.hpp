@@ -0,0 +1,99 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#ifndef ADMISSION_QUEUE_SIZE
+#define ADMISSION_QUEUE_SIZE 256
+#endif
+
+// seconds a parse may wait for a slot before it is shed
+#ifndef ADMISSION_QUEUE_TIMEOUT
+#define ADMISSION_QUEUE_TIMEOUT 10
+#endif
+
+// short term page latency above this multiple of the long term one means congestion
+#ifndef ADMISSION_LATENCY_TOLERANCE
+#define ADMISSION_LATENCY_TOLERANCE 2.0
+#endif
+
+#ifndef ADMISSION_DECREASE_FACTOR
+#define ADMISSION_DECREASE_FACTOR 0.9
+#endif
+
+/** Bounds the number of parses in flight with a limit that adapts to latency.
+
+    The limit follows AIMD on the parse latency per page: it grows by
+    about one for every `limit` completions that ran while the limit
+    was fully used, and shrinks by ADMISSION_DECREASE_FACTOR when the
+    short term latency average exceeds the long term one by more than
+    ADMISSION_LATENCY_TOLERANCE, i.e. when extra concurrency only adds
+    queueing inside the parse pool.
+
+    Parses over the limit wait in a bounded FIFO. A full queue, or a
+    wait longer than ADMISSION_QUEUE_TIMEOUT, sheds the request so the
+    caller can answer 503 right away instead of timing out later. Waits
+    are checked on every submit and completion, and by expire(), which
+    callers run once the timeout of a job they queued has passed, so a
+    job is shed in time even while every slot is held by a long parse.
+
+    Thread-safe: jobs are submitted from io threads and completed from
+    parse threads.
+*/
+class admission_controller {
+  public:
+    struct statistics {
+        double limit = 0;
+        std::size_t in_flight = 0;
+        std::size_t queue_depth = 0;
+        std::size_t queue_capacity = 0;
+        std::uint64_t admitted = 0;
+        std::uint64_t shed_queue_full = 0;
+        std::uint64_t shed_timeout = 0;
+        double page_latency_ms = 0;         // short term moving average
+    };
+
+    // disable copy constructor and copy assignment (non-copyable)
+    admission_controller(admission_controller const&) = delete;
+    admission_controller& operator=(admission_controller const&) = delete;
+
+    admission_controller(std::size_t initial_limit, std::size_t max_limit, std::size_t queue_capacity = ADMISSION_QUEUE_SIZE);
+
+    /* Run start once a slot is free, now or later from another thread.
+     * If the job waits too long shed is called instead, also possibly from another thread.
+     * Return false without calling either when the queue is full.
+     * Every started job must be followed by exactly one call to complete().
+     */
+    bool submit(std::function<void()> start, std::function<void()> shed);
+
+    // report a started job as finished, pages is the number of pages parsed
+    void complete(std::chrono::steady_clock::duration elapsed, unsigned int pages, bool ok);
+
+    // shed the queued jobs that waited longer than ADMISSION_QUEUE_TIMEOUT, return when the next one will have
+    std::optional<std::chrono::steady_clock::time_point> expire();
+
+    statistics stats() const;
+
+  private:
+    struct pending_job {
+        std::function<void()> start;
+        std::function<void()> shed;
+        std::chrono::steady_clock::time_point enqueued;
+    };
+
+    mutable std::mutex mutex_;
+    std::deque<pending_job> queue_;
+    statistics stats_;
+    double min_limit_ = 1;
+    double max_limit_;
+    double long_page_latency_ms_ = 0;
+
+    // call with mutex_ held, the oldest jobs are at the front
+    void take_expired(std::chrono::steady_clock::time_point now, std::vector<std::function<void()>>& to_shed);
+};
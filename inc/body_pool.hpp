@@ -0,0 +1,190 @@
+#pragma once
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/http/error.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/optional.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#ifndef BODY_POOL_MEMORY_CAP
+#define BODY_POOL_MEMORY_CAP 512*1024*1024
+#endif
+
+#ifndef BODY_POOL_MIN_BLOCK
+#define BODY_POOL_MIN_BLOCK 64*1024
+#endif
+
+/** A thread-safe pool of request body buffers shared by all workers.
+
+    Buffers are handed out only when a request carries a body and are
+    sized from its Content-Length. Sizes are rounded up to a quarter of
+    the next lower power of two (at most 25% slack) so released buffers
+    can be reused by later requests of a similar size.
+
+    Every byte obtained from the heap, in use or cached, counts against
+    the memory cap. When a request would exceed it, cached buffers are
+    freed first, and if that is not enough the request is refused.
+*/
+class body_buffer_pool {
+  public:
+    struct statistics {
+        std::size_t memory_cap = 0;
+        std::size_t reserved_bytes = 0;     // obtained from the heap, in use or cached
+        std::size_t in_use_bytes = 0;
+        std::size_t peak_in_use_bytes = 0;
+        std::size_t acquired = 0;           // successful acquisitions
+        std::size_t reused = 0;             // acquisitions served from the cache
+        std::size_t rejected = 0;           // acquisitions refused by the memory cap
+    };
+
+    // disable copy constructor and copy assignment (non-copyable)
+    body_buffer_pool(body_buffer_pool const&) = delete;
+    body_buffer_pool& operator=(body_buffer_pool const&) = delete;
+
+    explicit body_buffer_pool(std::size_t memory_cap = BODY_POOL_MEMORY_CAP);
+
+    ~body_buffer_pool();
+
+    // return nullptr if the memory cap does not allow it, capacity is set to the usable size
+    char* acquire(std::size_t size, std::size_t& capacity);
+
+    void release(char* block, std::size_t capacity);
+
+    statistics stats() const;
+
+    static std::size_t block_size(std::size_t size);
+
+  private:
+    mutable std::mutex mutex_;
+    std::map<std::size_t, std::vector<char*>> free_blocks_;
+    statistics stats_;
+
+    // free cached blocks until at least bytes are released, call with mutex_ held
+    void trim(std::size_t bytes);
+};
+
+/** A beast Body whose storage comes from a @ref body_buffer_pool.
+
+    Nothing is allocated until the parser sees a body. A known
+    Content-Length is acquired in one piece, chunked bodies grow
+    geometrically. The storage is returned to the pool when the
+    message is destroyed.
+
+    A refused acquisition fails the read with
+    `boost::asio::error::no_buffer_space`.
+*/
+struct pooled_body {
+    class value_type {
+      public:
+        value_type(value_type const&) = delete;
+        value_type& operator=(value_type const&) = delete;
+
+        explicit value_type(body_buffer_pool& pool) :
+            pool_(&pool) {
+        }
+
+        value_type(value_type&& other) noexcept :
+            pool_(other.pool_),
+            data_(other.data_),
+            size_(other.size_),
+            capacity_(other.capacity_) {
+            other.data_ = nullptr;
+            other.size_ = other.capacity_ = 0;
+        }
+
+        ~value_type() {
+            clear();
+        }
+
+        boost::asio::const_buffer data() const {
+            return {data_, size_};
+        }
+
+        std::size_t size() const {
+            return size_;
+        }
+
+        void clear() {
+            if (data_) {
+                pool_->release(data_, capacity_);
+            }
+            data_ = nullptr;
+            size_ = capacity_ = 0;
+        }
+
+      private:
+        friend struct pooled_body;
+
+        body_buffer_pool* pool_;
+        char* data_ = nullptr;
+        std::size_t size_ = 0;
+        std::size_t capacity_ = 0;
+
+        // make room for n more bytes, return false if the pool refuses
+        bool reserve(std::size_t n) {
+            if (size_ + n <= capacity_) {
+                return true;
+            }
+            std::size_t capacity = 0;
+            char* data = pool_->acquire(std::max(size_ + n, 2 * capacity_), capacity);
+            if (!data) {
+                return false;
+            }
+            if (data_) {
+                std::memcpy(data, data_, size_);
+                pool_->release(data_, capacity_);
+            }
+            data_ = data;
+            capacity_ = capacity;
+            return true;
+        }
+    };
+
+    static std::uint64_t size(value_type const& body) {
+        return body.size();
+    }
+
+    class reader {
+      public:
+        template<bool isRequest, class Fields>
+        reader(boost::beast::http::header<isRequest, Fields>&, value_type& body) :
+            body_(body) {
+        }
+
+        void init(boost::optional<std::uint64_t> const& length, boost::beast::error_code& ec) {
+            if (length && *length > 0 && !body_.reserve(static_cast<std::size_t>(*length))) {
+                ec = boost::asio::error::no_buffer_space;
+                return;
+            }
+            ec = {};
+        }
+
+        template<class ConstBufferSequence>
+        std::size_t put(ConstBufferSequence const& buffers, boost::beast::error_code& ec) {
+            std::size_t n = boost::asio::buffer_size(buffers);
+            if (!body_.reserve(n)) {
+                ec = boost::asio::error::no_buffer_space;
+                return 0;
+            }
+            body_.size_ += boost::asio::buffer_copy(
+                boost::asio::buffer(body_.data_ + body_.size_, n), buffers);
+            ec = {};
+            return n;
+        }
+
+        void finish(boost::beast::error_code& ec) {
+            ec = {};
+        }
+
+      private:
+        value_type& body_;
+    };
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include <zlib.h>
+
+// smaller bodies are sent as they are, compressing them saves less than the headers cost
+#ifndef HTTP_COMPRESSION_THRESHOLD
+#define HTTP_COMPRESSION_THRESHOLD 1024
+#endif
+
+// zlib level, 1 fastest to 9 smallest
+#ifndef HTTP_COMPRESSION_LEVEL
+#define HTTP_COMPRESSION_LEVEL 6
+#endif
+
+enum class CONTENT_ENCODING {IDENTITY, GZIP, DEFLATE};
+
+// the preferred coding the client accepts, gzip over deflate, honouring q=0
+CONTENT_ENCODING negotiate_encoding(std::string_view accept_encoding);
+
+// Content-Encoding header value, null for identity
+const char* encoding_name(CONTENT_ENCODING encoding);
+
+// compress a whole body in place, false and untouched if identity, below the threshold or on error
+bool compress_body(std::string& body, CONTENT_ENCODING encoding);
+
+/** Incremental gzip or deflate (zlib format) compression of a chunked body.
+
+    Every write is sync-flushed so the client can decode all data
+    written so far while the rest is still being parsed; finish writes
+    the stream trailer.
+*/
+class stream_compressor {
+  public:
+    // disable copy constructor and copy assignment (non-copyable)
+    stream_compressor(stream_compressor const&) = delete;
+    stream_compressor& operator=(stream_compressor const&) = delete;
+
+    explicit stream_compressor(CONTENT_ENCODING encoding, int level = HTTP_COMPRESSION_LEVEL);
+
+    ~stream_compressor();
+
+    std::string write(std::string_view data);
+
+    std::string finish();
+
+  private:
+    z_stream stream_{};
+    bool ok_ = false;
+
+    std::string deflate_some(std::string_view data, int flush);
+};
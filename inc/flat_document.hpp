@@ -0,0 +1,111 @@
+#pragma once
+
+#include "pdf_utils.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/** A flat, offset-based encoding of the section tree, read in place.
+
+    Every field is a little-endian uint32, every table starts 4-byte
+    aligned and the table offsets in the header count from the start of
+    the buffer, so a client casts the received bytes to these structs
+    instead of parsing them:
+
+      PDF_Flat_Header
+      PDF_Flat_Section[section_count]       in id order, a pre-order walk
+      PDF_Flat_Paragraph[paragraph_count]   grouped by section
+      PDF_Flat_String[keyword_count]        grouped by paragraph
+      UTF-8 text of all strings, unterminated, string offsets count from here
+
+    Section ids are the ids of the JSON output. The children of a
+    section with a non-zero child_count start at id + 1 and are chained
+    through next_sibling.
+*/
+
+#define PDF_FLAT_VERSION 1
+
+// header flags
+#define PDF_FLAT_TRUNCATED 0x1u
+#define PDF_FLAT_HAS_PAGES 0x2u
+
+// parent_id of the root, next_sibling of a last child
+constexpr std::uint32_t PDF_FLAT_NONE = 0xffffffffu;
+
+struct PDF_Flat_String {
+    std::uint32_t offset;
+    std::uint32_t length;
+};
+
+struct PDF_Flat_Header {
+    char magic[4];              // "PDFT"
+    std::uint32_t version;
+    std::uint32_t flags;
+    std::uint32_t section_count;
+    std::uint32_t paragraph_count;
+    std::uint32_t keyword_count;
+    std::uint32_t sections;     // table offsets
+    std::uint32_t paragraphs;
+    std::uint32_t keywords;
+    std::uint32_t strings;
+    std::uint32_t strings_size;
+    PDF_Flat_String pages;      // the "pages" member of the JSON output, with PDF_FLAT_HAS_PAGES
+};
+
+struct PDF_Flat_Section {
+    std::uint32_t id;
+    std::uint32_t parent_id;
+    std::uint32_t next_sibling;
+    std::uint32_t child_count;
+    PDF_Flat_String title;
+    std::uint32_t first_paragraph;
+    std::uint32_t paragraph_count;
+};
+
+struct PDF_Flat_Paragraph {
+    PDF_Flat_String text;
+    std::uint32_t first_keyword;
+    std::uint32_t keyword_count;
+};
+
+// assigns section ids like format_pdf_document_tree, throws std::length_error past 4 GiB
+std::string format_pdf_document_flat(PDF_Section_Node& doc_root, bool truncated = false, const std::optional<std::vector<unsigned int>>& covered_pages = std::nullopt);
+
+// a checked view of a flat document, nothing is copied
+class PDF_Flat_Document {
+  public:
+    // nullopt unless buffer is 4-byte aligned and every table, string and index is in bounds
+    static std::optional<PDF_Flat_Document> open(std::string_view buffer);
+
+    const PDF_Flat_Header& header() const {
+        return *header_;
+    }
+
+    const PDF_Flat_Section& section(std::uint32_t id) const {
+        return sections_[id];
+    }
+
+    const PDF_Flat_Paragraph& paragraph(std::uint32_t index) const {
+        return paragraphs_[index];
+    }
+
+    const PDF_Flat_String& keyword(std::uint32_t index) const {
+        return keywords_[index];
+    }
+
+    std::string_view text(PDF_Flat_String const& s) const {
+        return std::string_view(strings_ + s.offset, s.length);
+    }
+
+  private:
+    PDF_Flat_Document() = default;
+
+    const PDF_Flat_Header* header_ = nullptr;
+    const PDF_Flat_Section* sections_ = nullptr;
+    const PDF_Flat_Paragraph* paragraphs_ = nullptr;
+    const PDF_Flat_String* keywords_ = nullptr;
+    const char* strings_ = nullptr;
+};
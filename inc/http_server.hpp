@@ -1,36 +1,90 @@
 #pragma once
+#include "admission.hpp"
+#include "body_pool.hpp"
+#include "compression.hpp"
 #include "fields_alloc.hpp"
+#include "job_store.hpp"
+#include "output_format.hpp"
+#include "parse_pool.hpp"
+#include "pdf_stream.hpp"
+#include "pdf_utils.hpp"
+#include "query_string.hpp"
+#include "reactor_registry.hpp"
+#include "result_cache.hpp"
+#include "result_store.hpp"
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
 #include <boost/asio.hpp>
 #include <boost/filesystem.hpp>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
 
 #ifndef BOOST_BEAST_READ_HEADER_BUFFER
 #define BOOST_BEAST_READ_HEADER_BUFFER 8192
 #endif
 
+// maximum request body size, storage comes from the body_buffer_pool
 #ifndef BOOST_BEAST_READ_BODY_BUFFER
 #define BOOST_BEAST_READ_BODY_BUFFER 10*1024*2014
 #endif
 
+#ifndef HTTP_RETRY_AFTER
+#define HTTP_RETRY_AFTER 1
+#endif
+
+#ifndef HTTP_REQUEST_TIMEOUT
+#define HTTP_REQUEST_TIMEOUT 60
+#endif
+
+#ifndef HTTP_KEEP_ALIVE_TIMEOUT
+#define HTTP_KEEP_ALIVE_TIMEOUT 15
+#endif
+
+#ifndef HTTP_MAX_REQUESTS_PER_CONNECTION
+#define HTTP_MAX_REQUESTS_PER_CONNECTION 1000
+#endif
+
+// Services shared by all workers of a server.
+struct http_server_context {
+    parse_pool& parser;
+    body_buffer_pool& bodies;
+    admission_controller& admission;
+    job_store& jobs;
+    result_cache& results;
+    result_store& stored;
+    reactor_registry& registry;     // admission and bodies of every reactor, for /metrics
+};
+
 class http_worker {
   public:
     // disable copy constructor and copy assignment (non-copyable)
     http_worker(http_worker const&) = delete;
     http_worker& operator=(http_worker const&) = delete;
 
-    http_worker(boost::asio::ip::tcp::acceptor& acceptor);
+    http_worker(boost::asio::ip::tcp::acceptor& acceptor, http_server_context& context);
 
     void start();
 
   private:
     using alloc_t = fields_alloc<char>;
-    using request_body_t = boost::beast::http::basic_dynamic_body<boost::beast::flat_static_buffer<BOOST_BEAST_READ_BODY_BUFFER>>;
+    using request_body_t = pooled_body;
+
+    // Opens and parses the requested document, called on a parse thread.
+    using parse_job_t = std::function<std::optional<PDF_Document>(fz_context* ctx, PDF_Parse_Options const& options)>;
+
+    // A whole parse job run on a parse thread, told when it was admitted.
+    using pool_job_t = std::function<void(fz_context* ctx, std::chrono::steady_clock::time_point admitted)>;
 
     // The acceptor used to listen for incoming connections.
     boost::asio::ip::tcp::acceptor& acceptor_;
 
+    // The parse pool, body pool, admission control and jobs shared by all workers.
+    http_server_context& context_;
+
     // The socket for the currently connected client.
     boost::asio::ip::tcp::socket socket_{acceptor_.get_executor().context()};
 
@@ -46,29 +100,155 @@ class http_worker {
     // The timer putting a time limit on requests.
     boost::asio::basic_waitable_timer<std::chrono::steady_clock> request_deadline_{acceptor_.get_executor().context(), (std::chrono::steady_clock::time_point::max)()};
 
+    // The timer shedding queued parses once they waited ADMISSION_QUEUE_TIMEOUT, armed while any is queued.
+    boost::asio::basic_waitable_timer<std::chrono::steady_clock> queue_deadline_{acceptor_.get_executor().context()};
+
+    // Number of requests read on the current connection.
+    unsigned int requests_on_connection_ = 0;
+
+    // Whether the connection stays open after the current response.
+    bool keep_alive_ = false;
+
+    // The decoded path parameter of the current request.
+    std::string request_path_;
+
+    // The response coding the current request accepts.
+    CONTENT_ENCODING accept_encoding_ = CONTENT_ENCODING::IDENTITY;
+
+    // The output format the Accept header of the current request prefers.
+    OUTPUT_FORMAT accept_format_ = OUTPUT_FORMAT::JSON;
+
     // The string-based response message.
     boost::optional<boost::beast::http::response<boost::beast::http::string_body, boost::beast::http::basic_fields<alloc_t>>> string_response_;
 
     // The string-based response serializer.
     boost::optional<boost::beast::http::response_serializer<boost::beast::http::string_body, boost::beast::http::basic_fields<alloc_t>>> string_serializer_;
 
-    // The file-based response message.
+    // A response written from a shared parse result, and the result it points into.
+    std::shared_ptr<const result_cache::result> cached_result_;
+    boost::optional<boost::beast::http::response<boost::beast::http::span_body<char const>, boost::beast::http::basic_fields<alloc_t>>> cached_response_;
+    boost::optional<boost::beast::http::response_serializer<boost::beast::http::span_body<char const>, boost::beast::http::basic_fields<alloc_t>>> cached_serializer_;
+
+    // Cancels the running parse, polled by mupdf on the parse thread.
+    fz_cookie parse_cookie_{};
+
+    // Whether a parse job for the current request has not reported back yet.
+    bool parsing_ = false;
+
+    // Tells apart the connection watch of the current parse from stale ones.
+    unsigned int watch_generation_ = 0;
+
+    // The documents of the current batch request, one cookie each.
+    std::vector<parse_job_t> batch_jobs_;
+    std::deque<fz_cookie> batch_cookies_;
+
+    // Results of an output=array batch, in input order.
+    std::vector<std::string> batch_results_;
+
+    // Batch progress, all counts are document indices.
+    std::size_t batch_next_ = 0;
+    std::size_t batch_running_ = 0;
+    std::size_t batch_done_ = 0;
+    bool batch_ndjson_ = true;
+    std::optional<std::chrono::milliseconds> batch_budget_;
+    PDF_Parse_Options batch_options_;
+
+    // Content type and coding of the chunked response.
+    const char* stream_content_type_ = "application/json";
+    CONTENT_ENCODING stream_encoding_ = CONTENT_ENCODING::IDENTITY;
+
+    // Compresses the lines of an NDJSON batch response.
+    std::optional<stream_compressor> batch_compressor_;
+
+    // The chunked response header, while streaming.
+    boost::optional<boost::beast::http::response<boost::beast::http::empty_body, boost::beast::http::basic_fields<alloc_t>>> stream_response_;
+
+    // The chunked response header serializer.
+    boost::optional<boost::beast::http::response_serializer<boost::beast::http::empty_body, boost::beast::http::basic_fields<alloc_t>>> stream_serializer_;
+
+    // Chunks produced by the parse thread, not written yet.
+    std::deque<std::string> stream_chunks_;
+
+    // The chunk currently being written.
+    std::string stream_chunk_;
+
+    // Body bytes of the chunked response written so far.
+    std::size_t stream_bytes_ = 0;
+
+    // Streaming state, the parse thread is done once stream_done_ is set.
+    bool stream_writing_ = false;
+    bool stream_done_ = false;
+    bool stream_ok_ = false;
+    bool stream_failed_ = false;
+
+    // The file-based response message, a stored result sent with sendfile.
     boost::optional<boost::beast::http::response<boost::beast::http::file_body, boost::beast::http::basic_fields<alloc_t>>> file_response_;
 
     // The file-based response serializer.
     boost::optional<boost::beast::http::response_serializer<boost::beast::http::file_body, boost::beast::http::basic_fields<alloc_t>>> file_serializer_;
 
+    // Body bytes of the file-based response sent so far.
+    off_t file_offset_ = 0;
+
     void accept();
 
     void read_request();
 
-    bool url_decode(const std::string& in, std::string& out);
-
     void process_request(boost::beast::http::request<request_body_t, boost::beast::http::basic_fields<alloc_t>> const& req);
 
-    std::map<std::string, std::string> parse(const std::string &query);
+    // identity names the document in the result cache, nullopt if it is not cacheable
+    void start_parse(parse_job_t parse, query_string const& params, std::optional<std::string> const& identity);
+
+    PDF_Parse_Options with_page_helpers(PDF_Parse_Options options);
+
+    // complete is set when the result covers every selected page
+    std::optional<std::string> parse_to_body(parse_job_t const& parse, fz_context* ctx, PDF_Parse_Options const& options, std::chrono::steady_clock::time_point admitted,
+                                             OUTPUT_FORMAT format = OUTPUT_FORMAT::JSON, bool* complete = nullptr);
+
+    bool admit(pool_job_t job, std::function<void()> shed);
+
+    // shed timed out parses at when, and again at each next timeout while parses are queued
+    void watch_queue(std::chrono::steady_clock::time_point when);
+
+    void admit_or_shed(pool_job_t job);
+
+    void process_batch(boost::beast::http::request<request_body_t, boost::beast::http::basic_fields<alloc_t>> const& req, query_string const& params);
+
+    void run_batch();
+
+    void process_job_request(boost::beast::http::request<request_body_t, boost::beast::http::basic_fields<alloc_t>> const& req, boost::beast::string_view target_path, query_string const& params);
+
+    void submit_job(boost::beast::http::request<request_body_t, boost::beast::http::basic_fields<alloc_t>> const& req, query_string const& params);
+
+    void complete_batch_item(std::size_t index, std::optional<std::string> json, std::string const& error);
+
+    void cancel_parse();
+
+    void watch_connection();
+
+    void send_metrics_response();
+
+    // encoding is the coding json is already compressed with
+    void send_json_response(std::optional<std::string> json, boost::beast::http::status status = boost::beast::http::status::ok, CONTENT_ENCODING encoding = CONTENT_ENCODING::IDENTITY);
+
+    void send_cached_response(std::shared_ptr<const result_cache::result> result);
+
+    // takes over the file descriptor of stored
+    void send_file_response(result_store::hit stored);
+
+    void send_file_body();
+
+    void send_string_response(boost::beast::http::status status, const char* content_type, std::string body, CONTENT_ENCODING encoding = CONTENT_ENCODING::IDENTITY);
+
+    void write_stream_chunk(std::string chunk);
+
+    void end_stream(bool ok);
+
+    void write_next_chunk();
+
+    void send_bad_response(boost::beast::http::status status, std::string const& error, unsigned int retry_after = 0);
 
-    void send_bad_response(boost::beast::http::status status, std::string const& error);
+    void finish_response(boost::beast::error_code ec);
 
     void check_deadline();
 };
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+
+#include <mupdf/fitz.h>
+
+#ifndef JOB_STORE_CAPACITY
+#define JOB_STORE_CAPACITY 1024
+#endif
+
+// bytes of uploaded documents and results held by all jobs
+#ifndef JOB_STORE_MEMORY_CAP
+#define JOB_STORE_MEMORY_CAP 256*1024*1024
+#endif
+
+// seconds a finished job is kept for its result to be fetched
+#ifndef JOB_RESULT_TTL
+#define JOB_RESULT_TTL 600
+#endif
+
+/** Background parse jobs, looked up by id.
+
+    A job is created when it is submitted, runs on the parse pool
+    independently of the connection that submitted it, and keeps its
+    result until JOB_RESULT_TTL seconds after it finished. The store
+    holds at most JOB_STORE_CAPACITY jobs and JOB_STORE_MEMORY_CAP
+    bytes of uploads and results; submissions beyond that are refused.
+
+    Thread-safe: jobs are created and looked up from io threads and
+    finished from parse threads.
+*/
+class job_store {
+  public:
+    enum class STATE {QUEUED, RUNNING, DONE, FAILED};
+
+    struct job {
+        std::string id;
+
+        // the uploaded document, empty for a file path, released once parsed
+        std::string upload;
+
+        // polled by mupdf, aborted when the job is deleted
+        fz_cookie cookie{};
+
+        // progress, written by the parse thread
+        std::atomic<unsigned int> pages_done{0};
+        std::atomic<unsigned int> page_count{0};
+    };
+
+    struct status {
+        STATE state = STATE::QUEUED;
+        unsigned int pages_done = 0;
+        unsigned int page_count = 0;
+        std::string error;
+    };
+
+    struct statistics {
+        std::size_t jobs = 0;
+        std::size_t running = 0;
+        std::size_t memory_bytes = 0;
+        std::uint64_t submitted = 0;
+        std::uint64_t rejected = 0;
+        std::uint64_t expired = 0;
+    };
+
+    // disable copy constructor and copy assignment (non-copyable)
+    job_store(job_store const&) = delete;
+    job_store& operator=(job_store const&) = delete;
+
+    explicit job_store(std::size_t capacity = JOB_STORE_CAPACITY, std::size_t memory_cap = JOB_STORE_MEMORY_CAP);
+
+    // register a new queued job owning upload, null when the store is full
+    std::shared_ptr<job> create(std::string upload);
+
+    // the parse thread picked the job up
+    void start(job& j);
+
+    // store the result, or the error when there is none
+    void finish(job& j, std::optional<std::string> result, std::string const& error);
+
+    std::optional<status> find(std::string const& id);
+
+    // share the result of a DONE job, return its status either way
+    std::optional<status> result(std::string const& id, std::shared_ptr<const std::string>& out);
+
+    // cancel the job if it still runs and drop it, false if unknown
+    bool remove(std::string const& id);
+
+    statistics stats();
+
+  private:
+    struct entry {
+        std::shared_ptr<job> handle;
+        status current;
+        std::shared_ptr<const std::string> result;    // handed out without copying under the lock
+        std::size_t memory_bytes = 0;
+        std::chrono::steady_clock::time_point finished;
+    };
+
+    std::size_t capacity_;
+    std::size_t memory_cap_;
+
+    std::mutex mutex_;
+    std::map<std::string, entry> jobs_;
+    std::mt19937_64 random_;
+    statistics stats_;
+
+    // drop finished jobs older than JOB_RESULT_TTL, called with mutex_ held
+    void expire(std::chrono::steady_clock::time_point now);
+
+    // account a change of an entry's size, called with mutex_ held
+    void resize(entry& e, std::size_t memory_bytes);
+};
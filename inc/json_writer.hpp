@@ -0,0 +1,28 @@
+#pragma once
+
+#include "pdf_utils.hpp"
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Write the section tree as JSON text straight into an output buffer.
+ *
+ * The bytes are exactly those nlohmann::json::dump() produces for the
+ * trees built by add_json_node: keys in sorted order, no whitespace,
+ * only '"', '\\' and control characters escaped, and invalid UTF-8
+ * rejected with an exception. Nothing is allocated per node; the only
+ * allocations are the growth of out.
+ */
+
+// append s as a quoted JSON string, throws std::invalid_argument on invalid UTF-8
+void append_json_string(std::string& out, std::string_view s);
+
+// append the paragraphs as a JSON array
+void append_json_paragraphs(std::string& out, const std::vector<PDF_Paragraph>& paragraphs);
+
+// same bytes as add_json_node(node, id).dump(), numbering sections from id
+void append_json_node(std::string& out, PDF_Section_Node& node, unsigned int& id);
+
+// same bytes as format_pdf_document_tree, appended to out
+void append_json_document(std::string& out, PDF_Section_Node& doc_root, bool truncated = false, const std::optional<std::vector<unsigned int>>& covered_pages = std::nullopt);
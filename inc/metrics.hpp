@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+// stages of handling one document, each gets its own latency histogram
+enum class METRICS_STAGE {OPEN, EXTRACT, CLASSIFY, TREE, SERIALIZE};
+
+/** Process-wide counters and latency histograms in the Prometheus text format.
+
+    Every thread records into its own shard, which only that thread
+    writes, so recording is a few relaxed atomic stores with no lock and
+    no shared cache line. A scrape sums the shards of all threads that
+    ever recorded; shards outlive their threads so counters never go
+    back.
+*/
+class metrics {
+  public:
+    static void observe(METRICS_STAGE stage, std::chrono::steady_clock::duration elapsed);
+
+    // time a parse waited in the admission queue for a slot
+    static void observe_queue_wait(std::chrono::steady_clock::duration wait);
+
+    static void count_pages(unsigned int pages);
+
+    static void count_response(unsigned int status, std::size_t bytes);
+
+    // append all counters and histograms
+    static void write_prometheus(std::string& out);
+
+    // append one gauge or counter owned elsewhere, such as a queue depth
+    static void write_value(std::string& out, const char* name, const char* type, const char* help, double value);
+};
+
+// Observes the time from construction to destruction, not for use inside fz_try.
+class stage_timer {
+  public:
+    stage_timer(stage_timer const&) = delete;
+    stage_timer& operator=(stage_timer const&) = delete;
+
+    explicit stage_timer(METRICS_STAGE stage) :
+        stage_(stage),
+        start_(std::chrono::steady_clock::now()) {
+    }
+
+    ~stage_timer() {
+        metrics::observe(stage_, std::chrono::steady_clock::now() - start_);
+    }
+
+  private:
+    METRICS_STAGE stage_;
+    std::chrono::steady_clock::time_point start_;
+};
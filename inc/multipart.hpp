@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+// One part of a multipart body, both views point into the request body.
+struct multipart_part {
+    std::string_view content_type;
+    std::string_view body;
+};
+
+// return the boundary parameter of a multipart Content-Type value, empty if none
+std::string_view multipart_boundary(std::string_view content_type);
+
+// split a multipart body into its parts without copying, return false if it is malformed
+bool parse_multipart(std::string_view body, std::string_view boundary, std::vector<multipart_part>& parts);
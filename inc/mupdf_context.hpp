@@ -0,0 +1,47 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <mutex>
+
+#include <mupdf/fitz.h>
+
+// bytes of decoded fonts, glyphs and images kept across documents by all threads together
+#ifndef MUPDF_STORE_SIZE
+#define MUPDF_STORE_SIZE FZ_STORE_DEFAULT
+#endif
+
+/** A mupdf base context shared by all parsing threads.
+
+    The base context is created once with fz_locks_context set up and
+    the document handlers registered. Every thread parses with its own
+    fz_clone_context of it: clones have their own exception stack but
+    share the base's resource store, so fonts, glyphs and images
+    decoded for one document stay cached for the next one on any
+    thread, up to MUPDF_STORE_SIZE bytes.
+
+    Every clone must be dropped before this object is destroyed.
+*/
+class shared_mupdf_context {
+  public:
+    // disable copy constructor and copy assignment (non-copyable), mupdf keeps a pointer to the locks
+    shared_mupdf_context(shared_mupdf_context const&) = delete;
+    shared_mupdf_context& operator=(shared_mupdf_context const&) = delete;
+
+    // throw std::runtime_error if mupdf cannot be set up
+    explicit shared_mupdf_context(std::size_t store_size = MUPDF_STORE_SIZE);
+
+    ~shared_mupdf_context();
+
+    // a new context for the calling thread, null on failure, release with fz_drop_context
+    fz_context* clone();
+
+  private:
+    std::array<std::mutex, FZ_LOCK_MAX> locks_;
+    fz_locks_context locks_context_;
+    fz_context* base_ = nullptr;
+
+    static void lock(void* user, int lock);
+
+    static void unlock(void* user, int lock);
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct PDF_Section_Node;
+
+/* The encodings of a parsed document. CBOR and MessagePack carry the
+ * same maps as the JSON output; FLAT is the offset-based layout of
+ * flat_document.hpp, read in place without parsing.
+ */
+enum class OUTPUT_FORMAT {JSON, CBOR, MSGPACK, FLAT};
+
+// the format a format= parameter names: json, cbor, msgpack or flat; nullopt if unknown
+std::optional<OUTPUT_FORMAT> parse_output_format(std::string_view name);
+
+// the format of the Accept header's most preferred known media type, JSON if it names none
+OUTPUT_FORMAT negotiate_format(std::string_view accept);
+
+const char* format_content_type(OUTPUT_FORMAT format);
+
+// serialize the section tree, assigning section ids as format_pdf_document_tree does
+std::string format_pdf_document(PDF_Section_Node& doc_root, OUTPUT_FORMAT format, bool truncated = false, const std::optional<std::vector<unsigned int>>& covered_pages = std::nullopt);
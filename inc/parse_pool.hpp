@@ -0,0 +1,55 @@
+#pragma once
+
+#include "mupdf_context.hpp"
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <cstddef>
+#include <utility>
+
+#include <mupdf/fitz.h>
+
+/** A fixed-size pool of threads dedicated to CPU-bound PDF parsing.
+
+    Every thread lazily clones the shared mupdf context on first use and
+    keeps the clone for the lifetime of the thread, so jobs never share a
+    context, never pay for context creation and handler registration,
+    and find the fonts decoded by earlier jobs in the shared store.
+
+    Jobs are callables taking the thread's `fz_context*`, which may be
+    null if the context could not be created. Results must be handed
+    back to the caller by posting to the caller's own executor.
+*/
+class parse_pool {
+  public:
+    // disable copy constructor and copy assignment (non-copyable)
+    parse_pool(parse_pool const&) = delete;
+    parse_pool& operator=(parse_pool const&) = delete;
+
+    parse_pool(std::size_t num_threads, shared_mupdf_context& mupdf);
+
+    ~parse_pool();
+
+    template<class Job>
+    void post(Job&& job) {
+        boost::asio::post(pool_, [this, job = std::forward<Job>(job)]() mutable {
+            job(thread_context(mupdf_));
+        });
+    }
+
+    std::size_t size() const {
+        return num_threads_;
+    }
+
+    // stop accepting jobs and wait for running ones to finish
+    void join();
+
+  private:
+    std::size_t num_threads_;
+
+    shared_mupdf_context& mupdf_;
+
+    boost::asio::thread_pool pool_;
+
+    // clone of mupdf owned by the calling thread
+    static fz_context* thread_context(shared_mupdf_context& mupdf);
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "pdf_utils.hpp"
+#include <functional>
+#include <optional>
+#include <string>
+
+/** Serializes a document to JSON while it is being parsed.
+
+    In SECTIONS mode the concatenated chunks are byte for byte the output
+    of format_pdf_document_tree. Each top-level section is written with
+    its whole subtree as soon as the next top-level section starts. With
+    a page selection the "pages" key holds the selected pages, written
+    right after the root's id once the page count is known. If fewer
+    pages were parsed, a truncated document, a trailing "parsed_pages"
+    key before "truncated" lists those that were.
+
+    In PAGES mode the output is a flat array with one object per page
+    holding that page's paragraphs, written right after the page is parsed.
+    A truncated document ends the array with a {"truncated":true} element.
+
+    Chunks are handed to the sink on the parsing thread.
+*/
+class pdf_json_streamer {
+  public:
+    enum class MODE {SECTIONS, PAGES};
+
+    using sink_t = std::function<void(std::string&& chunk)>;
+
+    // disable copy constructor and copy assignment (non-copyable), the hooks refer to this
+    pdf_json_streamer(pdf_json_streamer const&) = delete;
+    pdf_json_streamer& operator=(pdf_json_streamer const&) = delete;
+
+    pdf_json_streamer(MODE mode, sink_t sink);
+
+    // options with the hooks added, to pass to parse_pdf_file / parse_pdf_buffer
+    PDF_Parse_Options parse_options(PDF_Parse_Options options);
+
+    // write the rest of the output once parsing succeeded
+    void finish(PDF_Document& document);
+
+  private:
+    MODE mode_;
+    sink_t sink_;
+
+    PDF_Section root_section_;
+    PDF_Section_Node doc_root_;
+    std::optional<PDF_Section_Tree_Builder> tree_builder_;
+
+    // the newest top-level node, its subtree may still grow
+    PDF_Section_Node* top_level_node_ = nullptr;
+    unsigned int next_id_ = 1;
+    bool root_written_ = false;
+    bool has_subnodes_ = false;
+    bool has_pages_ = false;
+
+    // the page selection of the parse, and the pages it covers once the page count is known
+    PDF_Parse_Options selection_;
+    std::optional<std::vector<unsigned int>> selected_pages_;
+
+    void on_section(PDF_Document& document, PDF_Section& section);
+
+    void on_page(unsigned int page_number, const std::vector<TextBlockInformation>& page_blocks);
+
+    void write_root(PDF_Document& document);
+
+    void write_top_level_node();
+};
@@ -1,8 +1,16 @@
 #pragma once
 
+#include <array>
 #include <string>
+#include <string_view>
 #include <optional>
 #include <list>
+#include <deque>
+#include <functional>
+#include <chrono>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include <mupdf/fitz.h>
 
@@ -14,13 +22,55 @@
 #define TITLE_MAX_LENGTH 200
 #endif
 
+// bytes reserved up front for the text of a block, the buffer grows past it and is reused
+#ifndef TEXT_BLOCK_RESERVE
+#define TEXT_BLOCK_RESERVE 4096
+#endif
+
+// a text arena starts with chunks this big and doubles them up to TEXT_ARENA_MAX_CHUNK
+#ifndef TEXT_ARENA_MIN_CHUNK
+#define TEXT_ARENA_MIN_CHUNK 4096
+#endif
+
+#ifndef TEXT_ARENA_MAX_CHUNK
+#define TEXT_ARENA_MAX_CHUNK (1 << 20)
+#endif
+
+// a document is split across threads only with at least this many pages for each
+#ifndef PARALLEL_PAGES_PER_THREAD
+#define PARALLEL_PAGES_PER_THREAD 32
+#endif
+
+/* A font as title formats compare it: by name and style, not by fz_font address,
+ * so the same font loaded through two document handles is the same title font.
+ */
+struct PDF_Font_Identity {
+        std::array<char, 32> name{};        // mupdf keeps at most 31 characters
+        bool bold = false;
+        bool italic = false;
+        bool serif = false;
+        bool monospaced = false;
+
+        PDF_Font_Identity() = default;
+        PDF_Font_Identity(fz_context* ctx, fz_font* font);
+
+        bool operator==(const PDF_Font_Identity& other) const {
+            return name == other.name && bold == other.bold && italic == other.italic &&
+                   serif == other.serif && monospaced == other.monospaced;
+        }
+
+        bool operator!=(const PDF_Font_Identity& other) const {
+            return !(*this == other);
+        }
+};
+
 struct PDF_Title_Format {
         static const double INDENT_DELTA_THRESHOLD;
         enum class CASE {ALL_UPPER, FIRST_ONLY_UPPER};
         enum class PREFIX {NONE, BULLET, ROMAN_NUMBERING, NUMBER_DOT_NUMBERING, ALPHABET_LOWERCASE_NUMBERING, ALPHABET_UPPERCASE_NUMBERING, ARTICLE};
         enum class EMPHASIZE_STYLE {NONE, SINGLE_QUOTE, DOUBLE_QUOTE};
 
-        fz_font *title_font;
+        PDF_Font_Identity title_font;
         CASE title_case = CASE::FIRST_ONLY_UPPER;
         PREFIX prefix = PREFIX::NONE;
         EMPHASIZE_STYLE emphasize_style = EMPHASIZE_STYLE::NONE;
@@ -39,18 +89,83 @@ struct PDF_Title_Format {
         friend std::ostream& operator<<(std::ostream& os, const PDF_Title_Format& tf);
 };
 
+// words stored in a PDF_Text_Arena
+struct PDF_Word_List {
+    const std::string_view* words = nullptr;
+    std::size_t count = 0;
+
+    const std::string_view* begin() const {
+        return words;
+    }
+
+    const std::string_view* end() const {
+        return words + count;
+    }
+
+    std::size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    const std::string_view& front() const {
+        return words[0];
+    }
+
+    // the list without its first word
+    PDF_Word_List tail() const {
+        return count ? PDF_Word_List{words + 1, count - 1} : PDF_Word_List{};
+    }
+};
+
+/** Storage for all the text of a document.
+
+    Text is copied into large chunks once and referenced by string_view
+    everywhere else, nothing is freed before the arena releases every
+    chunk at once. Moving an arena, or adopting it into another one,
+    keeps every view into it valid.
+*/
+class PDF_Text_Arena {
+  public:
+    PDF_Text_Arena() = default;
+    PDF_Text_Arena(PDF_Text_Arena&&) = default;
+    PDF_Text_Arena& operator=(PDF_Text_Arena&&) = default;
+
+    // disable copy constructor and copy assignment (non-copyable), views point into the chunks
+    PDF_Text_Arena(const PDF_Text_Arena&) = delete;
+    PDF_Text_Arena& operator=(const PDF_Text_Arena&) = delete;
+
+    std::string_view store(std::string_view text);
+
+    // an array of count views, filled in by the caller
+    std::string_view* store_words(std::size_t count);
+
+    // take over the chunks of other, its views stay valid for the lifetime of this arena
+    void adopt(PDF_Text_Arena&& other);
+
+  private:
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    char* next_ = nullptr;
+    std::size_t left_ = 0;
+    std::size_t next_chunk_size_ = TEXT_ARENA_MIN_CHUNK;
+
+    void* allocate(std::size_t size, std::size_t align);
+};
+
 struct PDF_Paragraph {
-    std::string paragraph;
-    std::list<std::string> emphasized_words;
+    std::string_view paragraph;
+    PDF_Word_List emphasized_words;
     unsigned int page;
     fz_rect bbox;
 };
 
 struct PDF_Section {
     unsigned int id;
-    std::string title;
+    std::string_view title;
     PDF_Title_Format title_format;
-    std::list<PDF_Paragraph> paragraphs;
+    std::vector<PDF_Paragraph> paragraphs;
 };
 
 struct PDF_Document_Info {
@@ -64,12 +179,17 @@ struct PDF_Document_Info {
     std::string producer;
     std::string create_date;
     std::string modified_date;
+    unsigned int page_count = 0;
 };
 
 struct PDF_Document {
+    PDF_Text_Arena text;        // holds every string_view of the paragraphs and sections below
     PDF_Document_Info document_info;
-    std::list<PDF_Paragraph> prefix_content;
-    std::list<PDF_Section> sections;
+    std::vector<PDF_Paragraph> prefix_content;
+    std::deque<PDF_Section> sections;   // a deque keeps sections in place while the tree points at them
+    bool truncated = false;     // parsing stopped at PDF_Parse_Options::deadline
+    unsigned int parsed_page_count = 0;
+    std::optional<std::vector<unsigned int>> covered_pages;    // pages parsed, in order, set only with a page selection
 };
 
 struct PDF_Section_Node {
@@ -78,20 +198,70 @@ struct PDF_Section_Node {
     PDF_Section_Node* parent_node;
 };
 
+// text views point into the arena the page was extracted into
 struct TextBlockInformation {
     std::optional<PDF_Title_Format> title_format = std::nullopt;
-    std::list<std::string> emphasized_words;
-    std::string partial_paragraph_content;
+    PDF_Word_List emphasized_words;
+    std::string_view partial_paragraph_content;
 
     unsigned int page;
     fz_rect bbox;
+};
+
+// optional hooks called on the parsing thread while the document is built, in page order
+struct PDF_Parse_Options {
+    // setting abort from another thread cancels parsing, the result is nullopt
+    fz_cookie* cookie = nullptr;
+    // no page is started after it, the result is marked truncated
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    // only parse pages in these inclusive ranges, every page when empty
+    std::vector<std::pair<unsigned int, unsigned int>> page_ranges;
+    // stop after parsing this many pages
+    std::optional<unsigned int> max_pages;
 
-    TextBlockInformation();
-    TextBlockInformation(const TextBlockInformation &text_block_information);
-    TextBlockInformation(TextBlockInformation &&text_block_information);
+    // run a task on another thread with that thread's own context, the task may start late or not at all;
+    // large documents then have pages extracted by up to max_helpers threads including the calling one,
+    // each with its own document handle, and added in page order on the calling thread
+    std::function<void(std::function<void(fz_context* ctx)> task)> spawn;
+    unsigned int max_helpers = 0;
+
+    // document info is filled in, no page parsed yet
+    std::function<void(PDF_Document& document)> on_start;
+    // text blocks of a page, before they are added to the document
+    std::function<void(unsigned int page_number, const std::vector<TextBlockInformation>& page_blocks)> on_page;
+    // section was appended to document.sections, every section before it is complete
+    std::function<void(PDF_Document& document, PDF_Section& section)> on_section;
 };
 
+// pages a parse with these options would cover, in order
+std::vector<unsigned int> selected_pages(const PDF_Parse_Options& options, unsigned int page_count);
+
+// number of pages a parse with these options would cover
+unsigned int count_selected_pages(const PDF_Parse_Options& options, unsigned int page_count);
+
 // return nullopt if cant read pdf document
 std::optional<PDF_Document> parse_pdf_file(std::string file_path);
 
+// same as above, using a caller-owned context with document handlers registered
+std::optional<PDF_Document> parse_pdf_file(fz_context* ctx, const std::string& file_path, const PDF_Parse_Options& options = {});
+
+// parse a document held in memory, data must outlive the call, magic is a mime type or file extension
+std::optional<PDF_Document> parse_pdf_buffer(fz_context* ctx, const unsigned char* data, size_t size, const char* magic = "application/pdf", const PDF_Parse_Options& options = {});
+
+// parse an already opened document, the caller keeps ownership of doc
+std::optional<PDF_Document> parse_pdf_document(fz_context* ctx, fz_document* doc, const PDF_Parse_Options& options = {});
+
+// builds the section tree under doc_root one section at a time, in document order
+class PDF_Section_Tree_Builder {
+    public:
+        explicit PDF_Section_Tree_Builder(PDF_Section_Node& doc_root);
+
+        // return the depth of the new node, 1 for children of doc_root
+        unsigned long add_section(PDF_Section& section);
+
+    private:
+        std::list<PDF_Title_Format> title_format_stack;
+        PDF_Section_Node* current_node;
+};
+
 PDF_Section_Node construct_document_tree(PDF_Document& document, PDF_Section &root_section);
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#ifndef QUERY_MAX_PARAMS
+#define QUERY_MAX_PARAMS 16
+#endif
+
+/** The parameters of a request target, split in one pass without allocating.
+
+    Keys and values are views into the target, values stay
+    percent-encoded until url_decode. Parameters without '=' are
+    ignored, and a repeated key takes its last value.
+*/
+class query_string {
+  public:
+    explicit query_string(std::string_view target);
+
+    // raw value of the parameter named key
+    std::optional<std::string_view> find(std::string_view key) const;
+
+    bool contains(std::string_view key) const {
+        return find(key).has_value();
+    }
+
+    // more than QUERY_MAX_PARAMS parameters, the rest were dropped
+    bool overflow() const {
+        return overflow_;
+    }
+
+  private:
+    std::array<std::pair<std::string_view, std::string_view>, QUERY_MAX_PARAMS> params_;
+    std::size_t size_ = 0;
+    bool overflow_ = false;
+};
+
+// decode %xx escapes and '+' into out, reusing its storage, false on a malformed escape
+bool url_decode(std::string_view in, std::string& out);
+
+// a plain unsigned decimal number, nullopt for anything else
+std::optional<unsigned long> parse_unsigned(std::string_view value);
+
+// 1-based page list "1-5,10,20-" as 0-based inclusive ranges, "20-" runs to the last page, false if malformed
+bool parse_page_ranges(std::string_view value, std::vector<std::pair<unsigned int, unsigned int>>& ranges);
+
+// the 0-based ranges sorted and merged as "first-last,...", the same string for every spelling of one selection
+std::string canonical_page_ranges(std::vector<std::pair<unsigned int, unsigned int>> ranges);
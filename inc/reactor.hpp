@@ -0,0 +1,47 @@
+#pragma once
+
+#include "job_store.hpp"
+#include "mupdf_context.hpp"
+#include "reactor_registry.hpp"
+#include "result_cache.hpp"
+#include "result_store.hpp"
+#include <boost/asio/ip/tcp.hpp>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/** One io thread with its own acceptor, workers, parse pool, body pool
+    and admission control.
+
+    Every reactor binds the same endpoint with SO_REUSEPORT and the
+    kernel spreads incoming connections across them, so nothing on the
+    request path is shared between reactors except the job store, the
+    result cache and store, and the mupdf store of decoded fonts and
+    images. Each reactor registers its admission controller and body
+    pool with the registry for /metrics.
+
+    With cpus given, the reactor thread is pinned to the first one and
+    each parse thread to one of its own, before anything else is
+    constructed, so the parse threads of a reactor and the page helpers
+    of a large document run in parallel. Under the kernel's default
+    first-touch policy all of the reactor's own memory (worker buffers,
+    fields_alloc pools, request bodies, mupdf context clones) then comes
+    from the NUMA node of those cpus, given as adjacent cpu numbers.
+*/
+class reactor {
+  public:
+    // disable copy constructor and copy assignment (non-copyable)
+    reactor(reactor const&) = delete;
+    reactor& operator=(reactor const&) = delete;
+
+    // start the reactor thread, throw if it cannot listen on endpoint
+    reactor(boost::asio::ip::tcp::endpoint endpoint, int num_workers, std::size_t num_parse_threads,
+            std::size_t body_memory_cap, job_store& jobs, result_cache& results, result_store& stored, reactor_registry& registry, shared_mupdf_context& mupdf, std::vector<unsigned int> cpus = {});
+
+    ~reactor();
+
+    void join();
+
+  private:
+    std::thread thread_;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "admission.hpp"
+#include "body_pool.hpp"
+#include <list>
+#include <mutex>
+
+/** The admission controllers and body pools of all reactors.
+
+    Every reactor admits parses and buffers bodies on its own, while a
+    scrape of /metrics lands on any one of them; the registry lets it
+    report the sums over the whole server instead of that one reactor.
+
+    Thread-safe: reactors register from their own threads and scrapes
+    read from any io thread.
+*/
+class reactor_registry {
+  public:
+    // keeps a reactor registered until it is destroyed
+    class registration {
+      public:
+        registration(registration const&) = delete;
+        registration& operator=(registration const&) = delete;
+
+        registration(reactor_registry& registry, admission_controller& admission, body_buffer_pool& bodies);
+
+        ~registration();
+
+      private:
+        reactor_registry& registry_;
+        std::list<registration*>::iterator position_;
+        admission_controller& admission_;
+        body_buffer_pool& bodies_;
+
+        friend class reactor_registry;
+    };
+
+    reactor_registry() = default;
+
+    // disable copy constructor and copy assignment (non-copyable)
+    reactor_registry(reactor_registry const&) = delete;
+    reactor_registry& operator=(reactor_registry const&) = delete;
+
+    // summed over all registered reactors, page_latency_ms is their average
+    admission_controller::statistics admission_stats() const;
+
+    // summed over all registered reactors, peak_in_use_bytes is the sum of their peaks
+    body_buffer_pool::statistics body_stats() const;
+
+  private:
+    mutable std::mutex mutex_;
+    std::list<registration*> reactors_;
+};
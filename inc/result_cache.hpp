@@ -0,0 +1,133 @@
+#pragma once
+
+#include "compression.hpp"
+#include "output_format.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// bytes of serialized results kept by all shards together
+#ifndef RESULT_CACHE_MEMORY_CAP
+#define RESULT_CACHE_MEMORY_CAP 256*1024*1024
+#endif
+
+// independently locked parts of the cache, a power of two
+#ifndef RESULT_CACHE_SHARDS
+#define RESULT_CACHE_SHARDS 16
+#endif
+
+// seconds a result is served from the cache after it was parsed
+#ifndef RESULT_CACHE_TTL
+#define RESULT_CACHE_TTL 3600
+#endif
+
+// cache the results of uploaded documents by the SHA-256 of their content, 0 to only cache files
+#ifndef RESULT_CACHE_HASH_UPLOADS
+#define RESULT_CACHE_HASH_UPLOADS 1
+#endif
+
+/** Serialized parse results of recently requested documents.
+
+    A file is identified by its path, inode, size and modification time,
+    so a changed file is parsed again; an upload by the SHA-256 of its
+    content and its size. The key adds the request variant (page selection,
+    output format and response coding) to that identity. All variants of one file land in
+    the same shard, so invalidating a path only locks and scans that one.
+
+    Each shard is an LRU list under its own mutex and holds at most
+    memory_cap / RESULT_CACHE_SHARDS bytes; the least recently used
+    results are evicted past that. Results are shared, so a hit is
+    served without copying and survives a concurrent eviction.
+
+    Thread-safe: looked up from io threads, filled from parse threads.
+*/
+class result_cache {
+  public:
+    struct result {
+        std::string body;
+        CONTENT_ENCODING encoding = CONTENT_ENCODING::IDENTITY;    // coding body is compressed with
+        OUTPUT_FORMAT format = OUTPUT_FORMAT::JSON;
+    };
+
+    struct statistics {
+        std::size_t entries = 0;
+        std::size_t memory_bytes = 0;
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t insertions = 0;
+        std::uint64_t evictions = 0;
+        std::uint64_t expirations = 0;
+        std::uint64_t invalidations = 0;
+    };
+
+    // disable copy constructor and copy assignment (non-copyable)
+    result_cache(result_cache const&) = delete;
+    result_cache& operator=(result_cache const&) = delete;
+
+    explicit result_cache(std::size_t memory_cap = RESULT_CACHE_MEMORY_CAP, std::chrono::seconds ttl = std::chrono::seconds(RESULT_CACHE_TTL));
+
+    // identity of the file at path as it is now, nullopt if it cannot be stat'ed
+    static std::optional<std::string> file_identity(std::string const& path);
+
+    // identity of an uploaded document, nullopt when uploads are not cached
+    static std::optional<std::string> upload_identity(const void* data, std::size_t size);
+
+    // SHA-256 of the bytes, in hex
+    static std::string digest(const void* data, std::size_t size);
+
+    // the key of one variant of the result of a document
+    static std::string make_key(std::string const& identity, std::string_view variant);
+
+    // the part of a key naming the document regardless of its version and variant
+    static std::string_view document_of(std::string_view key);
+
+    // what document_of returns for the keys of the file at path
+    static std::string document_identity(std::string const& path);
+
+    std::shared_ptr<const result> find(std::string const& key);
+
+    // results larger than a shard are not kept
+    void insert(std::string const& key, std::shared_ptr<const result> value);
+
+    // drop every cached result of the file at path, return how many
+    std::size_t invalidate(std::string const& path);
+
+    // drop every cached result, return how many
+    std::size_t clear();
+
+    statistics stats();
+
+  private:
+    struct entry {
+        std::string key;
+        std::shared_ptr<const result> value;
+        std::chrono::steady_clock::time_point expires;
+        std::size_t memory_bytes = 0;
+    };
+
+    struct shard {
+        std::mutex mutex;
+        std::list<entry> lru;   // most recently used first
+        std::unordered_map<std::string_view, std::list<entry>::iterator> index;  // views into entry::key
+        std::size_t memory_bytes = 0;
+        statistics stats;
+    };
+
+    std::size_t shard_memory_cap_;
+    std::chrono::seconds ttl_;
+    std::vector<shard> shards_;
+
+    // all keys of one document map to the same shard
+    shard& shard_of(std::string_view key);
+
+    // called with the shard's mutex held
+    void erase(shard& s, std::list<entry>::iterator it);
+};
@@ -0,0 +1,174 @@
+#pragma once
+
+#include "compression.hpp"
+#include "output_format.hpp"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+// directory of the on-disk result store, empty to keep results in memory only
+#ifndef RESULT_STORE_DIR
+#define RESULT_STORE_DIR ""
+#endif
+
+// bytes of result files kept on disk
+#ifndef RESULT_STORE_DISK_CAP
+#define RESULT_STORE_DISK_CAP 4ULL*1024*1024*1024
+#endif
+
+/** Serialized parse results on local disk, kept across restarts.
+
+    Behind the in-memory result_cache: a result is written here once
+    it is parsed, and a request the memory cache misses is answered
+    from its file with sendfile, never read into user space.
+
+    The directory holds
+      objects/  one file per distinct result body, named by the SHA-256
+                and size of its content, so variants with equal bodies
+                share it
+      index     an append-only log of fixed size records mapping a
+                hash of the cache key to an object; a record with size
+                0 removes the key
+      tmp/      objects being written, renamed into objects/ when whole
+
+    At startup the index is mapped and replayed, rewritten without the
+    removed records, and files no record refers to are deleted. Past
+    RESULT_STORE_DISK_CAP the oldest results are removed first. Writes
+    are not synced: after a crash a record whose object lost its tail
+    is caught by its size and dropped on lookup.
+
+    Thread-safe: looked up from io threads, filled from parse threads.
+*/
+class result_store {
+  public:
+    struct hit {
+        int fd = -1;                // open for reading, owned by the caller
+        std::uint64_t size = 0;
+        CONTENT_ENCODING encoding = CONTENT_ENCODING::IDENTITY;
+        OUTPUT_FORMAT format = OUTPUT_FORMAT::JSON;
+    };
+
+    struct statistics {
+        std::size_t entries = 0;
+        std::uint64_t disk_bytes = 0;
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t writes = 0;
+        std::uint64_t write_errors = 0;
+        std::uint64_t evictions = 0;
+        std::uint64_t invalidations = 0;
+    };
+
+    // disable copy constructor and copy assignment (non-copyable)
+    result_store(result_store const&) = delete;
+    result_store& operator=(result_store const&) = delete;
+
+    // load the store in directory, creating it; an empty directory disables the store
+    explicit result_store(std::string directory = RESULT_STORE_DIR, std::uint64_t disk_cap = RESULT_STORE_DISK_CAP);
+
+    ~result_store();
+
+    bool enabled() const {
+        return index_fd_ >= 0;
+    }
+
+    // open the stored result of a result_cache key
+    std::optional<hit> find(std::string const& key);
+
+    // write body as the result of key, replacing an older one; logs and gives up on I/O errors
+    void insert(std::string const& key, std::string_view body, CONTENT_ENCODING encoding, OUTPUT_FORMAT format);
+
+    // drop every stored result of the file at path, return how many
+    std::size_t invalidate(std::string const& path);
+
+    // drop every stored result, return how many
+    std::size_t clear();
+
+    statistics stats();
+
+  private:
+    // one index entry as written to disk, in host byte order
+    struct record {
+        std::uint64_t key[2];       // the first 128 bits of the SHA-256 of the cache key
+        std::uint64_t document;     // hash of the document part of the key
+        std::array<std::uint8_t, 32> object;    // SHA-256 of the body, names the object file with size
+        std::uint64_t size;         // body size, 0 for a removed key
+        std::uint32_t encoding;
+        std::uint32_t format;
+    };
+    static_assert(sizeof(record) == 72, "index records have a fixed layout");
+
+    using key_t = std::pair<std::uint64_t, std::uint64_t>;
+
+    // the halves are hashes already
+    struct key_hash {
+        std::size_t operator()(key_t const& key) const {
+            return static_cast<std::size_t>(key.first);
+        }
+    };
+
+    struct entry {
+        record stored;
+        std::uint64_t sequence;     // write order, the oldest is evicted first
+    };
+
+    struct object {
+        std::uint64_t size = 0;
+        unsigned int references = 0;
+    };
+
+    std::string directory_;
+    std::uint64_t disk_cap_;
+    int index_fd_ = -1;
+
+    // names of files in tmp/
+    std::atomic<std::uint64_t> temporary_{0};
+
+    std::mutex mutex_;
+    std::unordered_map<key_t, entry, key_hash> entries_;
+    std::map<std::uint64_t, key_t> order_;
+    std::unordered_map<std::string, object> objects_;     // by object_name
+    std::uint64_t sequence_ = 0;
+    std::uint64_t disk_bytes_ = 0;
+    statistics stats_;
+
+    // replay the index into the maps, false if it is unusable
+    bool load(std::string const& index_path);
+
+    // write the live records to a fresh index and open it for appending
+    bool compact(std::string const& index_path);
+
+    // delete object and temporary files no record refers to
+    void remove_orphans();
+
+    // the file name of the body of r, unique to its content and size
+    static std::string object_name(record const& r);
+
+    std::string object_path(std::string const& name) const;
+
+    // the key hash of r
+    static void set_key(record& r, std::string const& key);
+
+    // the following are called with mutex_ held
+
+    // apply one record, objects left unreferenced are deleted if delete_objects
+    void add(record const& r, bool delete_objects);
+
+    void remove(std::unordered_map<key_t, entry, key_hash>::iterator it, bool delete_objects);
+
+    // remove a key and log the removal to the index
+    void erase(std::unordered_map<key_t, entry, key_hash>::iterator it);
+
+    // add a new result, log it and evict past the disk cap
+    void commit(record const& r);
+
+    void append(record const& r);
+};
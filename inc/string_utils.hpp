@@ -1,22 +1,21 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <algorithm>
+#include <cctype>
 #include <nlohmann/json.hpp>
 #include "pdf_utils.hpp"
+#include "text_kernels.hpp"
 
 // trim from start (in place)
 inline void ltrim(std::string& s) {
-    s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](int ch) {
-        return !std::isspace(ch);
-    }));
+    s.erase(0, find_first_not_space(s.data(), s.size()));
 }
 
 // trim from end (in place)
 inline void rtrim(std::string& s) {
-    s.erase(std::find_if(s.rbegin(), s.rend(), [](int ch) {
-        return !std::isspace(ch);
-    }).base(), s.end());
+    s.erase(find_last_not_space(s.data(), s.size()));
 }
 
 // trim from both ends (in place)
@@ -25,6 +24,25 @@ inline void trim(std::string& s) {
     rtrim(s);
 }
 
+// trim from both ends, without copying
+inline std::string_view trim_view(std::string_view s) {
+    s.remove_prefix(find_first_not_space(s.data(), s.size()));
+    return s.substr(0, find_last_not_space(s.data(), s.size()));
+}
+
+// ASCII case-insensitive comparison, for header and media type tokens
+inline bool iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
 // trim from start (copying)
 inline std::string ltrim_copy(std::string s) {
     ltrim(s);
@@ -44,36 +62,30 @@ inline std::string trim_copy(std::string s) {
 }
 
 // return false if lowercase characters exist
-inline bool is_all_upper_case(std::string& s) {
-    return std::none_of(s.begin(), s.end(), &::islower);
+inline bool is_all_upper_case(std::string_view s) {
+    return !has_ascii_lower(s.data(), s.size());
 }
 
 // return false if uppercase characters exist
-inline bool is_all_lower_case(std::string& s) {
-    return std::none_of(s.begin(), s.end(), &isupper);
+inline bool is_all_lower_case(std::string_view s) {
+    return !has_ascii_upper(s.data(), s.size());
 }
 
 // convert Unicode character to UTF-8 encoded string
 inline std::string UnicodeToUTF8(int codepoint) {
     std::string out;
-    if (codepoint <= 0x7f)
-        out.append(1, static_cast<char>(codepoint));
-    else if (codepoint <= 0x7ff) {
-        out.append(1, static_cast<char>(0xc0 | ((codepoint >> 6) & 0x1f)));
-        out.append(1, static_cast<char>(0x80 | (codepoint & 0x3f)));
-    } else if (codepoint <= 0xffff) {
-        out.append(1, static_cast<char>(0xe0 | ((codepoint >> 12) & 0x0f)));
-        out.append(1, static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f)));
-        out.append(1, static_cast<char>(0x80 | (codepoint & 0x3f)));
-    } else {
-        out.append(1, static_cast<char>(0xf0 | ((codepoint >> 18) & 0x07)));
-        out.append(1, static_cast<char>(0x80 | ((codepoint >> 12) & 0x3f)));
-        out.append(1, static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f)));
-        out.append(1, static_cast<char>(0x80 | (codepoint & 0x3f)));
-    }
+    append_utf8(out, codepoint);
     return out;
 }
 
+nlohmann::json add_json_paragraph(PDF_Paragraph& paragraph);
+
 nlohmann::json add_json_node(PDF_Section_Node& node, unsigned int& id);
 
-std::string format_pdf_document_tree(PDF_Section_Node& doc_root);
+// 0-based page numbers as 1-based ranges, "1-5,10"
+std::string format_page_ranges(const std::vector<unsigned int>& pages);
+
+// the whole section tree as a DOM, the source of the CBOR and MessagePack output
+nlohmann::json pdf_document_tree_to_json(PDF_Section_Node& doc_root, bool truncated = false, const std::optional<std::vector<unsigned int>>& covered_pages = std::nullopt);
+
+std::string format_pdf_document_tree(PDF_Section_Node& doc_root, bool truncated = false, const std::optional<std::vector<unsigned int>>& covered_pages = std::nullopt);
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "pdf_utils.hpp"
+#include "text_kernels.hpp"
+#include <cctype>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/* The text of one block, built in place one character at a time.
+ * Emphasized words are contiguous in the content, so they are kept as spans of it
+ * until the block is done. Characters are encoded in batches between word boundaries.
+ * clear() keeps the storage for the next block.
+ */
+class text_block_builder {
+  public:
+    text_block_builder() {
+        content_.reserve(TEXT_BLOCK_RESERVE);
+        pending_.reserve(TEXT_BLOCK_RESERVE);
+    }
+
+    void clear() {
+        content_.clear();
+        pending_.clear();
+        words_.clear();
+    }
+
+    std::string_view content() {
+        flush();
+        return content_;
+    }
+
+    std::size_t size() {
+        flush();
+        return content_.size();
+    }
+
+    // completed emphasized words
+    std::size_t word_count() const {
+        return words_.size();
+    }
+
+    // append normalized, a leading space is dropped; encoding to UTF-8 waits for the next offset needed
+    void append(int c) {
+        if (c == ' ' && content_.empty() && pending_.empty()) {
+            return;
+        }
+        int normalized[NORMALIZE_MAX_CODEPOINTS];
+        std::size_t count = normalize_codepoint(c, normalized);
+        pending_.insert(pending_.end(), normalized, normalized + count);
+    }
+
+    // the emphasized word starts with the next character appended
+    void begin_word() {
+        flush();
+        word_start_ = content_.size();
+    }
+
+    // the emphasized word ends before the next character appended, kept trimmed unless blank
+    void end_word() {
+        flush();
+        std::size_t start = word_start_ + find_first_not_space(content_.data() + word_start_, content_.size() - word_start_);
+        std::size_t end = start + find_last_not_space(content_.data() + start, content_.size() - start);
+        if (end > start) {
+            words_.emplace_back(start, end - start);
+        }
+    }
+
+    std::string_view word(std::size_t i) {
+        return content().substr(words_[i].first, words_[i].second);
+    }
+
+    // the emphasized words as views into stored, the copy of content() kept in arena
+    PDF_Word_List store_words(PDF_Text_Arena& arena, std::string_view stored) const {
+        if (words_.empty()) {
+            return {};
+        }
+        std::string_view* words = arena.store_words(words_.size());
+        for (std::size_t i = 0; i < words_.size(); ++i) {
+            words[i] = stored.substr(words_[i].first, words_[i].second);
+        }
+        return {words, words_.size()};
+    }
+
+  private:
+    std::string content_;
+    std::vector<int> pending_;                                  // codepoints not encoded yet
+    std::vector<std::pair<std::size_t, std::size_t>> words_;    // offset and length in content_
+    std::size_t word_start_ = 0;
+
+    void flush() {
+        append_utf8(content_, pending_.data(), pending_.size());
+        pending_.clear();
+    }
+};
+
+// where the emphasized words of one block stand, kept across its font runs
+template <typename Font>
+struct text_block_emphasis {
+    bool parsing_emphasized_word = false;
+    std::optional<std::size_t> title_prefix_length;     // of the content before the first emphasized word
+    std::optional<Font> title_font;
+};
+
+/* Append one run of characters sharing font, first up to last chained by next, to builder.
+ * prev_font is the font of the last non-space character before the run, across blocks.
+ * is_emphasized(font) is asked at most once per run, and only if the run has a non-space character.
+ */
+template <typename Font, typename Char, typename Is_Emphasized>
+void append_font_run(text_block_builder& builder, text_block_emphasis<Font>& emphasis, Font& prev_font, Font font,
+                     const Char* first, const Char* last, Is_Emphasized&& is_emphasized) {
+    // spaces never start or end an emphasized word, and after the first other character
+    // the font is the same as the previous one, so only that character matters
+    bool visible = false;
+    for (const Char* ch = first; ch != last; ch = ch->next) {
+        if (!visible && !isspace(ch->c)) {
+            visible = true;
+            bool emphasized = is_emphasized(font);
+
+            if (prev_font && emphasis.parsing_emphasized_word) {  // just need to compare to font of previous character
+                if (font != prev_font) {
+                    // add emphasized word to list
+                    builder.end_word();
+                    emphasis.parsing_emphasized_word = false;
+
+                    if (emphasized) {
+                        emphasis.parsing_emphasized_word = true;
+                        builder.begin_word();
+                    }
+                } // else same as previous character, the word goes on
+            } else if (emphasized) {
+                emphasis.parsing_emphasized_word = true;
+                // first time this occured
+                if (!emphasis.title_prefix_length) {
+                    if (!emphasis.title_font) {
+                        emphasis.title_font = font;
+                    }
+
+                    if (builder.size() > 0 && builder.word_count() == 0) {
+                        emphasis.title_prefix_length = builder.size();
+                    }
+                }
+                builder.begin_word();
+            } else if (emphasis.parsing_emphasized_word) { // end of parsing emphasized word
+                builder.end_word();
+                emphasis.parsing_emphasized_word = false;
+            }
+        }
+
+        // add character to partial paragraph content
+        builder.append(ch->c);
+    }
+
+    if (visible) {
+        prev_font = font;
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// map more punctuation and ligatures to plain ASCII, off by default as it changes the extracted text
+#ifndef NORMALIZE_PUNCTUATION
+#define NORMALIZE_PUNCTUATION 0
+#endif
+
+// most codepoints normalize_codepoint writes for one input codepoint
+#define NORMALIZE_MAX_CODEPOINTS 3
+
+/** Byte and codepoint kernels for the hot loops of text extraction.
+
+    Every kernel has a scalar version and, on x86, SSE4.2 and AVX2
+    versions; the best set the CPU supports is picked once at startup.
+    Like the C locale the server runs in, only ASCII is special: bytes
+    of multi-byte UTF-8 sequences are never spaces, upper or lower case.
+*/
+
+// append one Unicode character to out, UTF-8 encoded
+inline void append_utf8(std::string& out, int codepoint) {
+    if (codepoint <= 0x7f)
+        out.push_back(static_cast<char>(codepoint));
+    else if (codepoint <= 0x7ff) {
+        out.push_back(static_cast<char>(0xc0 | ((codepoint >> 6) & 0x1f)));
+        out.push_back(static_cast<char>(0x80 | (codepoint & 0x3f)));
+    } else if (codepoint <= 0xffff) {
+        out.push_back(static_cast<char>(0xe0 | ((codepoint >> 12) & 0x0f)));
+        out.push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f)));
+        out.push_back(static_cast<char>(0x80 | (codepoint & 0x3f)));
+    } else {
+        out.push_back(static_cast<char>(0xf0 | ((codepoint >> 18) & 0x07)));
+        out.push_back(static_cast<char>(0x80 | ((codepoint >> 12) & 0x3f)));
+        out.push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f)));
+        out.push_back(static_cast<char>(0x80 | (codepoint & 0x3f)));
+    }
+}
+
+// append count Unicode characters to out, UTF-8 encoded, runs of ASCII are packed many at a time
+void append_utf8(std::string& out, const int* codepoints, std::size_t count);
+
+// index of the first byte that is not an ASCII space, size if there is none
+std::size_t find_first_not_space(const char* s, std::size_t size);
+
+// one past the last byte that is not an ASCII space, 0 if there is none
+std::size_t find_last_not_space(const char* s, std::size_t size);
+
+bool has_ascii_lower(const char* s, std::size_t size);
+
+bool has_ascii_upper(const char* s, std::size_t size);
+
+// the kernels in use: "avx2", "sse4.2" or "scalar"
+const char* text_kernels_name();
+
+// switch to the named kernels, false if the CPU lacks them; for tests and benchmarks, before any other thread runs
+bool use_text_kernels(const char* name);
+
+/* The codepoints to write for one extracted character, looked up in a table:
+ * curly double quotes become straight ones, and with NORMALIZE_PUNCTUATION
+ * curly single quotes, dashes and latin ligatures become their ASCII spelling.
+ * Return the number of codepoints written to out, at most NORMALIZE_MAX_CODEPOINTS.
+ */
+std::size_t normalize_codepoint(int codepoint, int* out);
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "pdf_utils.hpp"
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+namespace title_prefix_detail {
+
+    constexpr bool is_digit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    constexpr bool all_of(std::string_view s, bool (*pred)(char)) {
+        for (char c : s) {
+            if (!pred(c)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // \d+(\.\d+)*\.? and the number of digit groups in it
+    constexpr bool match_number_dot(std::string_view word, unsigned long& groups) {
+        groups = 0;
+        bool after_digit = false;
+        for (std::size_t i = 0; i < word.size(); ++i) {
+            if (is_digit(word[i])) {
+                groups += after_digit ? 0 : 1;
+                after_digit = true;
+            } else if (word[i] == '.' && after_digit) {
+                after_digit = false;
+            } else {
+                return false;
+            }
+        }
+        // only the last dot may be without digits after it
+        return groups > 0;
+    }
+
+} // namespace title_prefix_detail
+
+/* The kind of bullet or numbering of the first word of a title prefix.
+ * Same result as trying these regular expressions in order:
+ *   |o|•|[*+-]  \([a-z]{1,2}\)  \([A-Z]{1,2}\)  \([ivx]{1,6}\)  \d+(\.\d+)*\.?  [Aa]n?|[Tt]he
+ * numbering_level is set to the number of groups of a NUMBER_DOT_NUMBERING word.
+ */
+constexpr std::optional<PDF_Title_Format::PREFIX> classify_title_prefix(std::string_view word, unsigned long& numbering_level) {
+    if (word.empty() || word == "o" || word == "•" || word == "*" || word == "+" || word == "-") {
+        return PDF_Title_Format::PREFIX::BULLET;
+    }
+
+    if (word.size() >= 3 && word.front() == '(' && word.back() == ')') {
+        std::string_view inner = word.substr(1, word.size() - 2);
+        if (inner.size() <= 2 && title_prefix_detail::all_of(inner, [](char c) { return c >= 'a' && c <= 'z'; })) {
+            return PDF_Title_Format::PREFIX::ALPHABET_LOWERCASE_NUMBERING;
+        }
+        if (inner.size() <= 2 && title_prefix_detail::all_of(inner, [](char c) { return c >= 'A' && c <= 'Z'; })) {
+            return PDF_Title_Format::PREFIX::ALPHABET_UPPERCASE_NUMBERING;
+        }
+        // one or two letters were taken as latin numbering above, longest presentation might be (xviii)
+        if (inner.size() <= 6 && title_prefix_detail::all_of(inner, [](char c) { return c == 'i' || c == 'v' || c == 'x'; })) {
+            return PDF_Title_Format::PREFIX::ROMAN_NUMBERING;
+        }
+        return std::nullopt;
+    }
+
+    unsigned long groups = 0;
+    if (title_prefix_detail::is_digit(word.front())) {
+        if (title_prefix_detail::match_number_dot(word, groups)) {
+            numbering_level = groups;
+            return PDF_Title_Format::PREFIX::NUMBER_DOT_NUMBERING;
+        }
+        return std::nullopt;
+    }
+
+    if (word == "A" || word == "a" || word == "An" || word == "an" || word == "The" || word == "the") {
+        return PDF_Title_Format::PREFIX::ARTICLE;
+    }
+    return std::nullopt;
+}
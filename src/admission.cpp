@@ -0,0 +1,135 @@
+#include "admission.hpp"
+#include "logging.hpp"
+#include "metrics.hpp"
+#include <algorithm>
+
+namespace {
+
+    const double SHORT_TERM_ALPHA = 0.1;
+    const double LONG_TERM_ALPHA = 0.01;
+
+    double to_ms(std::chrono::steady_clock::duration d) {
+        return std::chrono::duration<double, std::milli>(d).count();
+    }
+
+} // namespace
+
+admission_controller::admission_controller(std::size_t initial_limit, std::size_t max_limit, std::size_t queue_capacity) :
+    max_limit_(static_cast<double>(std::max<std::size_t>(max_limit, 1))) {
+    stats_.limit = std::min(std::max(static_cast<double>(initial_limit), min_limit_), max_limit_);
+    stats_.queue_capacity = queue_capacity;
+}
+
+bool admission_controller::submit(std::function<void()> start, std::function<void()> shed) {
+    std::vector<std::function<void()>> to_shed;
+    bool queued = false;
+    bool started = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto now = std::chrono::steady_clock::now();
+        take_expired(now, to_shed);
+        if (stats_.in_flight >= static_cast<std::size_t>(stats_.limit) || !queue_.empty()) {
+            if (queue_.size() >= stats_.queue_capacity) {
+                ++stats_.shed_queue_full;
+                LOG_WARNING << "Shedding parse, queue full: " << queue_.size() << " queued, limit " << stats_.limit;
+            } else {
+                queue_.push_back({std::move(start), std::move(shed), now});
+                queued = true;
+            }
+            stats_.queue_depth = queue_.size();
+        } else {
+            ++stats_.in_flight;
+            ++stats_.admitted;
+            metrics::observe_queue_wait(std::chrono::steady_clock::duration::zero());
+            started = true;
+        }
+    }
+
+    for (auto& expired : to_shed) {
+        expired();
+    }
+    if (started) {
+        start();
+    }
+    return queued || started;
+}
+
+void admission_controller::complete(std::chrono::steady_clock::duration elapsed, unsigned int pages, bool ok) {
+    std::vector<std::function<void()>> to_start;
+    std::vector<std::function<void()>> to_shed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        bool limit_used = stats_.in_flight >= static_cast<std::size_t>(stats_.limit);
+        --stats_.in_flight;
+
+        if (ok) {
+            double page_latency_ms = to_ms(elapsed) / std::max(pages, 1u);
+            if (long_page_latency_ms_ == 0) {
+                long_page_latency_ms_ = stats_.page_latency_ms = page_latency_ms;
+            } else {
+                stats_.page_latency_ms += SHORT_TERM_ALPHA * (page_latency_ms - stats_.page_latency_ms);
+                long_page_latency_ms_ += LONG_TERM_ALPHA * (page_latency_ms - long_page_latency_ms_);
+            }
+
+            if (stats_.page_latency_ms > long_page_latency_ms_ * ADMISSION_LATENCY_TOLERANCE) {
+                // multiplicative decrease, and let the baseline catch up so one spike is not punished twice
+                stats_.limit = std::max(min_limit_, stats_.limit * ADMISSION_DECREASE_FACTOR);
+                long_page_latency_ms_ = (long_page_latency_ms_ + stats_.page_latency_ms) / 2;
+            } else if (limit_used) {
+                // additive increase, about one slot per limit completions
+                stats_.limit = std::min(max_limit_, stats_.limit + 1.0 / stats_.limit);
+            }
+        }
+
+        // shed what waited too long, fill free slots from the rest of the queue
+        auto now = std::chrono::steady_clock::now();
+        take_expired(now, to_shed);
+        while (!queue_.empty() && stats_.in_flight < static_cast<std::size_t>(stats_.limit)) {
+            pending_job job = std::move(queue_.front());
+            queue_.pop_front();
+            ++stats_.in_flight;
+            ++stats_.admitted;
+            metrics::observe_queue_wait(now - job.enqueued);
+            to_start.push_back(std::move(job.start));
+        }
+        stats_.queue_depth = queue_.size();
+    }
+
+    for (auto& shed : to_shed) {
+        shed();
+    }
+    for (auto& start : to_start) {
+        start();
+    }
+}
+
+std::optional<std::chrono::steady_clock::time_point> admission_controller::expire() {
+    std::vector<std::function<void()>> to_shed;
+    std::optional<std::chrono::steady_clock::time_point> next;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        take_expired(std::chrono::steady_clock::now(), to_shed);
+        stats_.queue_depth = queue_.size();
+        if (!queue_.empty()) {
+            next = queue_.front().enqueued + std::chrono::seconds(ADMISSION_QUEUE_TIMEOUT);
+        }
+    }
+
+    for (auto& shed : to_shed) {
+        shed();
+    }
+    return next;
+}
+
+admission_controller::statistics admission_controller::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void admission_controller::take_expired(std::chrono::steady_clock::time_point now, std::vector<std::function<void()>>& to_shed) {
+    while (!queue_.empty() && now - queue_.front().enqueued >= std::chrono::seconds(ADMISSION_QUEUE_TIMEOUT)) {
+        ++stats_.shed_timeout;
+        to_shed.push_back(std::move(queue_.front().shed));
+        queue_.pop_front();
+    }
+}
@@ -0,0 +1,85 @@
+#include "body_pool.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <new>
+
+body_buffer_pool::body_buffer_pool(std::size_t memory_cap) {
+    stats_.memory_cap = memory_cap;
+}
+
+body_buffer_pool::~body_buffer_pool() {
+    for (auto& free_list : free_blocks_) {
+        for (char* block : free_list.second) {
+            delete[] block;
+        }
+    }
+}
+
+std::size_t body_buffer_pool::block_size(std::size_t size) {
+    if (size <= BODY_POOL_MIN_BLOCK) {
+        return BODY_POOL_MIN_BLOCK;
+    }
+    // round up to a multiple of a quarter of the highest power of two below size
+    std::size_t power = BODY_POOL_MIN_BLOCK;
+    while (power <= size / 2) {
+        power *= 2;
+    }
+    std::size_t step = power / 4;
+    return (size + step - 1) / step * step;
+}
+
+char* body_buffer_pool::acquire(std::size_t size, std::size_t& capacity) {
+    capacity = block_size(size);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    char* block = nullptr;
+
+    auto free_list = free_blocks_.find(capacity);
+    if (free_list != free_blocks_.end() && !free_list->second.empty()) {
+        block = free_list->second.back();
+        free_list->second.pop_back();
+        ++stats_.reused;
+    } else {
+        if (stats_.reserved_bytes + capacity > stats_.memory_cap) {
+            trim(stats_.reserved_bytes + capacity - stats_.memory_cap);
+        }
+        if (stats_.reserved_bytes + capacity <= stats_.memory_cap) {
+            block = new (std::nothrow) char[capacity];
+        }
+        if (!block) {
+            ++stats_.rejected;
+            LOG_WARNING << "Body pool exhausted: " << stats_.in_use_bytes << " bytes in use, " << capacity << " bytes requested";
+            return nullptr;
+        }
+        stats_.reserved_bytes += capacity;
+    }
+
+    stats_.in_use_bytes += capacity;
+    stats_.peak_in_use_bytes = std::max(stats_.peak_in_use_bytes, stats_.in_use_bytes);
+    ++stats_.acquired;
+    return block;
+}
+
+void body_buffer_pool::release(char* block, std::size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.in_use_bytes -= capacity;
+    free_blocks_[capacity].push_back(block);
+}
+
+body_buffer_pool::statistics body_buffer_pool::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void body_buffer_pool::trim(std::size_t bytes) {
+    std::size_t released = 0;
+    // largest blocks first, they are the least likely to be reused
+    for (auto free_list = free_blocks_.rbegin(); free_list != free_blocks_.rend() && released < bytes; ++free_list) {
+        while (!free_list->second.empty() && released < bytes) {
+            delete[] free_list->second.back();
+            free_list->second.pop_back();
+            released += free_list->first;
+        }
+    }
+    stats_.reserved_bytes -= released;
+}
@@ -0,0 +1,143 @@
+#include "compression.hpp"
+#include "logging.hpp"
+#include "string_utils.hpp"
+#include <cstdlib>
+
+namespace {
+
+    // windowBits 15 is the zlib format HTTP calls deflate, adding 16 selects the gzip wrapper
+    int window_bits(CONTENT_ENCODING encoding) {
+        return encoding == CONTENT_ENCODING::GZIP ? 15 + 16 : 15;
+    }
+
+} // namespace
+
+CONTENT_ENCODING negotiate_encoding(std::string_view accept_encoding) {
+    bool gzip = false, deflate = false, any = false;
+    bool gzip_refused = false, deflate_refused = false;
+
+    while (!accept_encoding.empty()) {
+        std::size_t comma = accept_encoding.find(',');
+        std::string_view coding = accept_encoding.substr(0, comma);
+        accept_encoding = comma == std::string_view::npos ? std::string_view() : accept_encoding.substr(comma + 1);
+
+        // "gzip;q=0" refuses gzip, any other weight accepts it
+        bool accepted = true;
+        std::size_t semicolon = coding.find(';');
+        if (semicolon != std::string_view::npos) {
+            std::string_view param = trim_view(coding.substr(semicolon + 1));
+            if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+                accepted = std::strtod(std::string(param.substr(2)).c_str(), nullptr) > 0;
+            }
+            coding = coding.substr(0, semicolon);
+        }
+        coding = trim_view(coding);
+
+        if (iequals(coding, "gzip") || iequals(coding, "x-gzip")) {
+            (accepted ? gzip : gzip_refused) = true;
+        } else if (iequals(coding, "deflate")) {
+            (accepted ? deflate : deflate_refused) = true;
+        } else if (coding == "*") {
+            any = accepted;
+        }
+    }
+
+    if (gzip || (any && !gzip_refused)) {
+        return CONTENT_ENCODING::GZIP;
+    }
+    if (deflate || (any && !deflate_refused)) {
+        return CONTENT_ENCODING::DEFLATE;
+    }
+    return CONTENT_ENCODING::IDENTITY;
+}
+
+const char* encoding_name(CONTENT_ENCODING encoding) {
+    switch (encoding) {
+        case CONTENT_ENCODING::GZIP:
+            return "gzip";
+        case CONTENT_ENCODING::DEFLATE:
+            return "deflate";
+        default:
+            return nullptr;
+    }
+}
+
+bool compress_body(std::string& body, CONTENT_ENCODING encoding) {
+    if (encoding == CONTENT_ENCODING::IDENTITY || body.size() < HTTP_COMPRESSION_THRESHOLD) {
+        return false;
+    }
+
+    z_stream stream{};
+    if (deflateInit2(&stream, HTTP_COMPRESSION_LEVEL, Z_DEFLATED, window_bits(encoding), 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        LOG_ERROR << "Cannot initialize compression: " << (stream.msg ? stream.msg : "");
+        return false;
+    }
+
+    // one call into a buffer of the worst case size
+    std::string compressed(deflateBound(&stream, body.size()), '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(body.data());
+    stream.avail_in = static_cast<uInt>(body.size());
+    stream.next_out = reinterpret_cast<Bytef*>(compressed.data());
+    stream.avail_out = static_cast<uInt>(compressed.size());
+    int result = deflate(&stream, Z_FINISH);
+    compressed.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    if (result != Z_STREAM_END) {
+        LOG_ERROR << "Cannot compress response body: zlib error " << result;
+        return false;
+    }
+    body = std::move(compressed);
+    return true;
+}
+
+stream_compressor::stream_compressor(CONTENT_ENCODING encoding, int level) {
+    ok_ = deflateInit2(&stream_, level, Z_DEFLATED, window_bits(encoding), 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    if (!ok_) {
+        LOG_ERROR << "Cannot initialize compression: " << (stream_.msg ? stream_.msg : "");
+    }
+}
+
+stream_compressor::~stream_compressor() {
+    if (ok_) {
+        deflateEnd(&stream_);
+    }
+}
+
+std::string stream_compressor::write(std::string_view data) {
+    return deflate_some(data, Z_SYNC_FLUSH);
+}
+
+std::string stream_compressor::finish() {
+    return deflate_some(std::string_view(), Z_FINISH);
+}
+
+std::string stream_compressor::deflate_some(std::string_view data, int flush) {
+    std::string out;
+    if (!ok_) {
+        return out;
+    }
+
+    stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream_.avail_in = static_cast<uInt>(data.size());
+    out.resize(deflateBound(&stream_, data.size()) + 16);
+    std::size_t produced = 0;
+    for (;;) {
+        stream_.next_out = reinterpret_cast<Bytef*>(&out[produced]);
+        stream_.avail_out = static_cast<uInt>(out.size() - produced);
+        int result = deflate(&stream_, flush);
+        produced = out.size() - stream_.avail_out;
+        if (result == Z_STREAM_ERROR) {
+            LOG_ERROR << "Cannot compress response chunk";
+            ok_ = false;
+            break;
+        }
+        // done once zlib had room to spare, or the stream is complete
+        if (stream_.avail_out > 0 || result == Z_STREAM_END) {
+            break;
+        }
+        out.resize(out.size() * 2);
+    }
+    out.resize(produced);
+    return out;
+}
@@ -0,0 +1,190 @@
+#include "flat_document.hpp"
+#include "string_utils.hpp"
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "the flat document layout is written in host byte order, which must be little-endian"
+#endif
+
+static_assert(sizeof(PDF_Flat_Header) == 52, "flat layout");
+static_assert(sizeof(PDF_Flat_Section) == 32, "flat layout");
+static_assert(sizeof(PDF_Flat_Paragraph) == 16, "flat layout");
+
+namespace {
+
+    constexpr char FLAT_MAGIC[4] = {'P', 'D', 'F', 'T'};
+
+    struct flat_writer {
+        std::vector<PDF_Flat_Section> sections;
+        std::vector<PDF_Flat_Paragraph> paragraphs;
+        std::vector<PDF_Flat_String> keywords;
+        std::string strings;
+
+        static std::uint32_t narrow(std::size_t n) {
+            if (n > std::numeric_limits<std::uint32_t>::max()) {
+                throw std::length_error("document too large for the flat layout");
+            }
+            return static_cast<std::uint32_t>(n);
+        }
+
+        PDF_Flat_String add_string(std::string_view s) {
+            PDF_Flat_String added{narrow(strings.size()), narrow(s.size())};
+            strings.append(s);
+            return added;
+        }
+
+        void add_node(PDF_Section_Node& node, std::uint32_t parent_id) {
+            std::uint32_t id = narrow(sections.size());
+            node.main_section->id = id;
+
+            PDF_Flat_Section section{};
+            section.id = id;
+            section.parent_id = parent_id;
+            section.next_sibling = PDF_FLAT_NONE;
+            section.title = add_string(node.main_section->title);
+            section.first_paragraph = narrow(paragraphs.size());
+            section.paragraph_count = narrow(node.main_section->paragraphs.size());
+            sections.push_back(section);
+
+            for (PDF_Paragraph& paragraph : node.main_section->paragraphs) {
+                paragraphs.push_back({add_string(paragraph.paragraph), narrow(keywords.size()), narrow(paragraph.emphasized_words.size())});
+                for (std::string_view emphasized_word : paragraph.emphasized_words) {
+                    keywords.push_back(add_string(emphasized_word));
+                }
+            }
+
+            if (node.sub_sections) {
+                std::uint32_t previous = PDF_FLAT_NONE;
+                for (PDF_Section_Node& child : node.sub_sections.value()) {
+                    std::uint32_t child_id = narrow(sections.size());
+                    if (previous != PDF_FLAT_NONE) {
+                        sections[previous].next_sibling = child_id;
+                    }
+                    add_node(child, id);
+                    ++sections[id].child_count;
+                    previous = child_id;
+                }
+            }
+        }
+    };
+
+    template <typename T>
+    void append_table(std::string& out, std::vector<T> const& table) {
+        out.append(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(T));
+    }
+
+    bool in_bounds(std::uint64_t offset, std::uint64_t size, std::uint64_t limit) {
+        return offset <= limit && size <= limit - offset;
+    }
+
+} // namespace
+
+std::string format_pdf_document_flat(PDF_Section_Node& doc_root, bool truncated, const std::optional<std::vector<unsigned int>>& covered_pages) {
+    flat_writer writer;
+    writer.add_node(doc_root, PDF_FLAT_NONE);
+
+    PDF_Flat_Header header{};
+    std::memcpy(header.magic, FLAT_MAGIC, sizeof(header.magic));
+    header.version = PDF_FLAT_VERSION;
+    if (truncated) {
+        header.flags |= PDF_FLAT_TRUNCATED;
+    }
+    if (covered_pages) {
+        header.flags |= PDF_FLAT_HAS_PAGES;
+        header.pages = writer.add_string(format_page_ranges(covered_pages.value()));
+    }
+    header.section_count = flat_writer::narrow(writer.sections.size());
+    header.paragraph_count = flat_writer::narrow(writer.paragraphs.size());
+    header.keyword_count = flat_writer::narrow(writer.keywords.size());
+
+    std::size_t size = sizeof(PDF_Flat_Header);
+    header.sections = flat_writer::narrow(size);
+    size += writer.sections.size() * sizeof(PDF_Flat_Section);
+    header.paragraphs = flat_writer::narrow(size);
+    size += writer.paragraphs.size() * sizeof(PDF_Flat_Paragraph);
+    header.keywords = flat_writer::narrow(size);
+    size += writer.keywords.size() * sizeof(PDF_Flat_String);
+    header.strings = flat_writer::narrow(size);
+    header.strings_size = flat_writer::narrow(writer.strings.size());
+    size += writer.strings.size();
+    flat_writer::narrow(size);
+
+    std::string out;
+    out.reserve(size);
+    out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    append_table(out, writer.sections);
+    append_table(out, writer.paragraphs);
+    append_table(out, writer.keywords);
+    out.append(writer.strings);
+    return out;
+}
+
+std::optional<PDF_Flat_Document> PDF_Flat_Document::open(std::string_view buffer) {
+    if (buffer.size() < sizeof(PDF_Flat_Header) || reinterpret_cast<std::uintptr_t>(buffer.data()) % alignof(PDF_Flat_Header) != 0) {
+        return std::nullopt;
+    }
+    const PDF_Flat_Header& h = *reinterpret_cast<const PDF_Flat_Header*>(buffer.data());
+    if (std::memcmp(h.magic, FLAT_MAGIC, sizeof(h.magic)) != 0 || h.version != PDF_FLAT_VERSION) {
+        return std::nullopt;
+    }
+
+    std::uint64_t size = buffer.size();
+    if (h.sections % 4 || h.paragraphs % 4 || h.keywords % 4 ||
+        !in_bounds(h.sections, std::uint64_t(h.section_count) * sizeof(PDF_Flat_Section), size) ||
+        !in_bounds(h.paragraphs, std::uint64_t(h.paragraph_count) * sizeof(PDF_Flat_Paragraph), size) ||
+        !in_bounds(h.keywords, std::uint64_t(h.keyword_count) * sizeof(PDF_Flat_String), size) ||
+        !in_bounds(h.strings, h.strings_size, size) ||
+        h.section_count == 0) {
+        return std::nullopt;
+    }
+
+    PDF_Flat_Document document;
+    document.header_ = &h;
+    document.sections_ = reinterpret_cast<const PDF_Flat_Section*>(buffer.data() + h.sections);
+    document.paragraphs_ = reinterpret_cast<const PDF_Flat_Paragraph*>(buffer.data() + h.paragraphs);
+    document.keywords_ = reinterpret_cast<const PDF_Flat_String*>(buffer.data() + h.keywords);
+    document.strings_ = buffer.data() + h.strings;
+
+    // once open, no accessor can read out of bounds
+    auto valid_string = [&h](PDF_Flat_String const& s) {
+        return in_bounds(s.offset, s.length, h.strings_size);
+    };
+    if ((h.flags & PDF_FLAT_HAS_PAGES) && !valid_string(h.pages)) {
+        return std::nullopt;
+    }
+    for (std::uint32_t i = 0; i < h.section_count; ++i) {
+        PDF_Flat_Section const& s = document.sections_[i];
+        if (s.id != i || !valid_string(s.title) ||
+            (i == 0 ? s.parent_id != PDF_FLAT_NONE : s.parent_id >= i) ||
+            (s.next_sibling != PDF_FLAT_NONE && (s.next_sibling <= i || s.next_sibling >= h.section_count)) ||
+            (s.child_count && i + 1 >= h.section_count) ||
+            !in_bounds(s.first_paragraph, s.paragraph_count, h.paragraph_count)) {
+            return std::nullopt;
+        }
+    }
+    // the children of every section are where child_count says, so a walk never leaves the table
+    for (std::uint32_t i = 0; i < h.section_count; ++i) {
+        std::uint32_t child = i + 1;
+        for (std::uint32_t n = document.sections_[i].child_count; n > 0; --n) {
+            if (child >= h.section_count || document.sections_[child].parent_id != i ||
+                (n == 1) != (document.sections_[child].next_sibling == PDF_FLAT_NONE)) {
+                return std::nullopt;
+            }
+            child = document.sections_[child].next_sibling;
+        }
+    }
+    for (std::uint32_t i = 0; i < h.paragraph_count; ++i) {
+        PDF_Flat_Paragraph const& p = document.paragraphs_[i];
+        if (!valid_string(p.text) || !in_bounds(p.first_keyword, p.keyword_count, h.keyword_count)) {
+            return std::nullopt;
+        }
+    }
+    for (std::uint32_t i = 0; i < h.keyword_count; ++i) {
+        if (!valid_string(document.keywords_[i])) {
+            return std::nullopt;
+        }
+    }
+    return document;
+}
@@ -1,22 +1,111 @@
 #include "http_server.hpp"
+#include "compression.hpp"
 #include "logging.hpp"
+#include "metrics.hpp"
+#include "multipart.hpp"
+#include "output_format.hpp"
 #include "pdf_utils.hpp"
+#include "query_string.hpp"
 #include "string_utils.hpp"
 #include <boost/beast/core.hpp>
+#include <cerrno>
 #include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <limits>
 #include <list>
-#include <regex>
 #include <memory>
 #include <string>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 #include "pdf_utils.hpp"
 
-http_worker::http_worker(boost::asio::ip::tcp::acceptor& acceptor) :
-    acceptor_(acceptor){
+http_worker::http_worker(boost::asio::ip::tcp::acceptor& acceptor, http_server_context& context) :
+    acceptor_(acceptor),
+    context_(context) {
 }
 
+namespace {
+
+    // Runs on a parse thread: parsed document -> section tree -> body in format
+    std::optional<std::string> serialize_pdf_document(std::optional<PDF_Document> pdf_doc, OUTPUT_FORMAT format) {
+        if (!pdf_doc) {
+            return std::nullopt;
+        }
+
+        PDF_Document& pdf_document = pdf_doc.value();
+        PDF_Section root_section;
+        root_section.id = 0;
+        root_section.title = pdf_document.document_info.title;
+        root_section.paragraphs = std::move(pdf_document.prefix_content);
+        std::chrono::steady_clock::time_point tree_start = std::chrono::steady_clock::now();
+        PDF_Section_Node doc_root = construct_document_tree(pdf_document, root_section);
+        metrics::observe(METRICS_STAGE::TREE, std::chrono::steady_clock::now() - tree_start);
+
+        stage_timer timer(METRICS_STAGE::SERIALIZE);
+        return format_pdf_document(doc_root, format, pdf_document.truncated, pdf_document.covered_pages);
+    }
+
+    std::string job_status_to_json(std::string const& id, job_store::status const& status) {
+        static const char* const STATE_NAMES[] = {"queued", "running", "done", "failed"};
+        nlohmann::json json_job_status;
+        json_job_status["id"] = id;
+        json_job_status["state"] = STATE_NAMES[static_cast<int>(status.state)];
+        json_job_status["pages_done"] = status.pages_done;
+        json_job_status["page_count"] = status.page_count;
+        if (!status.error.empty()) {
+            json_job_status["error"] = status.error;
+        }
+        return json_job_status.dump();
+    }
+
+    /* the optional parameters bounding a parse, return an error message if one is malformed
+     *   - budget_ms : stop parsing after this time and return what was parsed, marked truncated
+     *   - pages : only parse these pages, e.g. 1-5,10 ; the result reports the pages covered
+     *   - max_pages : stop after parsing this many pages
+     */
+    const char* read_parse_params(query_string const& params, PDF_Parse_Options& options, std::optional<std::chrono::milliseconds>& budget) {
+        std::optional<std::string_view> budget_ms = params.find("budget_ms");
+        if (budget_ms) {
+            std::optional<unsigned long> ms = parse_unsigned(budget_ms.value());
+            if (!ms) {
+                return "Malformed budget_ms parameter\r\n";
+            }
+            budget = std::chrono::milliseconds(ms.value());
+        }
+
+        std::optional<std::string_view> pages = params.find("pages");
+        std::string decoded_pages;
+        if (pages && (!url_decode(pages.value(), decoded_pages) || !parse_page_ranges(decoded_pages, options.page_ranges))) {
+            return "Malformed pages parameter\r\n";
+        }
+
+        std::optional<std::string_view> max_pages = params.find("max_pages");
+        if (max_pages) {
+            std::optional<unsigned long> n = parse_unsigned(max_pages.value());
+            if (!n || n.value() > std::numeric_limits<unsigned int>::max()) {
+                return "Malformed max_pages parameter\r\n";
+            }
+            options.max_pages = static_cast<unsigned int>(n.value());
+        }
+        return nullptr;
+    }
+
+    // the page selection as parsed, so spellings of the same selection share a cache entry
+    std::string page_selection_variant(PDF_Parse_Options const& options) {
+        std::string variant = "pages=" + canonical_page_ranges(options.page_ranges);
+        variant += "&max_pages=";
+        if (options.max_pages) {
+            variant += std::to_string(options.max_pages.value());
+        }
+        return variant;
+    }
+
+} // namespace
+
 void http_worker::start() {
     accept();
     check_deadline();
@@ -27,6 +116,7 @@ void http_worker::accept() {
     boost::beast::error_code ec;
     socket_.close(ec);
     buffer_.consume(buffer_.size());
+    requests_on_connection_ = 0;
 
     acceptor_.async_accept(
         socket_,
@@ -36,10 +126,6 @@ void http_worker::accept() {
             accept();
         } else {
             LOG_INFO << "Accepted request from " << socket_.remote_endpoint().address() << ":" << socket_.remote_endpoint().port();
-
-            // Request must be fully processed within 60 seconds.
-            request_deadline_.expires_after(std::chrono::seconds(60));
-
             read_request();
         }
     });
@@ -54,149 +140,180 @@ void http_worker::read_request() {
     // forwarded to the message object. A single argument
     // is forwarded to the body constructor.
     //
-    // We construct the dynamic body with a 10MB limit
-    // to prevent vulnerability to buffer attacks.
+    // The body only takes storage from the shared pool once
+    // the request turns out to have one, and is limited to
+    // BOOST_BEAST_READ_BODY_BUFFER to prevent vulnerability
+    // to buffer attacks.
     //
     parser_.emplace(
         std::piecewise_construct,
-        std::make_tuple(),
+        std::forward_as_tuple(context_.bodies),
         std::make_tuple(alloc_));
+    parser_->body_limit(BOOST_BEAST_READ_BODY_BUFFER);
+
+    // An idle connection must start sending the next request within the keep-alive timeout.
+    // Bytes of pipelined requests are already waiting in buffer_.
+    request_deadline_.expires_after(std::chrono::seconds(HTTP_KEEP_ALIVE_TIMEOUT));
 
-    boost::beast::http::async_read(socket_,
-                                   buffer_,
-                                   *parser_,
+    boost::beast::http::async_read_header(socket_,
+                                          buffer_,
+                                          *parser_,
     [this](boost::beast::error_code ec, std::size_t) {
         if (ec) {
-            LOG_ERROR << "Error code: " << ec.value() << " " << ec.message();
+            if (ec != boost::beast::http::error::end_of_stream) {
+                LOG_ERROR << "Error code: " << ec.value() << " " << ec.message();
+            }
             accept();
-        } else {
-            process_request(parser_->get());
+            return;
         }
+
+        // Request must be fully processed within HTTP_REQUEST_TIMEOUT seconds.
+        request_deadline_.expires_after(std::chrono::seconds(HTTP_REQUEST_TIMEOUT));
+
+        boost::beast::http::async_read(socket_,
+                                       buffer_,
+                                       *parser_,
+        [this](boost::beast::error_code ec, std::size_t) {
+            if (ec == boost::beast::http::error::body_limit ||
+                ec == boost::beast::http::error::buffer_overflow) {
+                // the rest of the body is still on the wire, so close after answering
+                keep_alive_ = false;
+                send_bad_response(
+                    boost::beast::http::status::payload_too_large,
+                    "Request body too large\r\n");
+            } else if (ec == boost::asio::error::no_buffer_space) {
+                // the body pool is at its memory cap
+                keep_alive_ = false;
+                send_bad_response(
+                    boost::beast::http::status::service_unavailable,
+                    "Server is out of request buffers\r\n",
+                    HTTP_RETRY_AFTER);
+            } else if (ec) {
+                LOG_ERROR << "Error code: " << ec.value() << " " << ec.message();
+                accept();
+            } else {
+                // honour the client's Connection header, up to the per-connection limit
+                ++requests_on_connection_;
+                keep_alive_ = parser_->get().keep_alive() &&
+                              requests_on_connection_ < HTTP_MAX_REQUESTS_PER_CONNECTION;
+                process_request(parser_->get());
+            }
+        });
     });
 }
 
-bool http_worker::url_decode(const std::string& in, std::string& out)
-{
-  out.clear();
-  out.reserve(in.size());
-  for (std::size_t i = 0; i < in.size(); ++i)
-  {
-    if (in[i] == '%')
-    {
-      if (i + 3 <= in.size())
-      {
-        int value = 0;
-        std::istringstream is(in.substr(i + 1, 2));
-        if (is >> std::hex >> value)
-        {
-          out += static_cast<char>(value);
-          i += 2;
-        }
-        else
-        {
-          return false;
-        }
-      }
-      else
-      {
-        return false;
-      }
+void http_worker::process_request(boost::beast::http::request<request_body_t, boost::beast::http::basic_fields<alloc_t>> const& req) {
+    boost::beast::string_view target_path = req.target().substr(0, req.target().find('?'));
+    boost::beast::string_view accept_encoding = req[boost::beast::http::field::accept_encoding];
+    accept_encoding_ = negotiate_encoding(std::string_view(accept_encoding.data(), accept_encoding.size()));
+    boost::beast::string_view accept = req[boost::beast::http::field::accept];
+    accept_format_ = negotiate_format(std::string_view(accept.data(), accept.size()));
+
+    query_string params(std::string_view(req.target().data(), req.target().size()));
+    if (params.overflow()) {
+        send_bad_response(
+            boost::beast::http::status::bad_request,
+            "Too many query parameters\r\n");
+        return;
     }
-    else if (in[i] == '+')
-    {
-      out += ' ';
+
+    if (target_path == "/batch") {
+        process_batch(req, params);
+        return;
     }
-    else
-    {
-      out += in[i];
+    if (target_path == "/jobs" || target_path.starts_with("/jobs/")) {
+        process_job_request(req, target_path, params);
+        return;
     }
-  }
-  return true;
-}
-
-std::map<std::string, std::string> http_worker::parse(const std::string& query) {
-    std::map<std::string, std::string> data;
-    std::regex pattern("([\\w+%]+)=([^&]*)");
-    auto words_begin = std::sregex_iterator(query.begin(), query.end(), pattern);
-    auto words_end = std::sregex_iterator();
-
-    for (std::sregex_iterator i = words_begin; i != words_end; i++)
-    {
-        std::string key = (*i)[1].str();
-        std::string value = (*i)[2].str();
-        data[key] = value;
+    if (target_path == "/metrics" && req.method() == boost::beast::http::verb::get) {
+        send_metrics_response();
+        return;
+    }
+    if (target_path == "/cache" && req.method() == boost::beast::http::verb::delete_) {
+        // DELETE /cache?path=<file> drops the results of one file, DELETE /cache all of them
+        std::size_t invalidated = 0;
+        if (std::optional<std::string_view> path = params.find("path")) {
+            std::string decoded_path;
+            if (!url_decode(path.value(), decoded_path)) {
+                send_bad_response(
+                    boost::beast::http::status::bad_request,
+                    "Malformed path parameter\r\n");
+                return;
+            }
+            invalidated = context_.results.invalidate(decoded_path) + context_.stored.invalidate(decoded_path);
+        } else {
+            invalidated = context_.results.clear() + context_.stored.clear();
+        }
+        nlohmann::json json_invalidated;
+        json_invalidated["invalidated"] = invalidated;
+        send_json_response(json_invalidated.dump());
+        return;
     }
 
-    return data;
-}
-
-void http_worker::process_request(boost::beast::http::request<request_body_t, boost::beast::http::basic_fields<alloc_t>> const& req) {
     switch (req.method()) {
         case boost::beast::http::verb::get: {
             /* request parameters:
              *   - required: p   : pdf file path
              *   - optional: opw : owner password
              *   - optional: upw : user password
+             *   - optional: stream : sections|pages, chunked response written while parsing
+             *   - optional: budget_ms : stop parsing after this time and return what was parsed, marked truncated
+             *   - optional: pages : only parse these pages, e.g. 1-5,10 ; max_pages : stop after this many pages
              */
-                boost::beast::string_view target_pdf_file(req.target());
-                std::map<std::string, std::string> params = parse(target_pdf_file.to_string());
-                std::string request_path;
-                url_decode(params.at("path"), request_path);
-                LOG_INFO << "Processing request from " << socket_.remote_endpoint().address() << ":" << socket_.remote_endpoint().port() << " PDF file: " << request_path;
-
-                // Create PDFDoc
-                char* owner_password = nullptr;
-                if (params.find("opw") != params.end()) {
-                    owner_password = new char[params.at("opw").length()];
-                    std::strcpy(owner_password, params.at("opw").c_str());
+                std::optional<std::string_view> path = params.find("path");
+                if (!path) {
+                    send_bad_response(
+                        boost::beast::http::status::bad_request,
+                        "Missing path parameter\r\n");
+                    break;
                 }
-                char* user_password = nullptr;
-                if (params.find("upw") != params.end()) {
-                    user_password = new char[params.at("upw").length()];
-                    std::strcpy(user_password, params.at("upw").c_str());
+                // decoded into a buffer kept across requests, its capacity is reused
+                if (!url_decode(path.value(), request_path_)) {
+                    send_bad_response(
+                        boost::beast::http::status::bad_request,
+                        "Malformed path parameter\r\n");
+                    break;
                 }
+                LOG_INFO << "Processing request from " << socket_.remote_endpoint().address() << ":" << socket_.remote_endpoint().port() << " PDF file: " << request_path_;
+
+                // request_path_ is not touched again until the parse reported back
+                start_parse([this](fz_context* ctx, PDF_Parse_Options const& options) {
+                    return parse_pdf_file(ctx, request_path_, options);
+                }, params, result_cache::file_identity(request_path_));
+            }
+            break;
 
-                std::optional<PDF_Document> pdf_doc = parse_pdf_file(request_path);
-                PDF_Section_Node doc_root;
-                PDF_Document pdf_document;
-                PDF_Section root_section;
-                root_section.id = 0;
-                if (pdf_doc) {
-                    pdf_document = pdf_doc.value();
-                    root_section.title = pdf_document.document_info.title;
-                    root_section.paragraphs = pdf_document.prefix_content;
-                    doc_root = construct_document_tree(pdf_document, root_section);
+        case boost::beast::http::verb::post: {
+            /* request body: the pdf document itself, plain or chunked
+             * optional Content-Type header: mime type of the document, defaults to application/pdf
+             * request parameters: same optional ones as GET
+             */
+                boost::asio::const_buffer body = req.body().data();
+                if (body.size() == 0) {
+                    send_bad_response(
+                        boost::beast::http::status::bad_request,
+                        "Empty request body\r\n");
+                    break;
                 }
 
-                if (owner_password) {
-                    delete[] owner_password;
+                std::string magic = "application/pdf";
+                auto content_type = req.find(boost::beast::http::field::content_type);
+                if (content_type != req.end() &&
+                    !boost::beast::iequals(content_type->value(), "application/octet-stream")) {
+                    magic = content_type->value().to_string();
                 }
+                LOG_INFO << "Processing request from " << socket_.remote_endpoint().address() << ":" << socket_.remote_endpoint().port() << " PDF upload: " << body.size() << " bytes";
 
-                if (user_password) {
-                    delete[] user_password;
+                // the content type picks the document handler, so it is part of the identity
+                std::optional<std::string> identity = result_cache::upload_identity(body.data(), body.size());
+                if (identity) {
+                    identity.value() += ":" + magic;
                 }
 
-                string_response_.emplace(
-                            std::piecewise_construct,
-                            std::make_tuple(),
-                            std::make_tuple(alloc_));
-                string_response_->result(boost::beast::http::status::ok);
-                string_response_->keep_alive(false);
-                string_response_->set(boost::beast::http::field::content_type, "application/json");
-                string_response_->body() = pdf_doc ? format_pdf_document_tree(doc_root) : "{}";
-                string_response_->prepare_payload();
-                string_serializer_.emplace(*string_response_);
-
-                boost::beast::http::async_write(
-                            socket_,
-                            *string_serializer_,
-                            [this](boost::beast::error_code ec, std::size_t)
-                            {
-                                socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_send, ec);
-                                string_serializer_.reset();
-                                string_response_.reset();
-                                accept();
-                            });
+                // The body stays in parser_ until the response is written, so mupdf reads it in place.
+                start_parse([body, magic](fz_context* ctx, PDF_Parse_Options const& options) {
+                    return parse_pdf_buffer(ctx, static_cast<const unsigned char*>(body.data()), body.size(), magic.c_str(), options);
+                }, params, identity);
             }
             break;
 
@@ -210,18 +327,889 @@ void http_worker::process_request(boost::beast::http::request<request_body_t, bo
     }
 }
 
+void http_worker::start_parse(parse_job_t parse, query_string const& params, std::optional<std::string> const& identity) {
+    PDF_Parse_Options options;
+    std::optional<std::chrono::milliseconds> budget;
+    if (const char* error = read_parse_params(params, options, budget)) {
+        send_bad_response(
+            boost::beast::http::status::bad_request,
+            error);
+        return;
+    }
+
+    std::string_view stream = params.find("stream").value_or("");
+    bool buffered = stream != "sections" && stream != "pages" && stream != "1";
+
+    // format= overrides the Accept header; streamed responses are always JSON
+    OUTPUT_FORMAT format = buffered ? accept_format_ : OUTPUT_FORMAT::JSON;
+    if (std::optional<std::string_view> format_name = params.find("format")) {
+        std::optional<OUTPUT_FORMAT> named = parse_output_format(format_name.value());
+        if (!named || (!buffered && named.value() != OUTPUT_FORMAT::JSON)) {
+            send_bad_response(
+                boost::beast::http::status::bad_request,
+                named ? "Streamed responses are JSON only\r\n" : "Malformed format parameter\r\n");
+            return;
+        }
+        format = named.value();
+    }
+
+    // The page selection, the format and the coding change the body. A budget only matters when it
+    // cut the parse short, and truncated results are never cached.
+    std::string cache_key;
+    if (buffered && identity) {
+        std::string variant = page_selection_variant(options);
+        variant += "&format=";
+        variant += std::to_string(static_cast<int>(format));
+        variant += "&encoding=";
+        variant += std::to_string(static_cast<int>(accept_encoding_));
+        cache_key = result_cache::make_key(identity.value(), variant);
+
+        if (std::shared_ptr<const result_cache::result> cached = context_.results.find(cache_key)) {
+            send_cached_response(std::move(cached));
+            return;
+        }
+        if (std::optional<result_store::hit> stored = context_.stored.find(cache_key)) {
+            send_file_response(stored.value());
+            return;
+        }
+    }
+
+    // The parse thread polls the cookie, it is aborted on deadline or disconnect.
+    parse_cookie_ = fz_cookie();
+    parsing_ = true;
+    stream_content_type_ = "application/json";
+    stream_encoding_ = accept_encoding_;
+    watch_connection();
+
+    options.cookie = &parse_cookie_;
+    if (budget) {
+        options.deadline = std::chrono::steady_clock::now() + budget.value();
+    }
+
+    // compression runs on the parse thread too, not on this worker's io thread
+    CONTENT_ENCODING encoding = accept_encoding_;
+
+    if (buffered) {
+        // Parse on the pool, then serialize the response back on this worker's executor.
+        admit_or_shed([this, parse, options, encoding, format, cache_key](fz_context* ctx, std::chrono::steady_clock::time_point admitted) {
+            bool complete = false;
+            std::optional<std::string> body = parse_to_body(parse, ctx, with_page_helpers(options), admitted, format, &complete);
+            if (!body) {
+                boost::asio::post(socket_.get_executor(), [this]() {
+                    send_json_response(std::nullopt);
+                });
+                return;
+            }
+
+            // the response is written straight from the shared result, cached or not
+            std::shared_ptr<result_cache::result> result = std::make_shared<result_cache::result>();
+            result->body = std::move(body.value());
+            result->format = format;
+            if (compress_body(result->body, encoding)) {
+                result->encoding = encoding;
+            }
+            bool store = complete && !cache_key.empty();
+            if (store) {
+                context_.results.insert(cache_key, result);
+            }
+            boost::asio::post(socket_.get_executor(), [this, result]() mutable {
+                send_cached_response(std::move(result));
+            });
+
+            // written to disk after the response is on its way, the result is shared with it
+            if (store) {
+                context_.stored.insert(cache_key, result->body, result->encoding, result->format);
+            }
+        });
+        return;
+    }
+
+    // Chunks are posted back to this worker's executor as soon as the parse thread produces them.
+    pdf_json_streamer::MODE mode = stream == "pages" ? pdf_json_streamer::MODE::PAGES : pdf_json_streamer::MODE::SECTIONS;
+    admit_or_shed([this, parse, mode, options, encoding](fz_context* ctx, std::chrono::steady_clock::time_point admitted) {
+        bool ok = false;
+        unsigned int pages = 0;
+        try {
+            std::optional<stream_compressor> compressor;
+            if (encoding != CONTENT_ENCODING::IDENTITY) {
+                compressor.emplace(encoding);
+            }
+            auto post_chunk = [this](std::string&& chunk) {
+                boost::asio::post(socket_.get_executor(), [this, chunk = std::move(chunk)]() mutable {
+                    write_stream_chunk(std::move(chunk));
+                });
+            };
+            pdf_json_streamer streamer(mode, [&compressor, &post_chunk](std::string&& chunk) {
+                post_chunk(compressor ? compressor->write(chunk) : std::move(chunk));
+            });
+            PDF_Parse_Options stream_options = with_page_helpers(streamer.parse_options(options));
+            std::optional<PDF_Document> pdf_doc = parse(ctx, stream_options);
+            if (pdf_doc) {
+                pages = pdf_doc->parsed_page_count;
+                streamer.finish(pdf_doc.value());
+                if (compressor) {
+                    post_chunk(compressor->finish());
+                }
+                ok = true;
+            }
+        } catch (const std::exception& e) {
+            LOG_ERROR << "Cannot format document: " << e.what();
+        }
+        context_.admission.complete(std::chrono::steady_clock::now() - admitted, pages, ok);
+        boost::asio::post(socket_.get_executor(), [this, ok]() {
+            end_stream(ok);
+        });
+    });
+}
+
+// let a large document spread its pages over the parse threads no other parse is using right now
+PDF_Parse_Options http_worker::with_page_helpers(PDF_Parse_Options options) {
+    std::size_t threads = context_.parser.size();
+    std::size_t in_flight = context_.admission.stats().in_flight;
+    options.max_helpers = in_flight < threads ? static_cast<unsigned int>(threads - in_flight + 1) : 1;
+    options.spawn = [&parser = context_.parser](std::function<void(fz_context* ctx)> task) {
+        parser.post(std::move(task));
+    };
+    return options;
+}
+
+std::optional<std::string> http_worker::parse_to_body(parse_job_t const& parse, fz_context* ctx, PDF_Parse_Options const& options, std::chrono::steady_clock::time_point admitted,
+                                                      OUTPUT_FORMAT format, bool* complete) {
+    std::optional<std::string> body;
+    unsigned int pages = 0;
+    try {
+        std::optional<PDF_Document> pdf_doc = parse(ctx, options);
+        if (pdf_doc) {
+            pages = pdf_doc->parsed_page_count;
+            if (complete) {
+                *complete = !pdf_doc->truncated;
+            }
+        }
+        body = serialize_pdf_document(std::move(pdf_doc), format);
+    } catch (const std::exception& e) {
+        LOG_ERROR << "Cannot format document: " << e.what();
+    }
+    context_.admission.complete(std::chrono::steady_clock::now() - admitted, pages, body.has_value());
+    return body;
+}
+
+void http_worker::process_job_request(boost::beast::http::request<request_body_t, boost::beast::http::basic_fields<alloc_t>> const& req, boost::beast::string_view target_path, query_string const& params) {
+    /* POST /jobs                : submit, same parameters and body as a single request, answers the job id
+     * GET /jobs/<id>            : state and progress in pages
+     * GET /jobs/<id>/result     : the parsed document once done, 202 with the state before
+     * DELETE /jobs/<id>         : cancel the job and discard its result
+     * finished jobs are discarded JOB_RESULT_TTL seconds after they finished
+     */
+    if (target_path == "/jobs") {
+        if (req.method() != boost::beast::http::verb::post) {
+            send_bad_response(
+                boost::beast::http::status::bad_request,
+                "Jobs are submitted with POST\r\n");
+            return;
+        }
+        submit_job(req, params);
+        return;
+    }
+
+    std::string id = target_path.substr(std::strlen("/jobs/")).to_string();
+    bool want_result = false;
+    std::size_t slash = id.find('/');
+    if (slash != std::string::npos) {
+        want_result = id.substr(slash) == "/result";
+        if (!want_result) {
+            send_bad_response(
+                boost::beast::http::status::not_found,
+                "Unknown job resource\r\n");
+            return;
+        }
+        id.resize(slash);
+    }
+
+    if (req.method() == boost::beast::http::verb::delete_ && !want_result) {
+        if (context_.jobs.remove(id)) {
+            send_json_response("{}");
+        } else {
+            send_bad_response(
+                boost::beast::http::status::not_found,
+                "Unknown job\r\n");
+        }
+        return;
+    }
+    if (req.method() != boost::beast::http::verb::get) {
+        send_bad_response(
+            boost::beast::http::status::bad_request,
+            "Invalid request-method '" + req.method_string().to_string() + "'\r\n");
+        return;
+    }
+
+    std::shared_ptr<const std::string> result;
+    std::optional<job_store::status> status = want_result ? context_.jobs.result(id, result) : context_.jobs.find(id);
+    if (!status) {
+        send_bad_response(
+            boost::beast::http::status::not_found,
+            "Unknown job\r\n");
+    } else if (!want_result) {
+        send_json_response(job_status_to_json(id, status.value()));
+    } else if (status->state == job_store::STATE::DONE) {
+        send_json_response(*result);
+    } else if (status->state == job_store::STATE::FAILED) {
+        send_bad_response(
+            boost::beast::http::status::unprocessable_entity,
+            "Job failed: " + status->error + "\r\n");
+    } else {
+        send_json_response(job_status_to_json(id, status.value()), boost::beast::http::status::accepted);
+    }
+}
+
+void http_worker::submit_job(boost::beast::http::request<request_body_t, boost::beast::http::basic_fields<alloc_t>> const& req, query_string const& params) {
+    PDF_Parse_Options options;
+    std::optional<std::chrono::milliseconds> budget;
+    if (const char* error = read_parse_params(params, options, budget)) {
+        send_bad_response(
+            boost::beast::http::status::bad_request,
+            error);
+        return;
+    }
+    boost::asio::const_buffer body = req.body().data();
+
+    // the job outlives this request, so an uploaded document is copied into it
+    std::string upload;
+    std::string request_path;
+    std::string magic = "application/pdf";
+    if (body.size() > 0) {
+        upload.assign(static_cast<const char*>(body.data()), body.size());
+        auto content_type = req.find(boost::beast::http::field::content_type);
+        if (content_type != req.end() &&
+            !boost::beast::iequals(content_type->value(), "application/octet-stream")) {
+            magic = content_type->value().to_string();
+        }
+    } else if (params.contains("path")) {
+        if (!url_decode(params.find("path").value(), request_path)) {
+            send_bad_response(
+                boost::beast::http::status::bad_request,
+                "Malformed path parameter\r\n");
+            return;
+        }
+    } else {
+        send_bad_response(
+            boost::beast::http::status::bad_request,
+            "A job needs a path parameter or a request body\r\n");
+        return;
+    }
+
+    std::shared_ptr<job_store::job> job = context_.jobs.create(std::move(upload));
+    if (!job) {
+        send_bad_response(
+            boost::beast::http::status::service_unavailable,
+            "Job store is full\r\n",
+            HTTP_RETRY_AFTER);
+        return;
+    }
+    LOG_INFO << "Submitted job " << job->id << " from " << socket_.remote_endpoint().address() << ":" << socket_.remote_endpoint().port();
+
+    parse_job_t parse;
+    if (request_path.empty()) {
+        parse = [job, magic](fz_context* ctx, PDF_Parse_Options const& options) {
+            return parse_pdf_buffer(ctx, reinterpret_cast<const unsigned char*>(job->upload.data()), job->upload.size(), magic.c_str(), options);
+        };
+    } else {
+        parse = [request_path](fz_context* ctx, PDF_Parse_Options const& options) {
+            return parse_pdf_file(ctx, request_path, options);
+        };
+    }
+
+    options.cookie = &job->cookie;
+    if (budget) {
+        options.deadline = std::chrono::steady_clock::now() + budget.value();
+    }
+    // progress counts the selected pages only
+    options.on_start = [job, selection = options](PDF_Document& document) {
+        job->page_count = count_selected_pages(selection, document.document_info.page_count);
+    };
+    options.on_page = [job](unsigned int, const std::vector<TextBlockInformation>&) {
+        ++job->pages_done;
+    };
+
+    // the job runs detached from this worker, only the store sees its result
+    bool queued = admit([this, job, parse, options](fz_context* ctx, std::chrono::steady_clock::time_point admitted) {
+        context_.jobs.start(*job);
+        std::optional<std::string> json = parse_to_body(parse, ctx, with_page_helpers(options), admitted);
+        context_.jobs.finish(*job, std::move(json), job->cookie.abort ? "cancelled" : "cannot parse document");
+    }, [this, job]() {
+        context_.jobs.finish(*job, std::nullopt, "server is overloaded");
+    });
+
+    if (!queued) {
+        context_.jobs.remove(job->id);
+        send_bad_response(
+            boost::beast::http::status::service_unavailable,
+            "Server is overloaded, parse queue is full\r\n",
+            HTTP_RETRY_AFTER);
+        return;
+    }
+
+    job_store::status status;
+    send_json_response(job_status_to_json(job->id, status), boost::beast::http::status::accepted);
+}
+
+bool http_worker::admit(pool_job_t job, std::function<void()> shed) {
+    auto start = [this, job]() {
+        std::chrono::steady_clock::time_point admitted = std::chrono::steady_clock::now();
+        context_.parser.post([job, admitted](fz_context* ctx) {
+            job(ctx, admitted);
+        });
+    };
+
+    // shed is called from whichever thread frees a slot, hand it to this worker
+    auto post_shed = [this, shed]() {
+        boost::asio::post(socket_.get_executor(), shed);
+    };
+
+    if (!context_.admission.submit(start, post_shed)) {
+        return false;
+    }
+
+    // a running parse may hold its slot for long, the queue is also checked when this job's wait is over
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (queue_deadline_.expiry() <= now) {
+        watch_queue(now + std::chrono::seconds(ADMISSION_QUEUE_TIMEOUT));
+    }
+    return true;
+}
+
+void http_worker::watch_queue(std::chrono::steady_clock::time_point when) {
+    queue_deadline_.expires_at(when);
+    queue_deadline_.async_wait([this](boost::beast::error_code ec) {
+        if (ec) {
+            return;
+        }
+        std::optional<std::chrono::steady_clock::time_point> next = context_.admission.expire();
+        if (next) {
+            watch_queue(next.value());
+        }
+    });
+}
+
+void http_worker::admit_or_shed(pool_job_t job) {
+    bool queued = admit(job, [this]() {
+        parsing_ = false;
+        send_bad_response(
+            boost::beast::http::status::service_unavailable,
+            "Server is overloaded, parse queue timed out\r\n",
+            HTTP_RETRY_AFTER);
+    });
+
+    if (!queued) {
+        parsing_ = false;
+        send_bad_response(
+            boost::beast::http::status::service_unavailable,
+            "Server is overloaded, parse queue is full\r\n",
+            HTTP_RETRY_AFTER);
+    }
+}
+
+void http_worker::process_batch(boost::beast::http::request<request_body_t, boost::beast::http::basic_fields<alloc_t>> const& req, query_string const& params) {
+    /* POST /batch
+     *   - application/json body : array of pdf file paths
+     *   - multipart/form-data body : one pdf document per part, the part's Content-Type is its mime type
+     *   - optional: output : ndjson (default) one line per document as soon as it is parsed | array, in input order
+     *   - optional: budget_ms : per document, same as a single request
+     * every item is {"index":i,"result":{...}} or {"error":"...","index":i}
+     */
+    if (req.method() != boost::beast::http::verb::post) {
+        send_bad_response(
+            boost::beast::http::status::bad_request,
+            "Batch requests must be POST\r\n");
+        return;
+    }
+
+    PDF_Parse_Options options;
+    std::optional<std::chrono::milliseconds> budget;
+    if (const char* error = read_parse_params(params, options, budget)) {
+        send_bad_response(
+            boost::beast::http::status::bad_request,
+            error);
+        return;
+    }
+    boost::asio::const_buffer body = req.body().data();
+    std::string_view body_view(static_cast<const char*>(body.data()), body.size());
+    boost::beast::string_view content_type = req[boost::beast::http::field::content_type];
+    std::string_view boundary = multipart_boundary(std::string_view(content_type.data(), content_type.size()));
+
+    std::vector<parse_job_t> jobs;
+    if (!boundary.empty()) {
+        std::vector<multipart_part> parts;
+        if (!parse_multipart(body_view, boundary, parts)) {
+            send_bad_response(
+                boost::beast::http::status::bad_request,
+                "Malformed multipart body\r\n");
+            return;
+        }
+        // parts point into the request body, which outlives the batch
+        for (multipart_part const& part : parts) {
+            std::string magic = part.content_type.empty() || part.content_type == "application/octet-stream" ?
+                                "application/pdf" : std::string(part.content_type);
+            jobs.push_back([part, magic](fz_context* ctx, PDF_Parse_Options const& options) {
+                return parse_pdf_buffer(ctx, reinterpret_cast<const unsigned char*>(part.body.data()), part.body.size(), magic.c_str(), options);
+            });
+        }
+    } else {
+        nlohmann::json paths = nlohmann::json::parse(body_view.begin(), body_view.end(), nullptr, false);
+        if (!paths.is_array()) {
+            send_bad_response(
+                boost::beast::http::status::bad_request,
+                "Batch body must be a json array of paths or multipart/form-data\r\n");
+            return;
+        }
+        for (nlohmann::json const& path : paths) {
+            if (!path.is_string()) {
+                send_bad_response(
+                    boost::beast::http::status::bad_request,
+                    "Batch paths must be strings\r\n");
+                return;
+            }
+            jobs.push_back([file_path = path.get<std::string>()](fz_context* ctx, PDF_Parse_Options const& options) {
+                return parse_pdf_file(ctx, file_path, options);
+            });
+        }
+    }
+
+    if (jobs.empty()) {
+        send_bad_response(
+            boost::beast::http::status::bad_request,
+            "Empty batch\r\n");
+        return;
+    }
+    LOG_INFO << "Processing batch from " << socket_.remote_endpoint().address() << ":" << socket_.remote_endpoint().port() << " of " << jobs.size() << " documents";
+
+    parse_cookie_ = fz_cookie();
+    parsing_ = true;
+    stream_content_type_ = "application/x-ndjson";
+    stream_encoding_ = accept_encoding_;
+    watch_connection();
+
+    batch_jobs_ = std::move(jobs);
+    batch_cookies_.clear();
+    batch_cookies_.resize(batch_jobs_.size());
+    batch_ndjson_ = params.find("output") != "array";
+    batch_compressor_.reset();
+    if (batch_ndjson_ && stream_encoding_ != CONTENT_ENCODING::IDENTITY) {
+        batch_compressor_.emplace(stream_encoding_);
+    }
+    batch_results_.clear();
+    batch_results_.resize(batch_ndjson_ ? 0 : batch_jobs_.size());
+    batch_next_ = batch_running_ = batch_done_ = 0;
+    batch_budget_ = budget;
+    batch_options_ = options;
+
+    run_batch();
+}
+
+void http_worker::run_batch() {
+    // once cancelled, the documents not started yet are dropped
+    if (parse_cookie_.abort) {
+        batch_done_ += batch_jobs_.size() - batch_next_;
+        batch_next_ = batch_jobs_.size();
+    }
+
+    // keep at most one document per parse thread in flight, the rest of the server gets its share
+    while (batch_next_ < batch_jobs_.size() && batch_running_ < context_.parser.size()) {
+        std::size_t index = batch_next_++;
+        ++batch_running_;
+
+        PDF_Parse_Options options = batch_options_;
+        options.cookie = &batch_cookies_[index];
+        if (batch_budget_) {
+            options.deadline = std::chrono::steady_clock::now() + batch_budget_.value();
+        }
+
+        bool queued = admit([this, parse = batch_jobs_[index], options, index](fz_context* ctx, std::chrono::steady_clock::time_point admitted) {
+            std::optional<std::string> json = parse_to_body(parse, ctx, options, admitted);
+            boost::asio::post(socket_.get_executor(), [this, index, json = std::move(json)]() mutable {
+                complete_batch_item(index, std::move(json), "cannot parse document");
+                run_batch();
+            });
+        }, [this, index]() {
+            complete_batch_item(index, std::nullopt, "server is overloaded");
+            run_batch();
+        });
+
+        if (!queued) {
+            complete_batch_item(index, std::nullopt, "server is overloaded");
+        }
+    }
+
+    if (batch_done_ < batch_jobs_.size()) {
+        return;
+    }
+
+    batch_jobs_.clear();
+    if (batch_ndjson_) {
+        if (batch_compressor_) {
+            write_stream_chunk(batch_compressor_->finish());
+            batch_compressor_.reset();
+        }
+        end_stream(true);
+    } else {
+        std::string json = "[";
+        for (std::string& item : batch_results_) {
+            json += json.size() > 1 ? "," : "";
+            json += item;
+        }
+        json += "]";
+        batch_results_.clear();
+        send_json_response(std::move(json));
+    }
+}
+
+void http_worker::complete_batch_item(std::size_t index, std::optional<std::string> json, std::string const& error) {
+    --batch_running_;
+    ++batch_done_;
+
+    // a batch may take longer than one request, as long as it makes progress
+    request_deadline_.expires_after(std::chrono::seconds(HTTP_REQUEST_TIMEOUT));
+
+    std::string item;
+    if (json) {
+        item = "{\"index\":" + std::to_string(index) + ",\"result\":" + json.value() + "}";
+    } else {
+        item = "{\"error\":" + nlohmann::json(error).dump() + ",\"index\":" + std::to_string(index) + "}";
+    }
+
+    if (batch_ndjson_) {
+        item += "\n";
+        write_stream_chunk(batch_compressor_ ? batch_compressor_->write(item) : std::move(item));
+    } else {
+        batch_results_[index] = std::move(item);
+    }
+}
+
+void http_worker::cancel_parse() {
+    parse_cookie_.abort = 1;
+    for (fz_cookie& cookie : batch_cookies_) {
+        cookie.abort = 1;
+    }
+}
+
+void http_worker::watch_connection() {
+    // A readable socket with nothing to read means the client closed its end.
+    // Bytes of a pipelined request also make it readable, then there is nothing more to learn.
+    socket_.async_wait(boost::asio::ip::tcp::socket::wait_read,
+    [this, generation = ++watch_generation_](boost::beast::error_code ec) {
+        if (generation != watch_generation_ || !parsing_) {
+            return;
+        }
+        boost::beast::error_code available_ec;
+        if (ec || socket_.available(available_ec) == 0 || available_ec) {
+            LOG_INFO << "Client went away, cancelling parse";
+            cancel_parse();
+        }
+    });
+}
+
+void http_worker::send_metrics_response() {
+    std::string body;
+    metrics::write_prometheus(body);
+
+    admission_controller::statistics admission = context_.registry.admission_stats();
+    metrics::write_value(body, "pdf_parse_limit", "gauge", "Adaptive limit on concurrent parses.", admission.limit);
+    metrics::write_value(body, "pdf_parses_in_flight", "gauge", "Parses running on the parse pool.", admission.in_flight);
+    metrics::write_value(body, "pdf_parse_queue_depth", "gauge", "Parses waiting for a slot.", admission.queue_depth);
+    metrics::write_value(body, "pdf_parses_admitted_total", "counter", "Parses started.", admission.admitted);
+    metrics::write_value(body, "pdf_parses_shed_queue_full_total", "counter", "Parses refused because the queue was full.", admission.shed_queue_full);
+    metrics::write_value(body, "pdf_parses_shed_timeout_total", "counter", "Parses shed after waiting too long.", admission.shed_timeout);
+
+    body_buffer_pool::statistics bodies = context_.registry.body_stats();
+    metrics::write_value(body, "http_body_pool_reserved_bytes", "gauge", "Request body memory obtained from the heap.", bodies.reserved_bytes);
+    metrics::write_value(body, "http_body_pool_in_use_bytes", "gauge", "Request body memory held by requests.", bodies.in_use_bytes);
+    metrics::write_value(body, "http_body_pool_rejected_total", "counter", "Request bodies refused by the memory cap.", bodies.rejected);
+
+    job_store::statistics jobs = context_.jobs.stats();
+    metrics::write_value(body, "pdf_jobs", "gauge", "Jobs in the job store.", jobs.jobs);
+    metrics::write_value(body, "pdf_jobs_running", "gauge", "Jobs being parsed.", jobs.running);
+    metrics::write_value(body, "pdf_jobs_memory_bytes", "gauge", "Uploads and results held by jobs.", jobs.memory_bytes);
+
+    result_cache::statistics results = context_.results.stats();
+    metrics::write_value(body, "pdf_result_cache_entries", "gauge", "Parse results in the result cache.", results.entries);
+    metrics::write_value(body, "pdf_result_cache_memory_bytes", "gauge", "Bytes held by the result cache.", results.memory_bytes);
+    metrics::write_value(body, "pdf_result_cache_hits_total", "counter", "Requests answered from the result cache.", results.hits);
+    metrics::write_value(body, "pdf_result_cache_misses_total", "counter", "Cacheable requests that had to be parsed.", results.misses);
+    metrics::write_value(body, "pdf_result_cache_evictions_total", "counter", "Results evicted by the memory cap.", results.evictions);
+    metrics::write_value(body, "pdf_result_cache_expirations_total", "counter", "Results dropped after RESULT_CACHE_TTL.", results.expirations);
+    metrics::write_value(body, "pdf_result_cache_invalidations_total", "counter", "Results dropped through DELETE /cache.", results.invalidations);
+
+    result_store::statistics stored = context_.stored.stats();
+    metrics::write_value(body, "pdf_result_store_entries", "gauge", "Parse results in the on-disk result store.", stored.entries);
+    metrics::write_value(body, "pdf_result_store_disk_bytes", "gauge", "Bytes of result files on disk.", stored.disk_bytes);
+    metrics::write_value(body, "pdf_result_store_hits_total", "counter", "Requests answered from the result store.", stored.hits);
+    metrics::write_value(body, "pdf_result_store_misses_total", "counter", "Result cache misses the result store missed too.", stored.misses);
+    metrics::write_value(body, "pdf_result_store_writes_total", "counter", "Results written to the result store.", stored.writes);
+    metrics::write_value(body, "pdf_result_store_write_errors_total", "counter", "Failed writes to the result store.", stored.write_errors);
+    metrics::write_value(body, "pdf_result_store_evictions_total", "counter", "Results evicted by the disk cap.", stored.evictions);
+    metrics::write_value(body, "pdf_result_store_invalidations_total", "counter", "Results dropped through DELETE /cache.", stored.invalidations);
+
+    send_string_response(boost::beast::http::status::ok, "text/plain; version=0.0.4", std::move(body));
+}
+
+void http_worker::send_json_response(std::optional<std::string> json, boost::beast::http::status status, CONTENT_ENCODING encoding) {
+    parsing_ = false;
+    send_string_response(status, "application/json", json ? std::move(json.value()) : "{}", encoding);
+}
+
+void http_worker::send_cached_response(std::shared_ptr<const result_cache::result> result) {
+    parsing_ = false;
+
+    // the body is written from the shared result, which stays alive until the write completes
+    cached_result_ = std::move(result);
+    cached_response_.emplace(
+                std::piecewise_construct,
+                std::make_tuple(),
+                std::make_tuple(alloc_));
+    cached_response_->result(boost::beast::http::status::ok);
+    cached_response_->keep_alive(keep_alive_);
+    cached_response_->set(boost::beast::http::field::content_type, format_content_type(cached_result_->format));
+    cached_response_->set(boost::beast::http::field::vary, "Accept, Accept-Encoding");
+    if (cached_result_->encoding != CONTENT_ENCODING::IDENTITY) {
+        cached_response_->set(boost::beast::http::field::content_encoding, encoding_name(cached_result_->encoding));
+    }
+    cached_response_->body() = boost::beast::span<char const>(cached_result_->body.data(), cached_result_->body.size());
+    cached_response_->prepare_payload();
+    cached_serializer_.emplace(*cached_response_);
+
+    boost::beast::http::async_write(
+                socket_,
+                *cached_serializer_,
+                [this](boost::beast::error_code ec, std::size_t)
+                {
+                    finish_response(ec);
+                });
+}
+
+void http_worker::send_file_response(result_store::hit stored) {
+    parsing_ = false;
+
+    boost::beast::error_code ec;
+    boost::beast::file file;
+    file.native_handle(stored.fd);
+
+    file_response_.emplace(
+                std::piecewise_construct,
+                std::make_tuple(),
+                std::make_tuple(alloc_));
+    file_response_->result(boost::beast::http::status::ok);
+    file_response_->keep_alive(keep_alive_);
+    file_response_->set(boost::beast::http::field::content_type, format_content_type(stored.format));
+    file_response_->set(boost::beast::http::field::vary, "Accept, Accept-Encoding");
+    if (stored.encoding != CONTENT_ENCODING::IDENTITY) {
+        file_response_->set(boost::beast::http::field::content_encoding, encoding_name(stored.encoding));
+    }
+    file_response_->body().reset(std::move(file), ec);
+    if (ec) {
+        file_response_.reset();
+        send_json_response(std::nullopt);
+        return;
+    }
+    file_response_->prepare_payload();
+    file_serializer_.emplace(*file_response_);
+    file_offset_ = 0;
+
+    boost::beast::http::async_write_header(
+                socket_,
+                *file_serializer_,
+                [this](boost::beast::error_code ec, std::size_t)
+                {
+                    if (ec) {
+                        finish_response(ec);
+                    } else {
+                        send_file_body();
+                    }
+                });
+}
+
+void http_worker::send_file_body() {
+    // The kernel copies the body from the page cache to the socket, file_body would read it through a user space buffer.
+#ifdef __linux__
+    boost::beast::error_code ec;
+    socket_.native_non_blocking(true, ec);
+    int in = file_response_->body().file().native_handle();
+    std::uint64_t size = file_response_->body().size();
+    while (!ec && static_cast<std::uint64_t>(file_offset_) < size) {
+        ssize_t sent = ::sendfile(socket_.native_handle(), in, &file_offset_, static_cast<std::size_t>(size - file_offset_));
+        if (sent > 0 || (sent < 0 && errno == EINTR)) {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            socket_.async_wait(
+                        boost::asio::ip::tcp::socket::wait_write,
+                        [this](boost::beast::error_code ec)
+                        {
+                            if (ec) {
+                                finish_response(ec);
+                            } else {
+                                send_file_body();
+                            }
+                        });
+            return;
+        }
+        if (sent < 0 && file_offset_ == 0 && (errno == EINVAL || errno == ENOSYS)) {
+            // sendfile does not support this file or socket, let file_body write it
+            break;
+        }
+        // the stored file shrank or the connection failed, the response cannot be completed
+        ec.assign(sent < 0 ? errno : EIO, boost::system::system_category());
+    }
+    if (ec || file_offset_ != 0) {
+        finish_response(ec);
+        return;
+    }
+#endif
+    boost::beast::http::async_write(
+                socket_,
+                *file_serializer_,
+                [this](boost::beast::error_code ec, std::size_t)
+                {
+                    finish_response(ec);
+                });
+}
+
+void http_worker::send_string_response(boost::beast::http::status status, const char* content_type, std::string body, CONTENT_ENCODING encoding) {
+    // bodies not compressed by the parse thread yet are compressed here
+    if (encoding == CONTENT_ENCODING::IDENTITY && compress_body(body, accept_encoding_)) {
+        encoding = accept_encoding_;
+    }
+
+    string_response_.emplace(
+                std::piecewise_construct,
+                std::make_tuple(),
+                std::make_tuple(alloc_));
+    string_response_->result(status);
+    string_response_->keep_alive(keep_alive_);
+    string_response_->set(boost::beast::http::field::content_type, content_type);
+    string_response_->set(boost::beast::http::field::vary, "Accept-Encoding");
+    if (encoding != CONTENT_ENCODING::IDENTITY) {
+        string_response_->set(boost::beast::http::field::content_encoding, encoding_name(encoding));
+    }
+    string_response_->body() = std::move(body);
+    string_response_->prepare_payload();
+    string_serializer_.emplace(*string_response_);
+
+    boost::beast::http::async_write(
+                socket_,
+                *string_serializer_,
+                [this](boost::beast::error_code ec, std::size_t)
+                {
+                    finish_response(ec);
+                });
+}
+
+void http_worker::write_stream_chunk(std::string chunk) {
+    // an empty chunk would end the body
+    if (stream_failed_ || chunk.empty()) {
+        return;
+    }
+    stream_chunks_.push_back(std::move(chunk));
+
+    if (!stream_response_) {
+        // First chunk: the status line can no longer change from here on.
+        stream_response_.emplace(
+                    std::piecewise_construct,
+                    std::make_tuple(),
+                    std::make_tuple(alloc_));
+        stream_response_->result(boost::beast::http::status::ok);
+        stream_response_->keep_alive(keep_alive_);
+        stream_response_->set(boost::beast::http::field::content_type, stream_content_type_);
+        stream_response_->set(boost::beast::http::field::vary, "Accept-Encoding");
+        if (stream_encoding_ != CONTENT_ENCODING::IDENTITY) {
+            stream_response_->set(boost::beast::http::field::content_encoding, encoding_name(stream_encoding_));
+        }
+        stream_response_->chunked(true);
+        stream_serializer_.emplace(*stream_response_);
+
+        stream_writing_ = true;
+        boost::beast::http::async_write_header(
+                    socket_,
+                    *stream_serializer_,
+                    [this](boost::beast::error_code ec, std::size_t)
+                    {
+                        stream_writing_ = false;
+                        stream_failed_ = stream_failed_ || ec;
+                        write_next_chunk();
+                    });
+    } else if (!stream_writing_) {
+        write_next_chunk();
+    }
+}
+
+void http_worker::end_stream(bool ok) {
+    parsing_ = false;
+    stream_done_ = true;
+    stream_ok_ = ok;
+
+    if (!stream_response_) {
+        // failed before the first chunk, answer like the buffered response does
+        send_json_response(std::nullopt);
+    } else if (!stream_writing_) {
+        write_next_chunk();
+    }
+}
+
+void http_worker::write_next_chunk() {
+    if (stream_failed_) {
+        // the client cannot receive the rest, stop producing it
+        cancel_parse();
+        stream_chunks_.clear();
+    }
+
+    if (!stream_chunks_.empty()) {
+        stream_chunk_ = std::move(stream_chunks_.front());
+        stream_chunks_.pop_front();
+        stream_bytes_ += stream_chunk_.size();
+
+        stream_writing_ = true;
+        boost::asio::async_write(
+                    socket_,
+                    boost::beast::http::make_chunk(boost::asio::buffer(stream_chunk_)),
+                    [this](boost::beast::error_code ec, std::size_t)
+                    {
+                        stream_writing_ = false;
+                        stream_failed_ = stream_failed_ || ec;
+                        write_next_chunk();
+                    });
+    } else if (stream_done_) {
+        // Nothing is left to write only once the parse thread is done with this worker.
+        if (stream_failed_ || !stream_ok_) {
+            // a chunked body without its last chunk tells the client the response is truncated
+            finish_response(boost::asio::error::connection_aborted);
+        } else {
+            stream_writing_ = true;
+            boost::asio::async_write(
+                        socket_,
+                        boost::beast::http::make_chunk_last(),
+                        [this](boost::beast::error_code ec, std::size_t)
+                        {
+                            stream_writing_ = false;
+                            finish_response(ec);
+                        });
+        }
+    }
+}
+
 void http_worker::send_bad_response(
     boost::beast::http::status status,
-    std::string const& error) {
+    std::string const& error,
+    unsigned int retry_after) {
     string_response_.emplace(
         std::piecewise_construct,
         std::make_tuple(),
         std::make_tuple(alloc_));
 
     string_response_->result(status);
-    string_response_->keep_alive(false);
+    string_response_->keep_alive(keep_alive_);
     string_response_->set(boost::beast::http::field::server, "Beast");
     string_response_->set(boost::beast::http::field::content_type, "text/plain");
+    if (retry_after > 0) {
+        string_response_->set(boost::beast::http::field::retry_after, std::to_string(retry_after));
+    }
     string_response_->body() = error;
     string_response_->prepare_payload();
 
@@ -231,11 +1219,44 @@ void http_worker::send_bad_response(
         socket_,
         *string_serializer_,
     [this](boost::beast::error_code ec, std::size_t) {
+        finish_response(ec);
+    });
+}
+
+void http_worker::finish_response(boost::beast::error_code ec) {
+    if (string_response_) {
+        metrics::count_response(string_response_->result_int(), string_response_->body().size());
+    } else if (cached_response_) {
+        metrics::count_response(cached_response_->result_int(), cached_result_->body.size());
+    } else if (file_response_) {
+        metrics::count_response(file_response_->result_int(), static_cast<std::size_t>(file_response_->body().size()));
+    } else if (stream_response_) {
+        metrics::count_response(stream_response_->result_int(), stream_bytes_);
+    }
+
+    bool keep_alive = !ec && keep_alive_;
+    string_serializer_.reset();
+    string_response_.reset();
+    cached_serializer_.reset();
+    cached_response_.reset();
+    cached_result_.reset();
+    file_serializer_.reset();
+    file_response_.reset();
+    file_offset_ = 0;
+    stream_serializer_.reset();
+    stream_response_.reset();
+    stream_chunks_.clear();
+    stream_chunk_.clear();
+    stream_bytes_ = 0;
+    stream_done_ = stream_ok_ = stream_failed_ = false;
+
+    if (keep_alive) {
+        // Serve the next (possibly already pipelined) request on the same connection.
+        read_request();
+    } else {
         socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_send, ec);
-        string_serializer_.reset();
-        string_response_.reset();
         accept();
-    });
+    }
 }
 
 void http_worker::check_deadline() {
@@ -245,6 +1266,11 @@ void http_worker::check_deadline() {
         boost::beast::error_code ec;
         socket_.close();
 
+        // Nobody will read the result of a parse still running for this request.
+        if (parsing_) {
+            cancel_parse();
+        }
+
         // Sleep indefinitely until we're given a new deadline.
         request_deadline_.expires_at(
             std::chrono::steady_clock::time_point::max());
@@ -0,0 +1,157 @@
+#include "job_store.hpp"
+#include "logging.hpp"
+#include <cstdio>
+
+job_store::job_store(std::size_t capacity, std::size_t memory_cap) :
+    capacity_(capacity),
+    memory_cap_(memory_cap),
+    random_(std::random_device{}()) {
+}
+
+std::shared_ptr<job_store::job> job_store::create(std::string upload) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    expire(std::chrono::steady_clock::now());
+
+    if (jobs_.size() >= capacity_ || stats_.memory_bytes + upload.size() > memory_cap_) {
+        ++stats_.rejected;
+        LOG_WARNING << "Job store full: " << jobs_.size() << " jobs, " << stats_.memory_bytes << " bytes";
+        return nullptr;
+    }
+
+    // ids are not guessable, so one client cannot fetch another's results
+    char id[17];
+    do {
+        std::snprintf(id, sizeof(id), "%016llx", static_cast<unsigned long long>(random_()));
+    } while (jobs_.count(id));
+
+    auto handle = std::make_shared<job>();
+    handle->id = id;
+    handle->upload = std::move(upload);
+
+    entry& e = jobs_[handle->id];
+    e.handle = handle;
+    resize(e, handle->upload.size());
+    ++stats_.submitted;
+    stats_.jobs = jobs_.size();
+    return handle;
+}
+
+void job_store::start(job& j) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = jobs_.find(j.id);
+    if (it != jobs_.end()) {
+        it->second.current.state = STATE::RUNNING;
+        ++stats_.running;
+    }
+}
+
+void job_store::finish(job& j, std::optional<std::string> result, std::string const& error) {
+    // the document is parsed, only the result is kept from here on
+    std::string().swap(j.upload);
+    std::shared_ptr<const std::string> shared_result;
+    if (result) {
+        shared_result = std::make_shared<const std::string>(std::move(result.value()));
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = jobs_.find(j.id);
+    if (it == jobs_.end()) {
+        // deleted while running
+        return;
+    }
+
+    entry& e = it->second;
+    if (e.current.state == STATE::RUNNING) {
+        --stats_.running;
+    }
+    e.finished = std::chrono::steady_clock::now();
+    e.current.pages_done = j.pages_done;
+    e.current.page_count = j.page_count;
+
+    if (shared_result && stats_.memory_bytes - e.memory_bytes + shared_result->size() > memory_cap_) {
+        LOG_WARNING << "Job " << j.id << " result of " << shared_result->size() << " bytes does not fit the job store";
+        shared_result.reset();
+        e.current.error = "result too large to store";
+    } else if (!shared_result) {
+        e.current.error = error;
+    }
+
+    e.current.state = shared_result ? STATE::DONE : STATE::FAILED;
+    e.result = std::move(shared_result);
+    resize(e, e.result ? e.result->size() : 0);
+}
+
+std::optional<job_store::status> job_store::find(std::string const& id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    expire(std::chrono::steady_clock::now());
+
+    auto it = jobs_.find(id);
+    if (it == jobs_.end()) {
+        return std::nullopt;
+    }
+
+    status current = it->second.current;
+    if (current.state == STATE::QUEUED || current.state == STATE::RUNNING) {
+        current.pages_done = it->second.handle->pages_done;
+        current.page_count = it->second.handle->page_count;
+    }
+    return current;
+}
+
+std::optional<job_store::status> job_store::result(std::string const& id, std::shared_ptr<const std::string>& out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    expire(std::chrono::steady_clock::now());
+
+    auto it = jobs_.find(id);
+    if (it == jobs_.end()) {
+        return std::nullopt;
+    }
+    if (it->second.current.state == STATE::DONE) {
+        out = it->second.result;
+    }
+    return it->second.current;
+}
+
+bool job_store::remove(std::string const& id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = jobs_.find(id);
+    if (it == jobs_.end()) {
+        return false;
+    }
+
+    // a running parse stops at the next page, finish() then finds nothing to update
+    it->second.handle->cookie.abort = 1;
+    if (it->second.current.state == STATE::RUNNING) {
+        --stats_.running;
+    }
+    resize(it->second, 0);
+    jobs_.erase(it);
+    stats_.jobs = jobs_.size();
+    return true;
+}
+
+job_store::statistics job_store::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    expire(std::chrono::steady_clock::now());
+    return stats_;
+}
+
+void job_store::expire(std::chrono::steady_clock::time_point now) {
+    for (auto it = jobs_.begin(); it != jobs_.end();) {
+        STATE state = it->second.current.state;
+        if ((state == STATE::DONE || state == STATE::FAILED) &&
+            now - it->second.finished > std::chrono::seconds(JOB_RESULT_TTL)) {
+            resize(it->second, 0);
+            it = jobs_.erase(it);
+            ++stats_.expired;
+        } else {
+            ++it;
+        }
+    }
+    stats_.jobs = jobs_.size();
+}
+
+void job_store::resize(entry& e, std::size_t memory_bytes) {
+    stats_.memory_bytes = stats_.memory_bytes - e.memory_bytes + memory_bytes;
+    e.memory_bytes = memory_bytes;
+}
@@ -0,0 +1,206 @@
+#include "json_writer.hpp"
+#include "string_utils.hpp"
+#include <stdexcept>
+
+namespace {
+
+    // bytes written around the text of a node and a paragraph, for the initial reservation
+    constexpr std::size_t NODE_OVERHEAD = 64;
+    constexpr std::size_t PARAGRAPH_OVERHEAD = 32;
+    constexpr std::size_t KEYWORD_OVERHEAD = 3;
+
+    constexpr char HEX_DIGITS[] = "0123456789abcdef";
+
+    [[noreturn]] void invalid_utf8(std::string_view s, std::size_t index) {
+        std::string message = index < s.size() ? "invalid UTF-8 byte at index " : "incomplete UTF-8 string at index ";
+        message += std::to_string(index);
+        throw std::invalid_argument(message);
+    }
+
+    // length of the well-formed UTF-8 sequence starting at s[i], per Unicode table 3-7; never 0
+    std::size_t utf8_sequence(std::string_view s, std::size_t i) {
+        unsigned char lead = static_cast<unsigned char>(s[i]);
+        std::size_t length;
+        unsigned char low = 0x80, high = 0xbf;
+        if (lead >= 0xc2 && lead <= 0xdf) {
+            length = 2;
+        } else if (lead >= 0xe0 && lead <= 0xef) {
+            length = 3;
+            low = lead == 0xe0 ? 0xa0 : 0x80;
+            high = lead == 0xed ? 0x9f : 0xbf;     // no surrogates
+        } else if (lead >= 0xf0 && lead <= 0xf4) {
+            length = 4;
+            low = lead == 0xf0 ? 0x90 : 0x80;
+            high = lead == 0xf4 ? 0x8f : 0xbf;     // nothing past U+10FFFF
+        } else {
+            invalid_utf8(s, i);
+        }
+
+        for (std::size_t k = 1; k < length; ++k) {
+            if (i + k >= s.size()) {
+                invalid_utf8(s, s.size());
+            }
+            unsigned char c = static_cast<unsigned char>(s[i + k]);
+            if (c < low || c > high) {
+                invalid_utf8(s, i + k);
+            }
+            low = 0x80;
+            high = 0xbf;
+        }
+        return length;
+    }
+
+    std::size_t estimate_node(PDF_Section_Node& node) {
+        std::size_t size = NODE_OVERHEAD + node.main_section->title.size();
+        for (PDF_Paragraph& paragraph : node.main_section->paragraphs) {
+            size += PARAGRAPH_OVERHEAD + paragraph.paragraph.size();
+            for (std::string_view emphasized_word : paragraph.emphasized_words) {
+                size += KEYWORD_OVERHEAD + emphasized_word.size();
+            }
+        }
+        if (node.sub_sections) {
+            for (PDF_Section_Node& child : node.sub_sections.value()) {
+                size += estimate_node(child);
+            }
+        }
+        return size;
+    }
+
+    void append_json_paragraph(std::string& out, const PDF_Paragraph& paragraph) {
+        out += '{';
+        if (!paragraph.emphasized_words.empty()) {
+            out += "\"keywords\":[";
+            bool first = true;
+            for (std::string_view emphasized_word : paragraph.emphasized_words) {
+                if (!first) {
+                    out += ',';
+                }
+                first = false;
+                append_json_string(out, emphasized_word);
+            }
+            out += "],";
+        }
+        out += "\"paragraph\":";
+        append_json_string(out, paragraph.paragraph);
+        out += '}';
+    }
+
+    // the keys of a section object in nlohmann's sorted order, with the extra ones of the root
+    void append_node(std::string& out, PDF_Section_Node& node, unsigned int& id, const std::string* pages, bool truncated) {
+        node.main_section->id = id++;
+        out += "{\"id\":";
+        out += std::to_string(node.main_section->id);
+        if (pages) {
+            out += ",\"pages\":";
+            append_json_string(out, *pages);
+        }
+        if (!node.main_section->paragraphs.empty()) {
+            out += ",\"paragraphs\":";
+            append_json_paragraphs(out, node.main_section->paragraphs);
+        }
+        if (node.parent_node) {
+            out += ",\"parent_id\":";
+            out += std::to_string(node.parent_node->main_section->id);
+        }
+        if (node.sub_sections && !node.sub_sections->empty()) {
+            out += ",\"subnodes\":[";
+            bool first = true;
+            for (PDF_Section_Node& child : node.sub_sections.value()) {
+                if (!first) {
+                    out += ',';
+                }
+                first = false;
+                append_node(out, child, id, nullptr, false);
+            }
+            out += ']';
+        }
+        out += ",\"title\":";
+        append_json_string(out, node.main_section->title);
+        if (truncated) {
+            out += ",\"truncated\":true";
+        }
+        out += '}';
+    }
+
+} // namespace
+
+void append_json_string(std::string& out, std::string_view s) {
+    out += '"';
+    std::size_t run = 0;
+    std::size_t i = 0;
+    while (i < s.size()) {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        if (c >= 0x80) {
+            i += utf8_sequence(s, i);
+            continue;
+        }
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            ++i;
+            continue;
+        }
+
+        // flush the plain run, then the escape
+        out.append(s.data() + run, i - run);
+        out += '\\';
+        switch (c) {
+            case '"':
+                out += '"';
+                break;
+            case '\\':
+                out += '\\';
+                break;
+            case '\b':
+                out += 'b';
+                break;
+            case '\t':
+                out += 't';
+                break;
+            case '\n':
+                out += 'n';
+                break;
+            case '\f':
+                out += 'f';
+                break;
+            case '\r':
+                out += 'r';
+                break;
+            default:
+                out += "u00";
+                out += HEX_DIGITS[c >> 4];
+                out += HEX_DIGITS[c & 0xf];
+                break;
+        }
+        run = ++i;
+    }
+    out.append(s.data() + run, s.size() - run);
+    out += '"';
+}
+
+void append_json_paragraphs(std::string& out, const std::vector<PDF_Paragraph>& paragraphs) {
+    out += '[';
+    bool first = true;
+    for (const PDF_Paragraph& paragraph : paragraphs) {
+        if (!first) {
+            out += ',';
+        }
+        first = false;
+        append_json_paragraph(out, paragraph);
+    }
+    out += ']';
+}
+
+void append_json_node(std::string& out, PDF_Section_Node& node, unsigned int& id) {
+    append_node(out, node, id, nullptr, false);
+}
+
+void append_json_document(std::string& out, PDF_Section_Node& doc_root, bool truncated, const std::optional<std::vector<unsigned int>>& covered_pages) {
+    // one reservation for the unescaped text, escapes are rare enough to grow into
+    out.reserve(out.size() + estimate_node(doc_root));
+
+    std::optional<std::string> pages;
+    if (covered_pages) {
+        pages = format_page_ranges(covered_pages.value());
+    }
+    unsigned int start_id = 0;
+    append_node(out, doc_root, start_id, pages ? &pages.value() : nullptr, truncated);
+}
@@ -3,22 +3,104 @@
 #include "http_server.hpp"
 #include "pdf_utils.hpp"
 #include "string_utils.hpp"
+#include "parse_pool.hpp"
+#include "body_pool.hpp"
+#include "admission.hpp"
+#include "job_store.hpp"
+#include "mupdf_context.hpp"
+#include "reactor.hpp"
+#include "reactor_registry.hpp"
+#include "result_cache.hpp"
+#include "result_store.hpp"
+#include "text_kernels.hpp"
+#include <algorithm>
+#include <list>
+#include <thread>
+#include <vector>
 
 int main(int argc, char* argv[]) {
     try {
         // Check command line arguments.
-        if (argc < 3) {
-            std::cerr << "Usage: http_server_fast <address> <port> <number_of_workers>\n";
+        if (argc < 4) {
+            std::cerr << "Usage: http_server_fast <address> <port> <number_of_workers> [number_of_parse_threads] [number_of_reactors [pin]]\n";
             std::cerr << "  For IPv4, try:\n";
             std::cerr << "    http_server_fast 0.0.0.0 8080 100\n";
             std::cerr << "  For IPv6, try:\n";
             std::cerr << "    http_server_fast 0::0 8080 100\n";
+            std::cerr << "  With reactors, workers and parse threads are per reactor, pin gives each parse thread a core of its own.\n";
+            std::cerr << "  For one reactor per core pinned to it, try:\n";
+            std::cerr << "    http_server_fast 0.0.0.0 8080 16 1 $(nproc) pin\n";
             return EXIT_FAILURE;
         }
 
         auto const address = boost::asio::ip::make_address(argv[1]);
         unsigned short port = static_cast<unsigned short>(std::atoi(argv[2]));
         int num_workers = std::atoi(argv[3]);
+        // default to one parse thread per core
+        std::size_t num_parse_threads = argc > 4 ? static_cast<std::size_t>(std::atoi(argv[4])) : std::thread::hardware_concurrency();
+        int num_reactors = argc > 5 ? std::atoi(argv[5]) : 0;
+        bool pin = argc > 6 && std::string(argv[6]) == "pin";
+
+        // every parse thread clones this context, decoded fonts stay in its store across documents
+        shared_mupdf_context mupdf;
+        LOG_INFO << "Text kernels: " << text_kernels_name();
+
+        if (num_reactors > 0) {
+            // jobs are looked up by id from whichever reactor the client lands on, results shared the same way
+            job_store jobs;
+            result_cache results;
+            result_store stored;
+            // /metrics on any reactor reports the admission and body pools of all of them
+            reactor_registry registry;
+
+            // one SO_REUSEPORT listener per reactor, the kernel balances connections across them
+            std::size_t body_memory_cap = static_cast<std::size_t>(BODY_POOL_MEMORY_CAP) / static_cast<std::size_t>(num_reactors);
+            // reactor i gets cpus [i * k, (i + 1) * k) for its k parse threads, adjacent cpus usually share a node
+            unsigned int num_cpus = std::max(std::thread::hardware_concurrency(), 1u);
+            std::size_t cpus_per_reactor = std::max<std::size_t>(num_parse_threads, 1);
+            if (pin && num_reactors * cpus_per_reactor > num_cpus) {
+                LOG_WARNING << num_reactors << " reactors of " << cpus_per_reactor << " parse threads need more than " << num_cpus << " cpus, pinned threads share cpus";
+            }
+            std::list<reactor> reactors;
+            for (int i = 0; i < num_reactors; ++i) {
+                std::vector<unsigned int> cpus;
+                for (std::size_t j = 0; pin && j < cpus_per_reactor; ++j) {
+                    cpus.push_back(static_cast<unsigned int>((i * cpus_per_reactor + j) % num_cpus));
+                }
+                reactors.emplace_back(boost::asio::ip::tcp::endpoint{address, port}, num_workers, num_parse_threads, body_memory_cap, jobs, results, stored, registry, mupdf, cpus);
+            }
+            LOG_INFO << "Serving with " << num_reactors << " reactors of " << num_workers << " workers and " << num_parse_threads << " parse threads" << (pin ? ", pinned" : "");
+
+            for (reactor& r : reactors) {
+                r.join();
+            }
+            LOG_INFO << "Server stopped";
+            return EXIT_SUCCESS;
+        }
+
+        // cpu bound parsing runs here, off the io thread
+        parse_pool parser{num_parse_threads, mupdf};
+        LOG_INFO << "Parsing with " << parser.size() << " threads";
+
+        // request bodies of all workers share one capped pool
+        body_buffer_pool bodies;
+
+        // parses beyond the adaptive limit queue up, then get shed with 503
+        admission_controller admission{parser.size(), 2 * parser.size()};
+
+        // background parses submitted through /jobs, independent of connections
+        job_store jobs;
+
+        // serialized results of recently parsed documents, served without parsing again
+        result_cache results;
+
+        // results written to disk, they survive a restart
+        result_store stored;
+
+        reactor_registry registry;
+        reactor_registry::registration registered{registry, admission, bodies};
+
+        http_server_context context{parser, bodies, admission, jobs, results, stored, registry};
 
         // assume that ioc is accessed from single thread
         boost::asio::io_context ioc{1};
@@ -26,11 +108,14 @@ int main(int argc, char* argv[]) {
 
         std::list<http_worker> workers;
         for (int i = 0; i < num_workers; ++i) {
-            workers.emplace_back(acceptor);
+            workers.emplace_back(acceptor, context);
             workers.back().start();
         }
 
         ioc.run();
+
+        // workers must not be called back after they are destroyed
+        parser.join();
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
         return EXIT_FAILURE;
@@ -0,0 +1,170 @@
+#include "metrics.hpp"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+    const char* const STAGE_NAMES[] = {"open", "extract", "classify", "tree", "serialize"};
+    const std::size_t STAGES = sizeof(STAGE_NAMES) / sizeof(STAGE_NAMES[0]);
+
+    // upper bounds in seconds, the last bucket is +Inf
+    const double BUCKET_BOUNDS[] = {0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+    const char* const BUCKET_LABELS[] = {"0.0005", "0.001", "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1", "0.25", "0.5", "1", "2.5", "5", "10", "+Inf"};
+    const std::size_t BUCKETS = sizeof(BUCKET_LABELS) / sizeof(BUCKET_LABELS[0]);
+
+    const unsigned int MAX_STATUS = 600;
+
+    // aligned so two threads' shards never share a cache line
+    struct alignas(64) shard {
+        std::atomic<std::uint64_t> stage_buckets[STAGES][BUCKETS] = {};
+        std::atomic<std::uint64_t> stage_sum_ns[STAGES] = {};
+        std::atomic<std::uint64_t> queue_wait_buckets[BUCKETS] = {};
+        std::atomic<std::uint64_t> queue_wait_sum_ns{0};
+        std::atomic<std::uint64_t> pages{0};
+        std::atomic<std::uint64_t> responses[MAX_STATUS] = {};
+        std::atomic<std::uint64_t> bytes_out{0};
+    };
+
+    // Only the owning thread writes a shard, so a relaxed load and store is enough
+    // and avoids the locked read-modify-write of fetch_add.
+    void add(std::atomic<std::uint64_t>& counter, std::uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::mutex shards_mutex;
+    std::vector<std::unique_ptr<shard>> shards;
+
+    shard& local_shard() {
+        thread_local shard* local = nullptr;
+        if (!local) {
+            std::lock_guard<std::mutex> lock(shards_mutex);
+            shards.push_back(std::make_unique<shard>());
+            local = shards.back().get();
+        }
+        return *local;
+    }
+
+    std::string format_double(double value) {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+        return buffer;
+    }
+
+    std::size_t bucket_of(std::chrono::steady_clock::duration elapsed) {
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        std::size_t bucket = 0;
+        while (bucket < BUCKETS - 1 && seconds > BUCKET_BOUNDS[bucket]) {
+            ++bucket;
+        }
+        return bucket;
+    }
+
+    std::uint64_t nanoseconds(std::chrono::steady_clock::duration elapsed) {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+
+    // the bucket, sum and count lines of one histogram series, labels may be empty
+    void write_histogram_series(std::string& out, const char* name, std::string const& labels, const std::uint64_t (&buckets)[BUCKETS], std::uint64_t sum_ns) {
+        std::string separator = labels.empty() ? "" : ",";
+        std::uint64_t cumulative = 0;
+        for (std::size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+            cumulative += buckets[bucket];
+            out += std::string(name) + "_bucket{" + labels + separator + "le=\"" + BUCKET_LABELS[bucket] + "\"} " + std::to_string(cumulative) + "\n";
+        }
+        std::string braced = labels.empty() ? "" : "{" + labels + "}";
+        out += std::string(name) + "_sum" + braced + " " + format_double(sum_ns / 1e9) + "\n";
+        out += std::string(name) + "_count" + braced + " " + std::to_string(cumulative) + "\n";
+    }
+
+} // namespace
+
+void metrics::observe(METRICS_STAGE stage, std::chrono::steady_clock::duration elapsed) {
+    std::size_t s = static_cast<std::size_t>(stage);
+    shard& local = local_shard();
+    add(local.stage_buckets[s][bucket_of(elapsed)], 1);
+    add(local.stage_sum_ns[s], nanoseconds(elapsed));
+}
+
+void metrics::observe_queue_wait(std::chrono::steady_clock::duration wait) {
+    shard& local = local_shard();
+    add(local.queue_wait_buckets[bucket_of(wait)], 1);
+    add(local.queue_wait_sum_ns, nanoseconds(wait));
+}
+
+void metrics::count_pages(unsigned int pages) {
+    add(local_shard().pages, pages);
+}
+
+void metrics::count_response(unsigned int status, std::size_t bytes) {
+    shard& local = local_shard();
+    add(local.responses[status < MAX_STATUS ? status : 0], 1);
+    add(local.bytes_out, bytes);
+}
+
+void metrics::write_prometheus(std::string& out) {
+    std::uint64_t stage_buckets[STAGES][BUCKETS] = {};
+    std::uint64_t stage_sum_ns[STAGES] = {};
+    std::uint64_t queue_wait_buckets[BUCKETS] = {};
+    std::uint64_t queue_wait_sum_ns = 0;
+    std::uint64_t pages = 0;
+    std::uint64_t responses[MAX_STATUS] = {};
+    std::uint64_t bytes_out = 0;
+    {
+        std::lock_guard<std::mutex> lock(shards_mutex);
+        for (auto& s : shards) {
+            for (std::size_t stage = 0; stage < STAGES; ++stage) {
+                for (std::size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+                    stage_buckets[stage][bucket] += s->stage_buckets[stage][bucket].load(std::memory_order_relaxed);
+                }
+                stage_sum_ns[stage] += s->stage_sum_ns[stage].load(std::memory_order_relaxed);
+            }
+            for (std::size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+                queue_wait_buckets[bucket] += s->queue_wait_buckets[bucket].load(std::memory_order_relaxed);
+            }
+            queue_wait_sum_ns += s->queue_wait_sum_ns.load(std::memory_order_relaxed);
+            pages += s->pages.load(std::memory_order_relaxed);
+            for (unsigned int status = 0; status < MAX_STATUS; ++status) {
+                responses[status] += s->responses[status].load(std::memory_order_relaxed);
+            }
+            bytes_out += s->bytes_out.load(std::memory_order_relaxed);
+        }
+    }
+
+    out += "# HELP pdf_stage_duration_seconds Time spent in each stage of handling a document.\n";
+    out += "# TYPE pdf_stage_duration_seconds histogram\n";
+    for (std::size_t stage = 0; stage < STAGES; ++stage) {
+        write_histogram_series(out, "pdf_stage_duration_seconds", std::string("stage=\"") + STAGE_NAMES[stage] + "\"", stage_buckets[stage], stage_sum_ns[stage]);
+    }
+
+    // parses started right away count as a wait of zero
+    out += "# HELP pdf_parse_queue_wait_seconds Time parses waited for an admission slot.\n";
+    out += "# TYPE pdf_parse_queue_wait_seconds histogram\n";
+    write_histogram_series(out, "pdf_parse_queue_wait_seconds", "", queue_wait_buckets, queue_wait_sum_ns);
+
+    // pages per second is rate(pdf_pages_parsed_total[...])
+    out += "# HELP pdf_pages_parsed_total Pages parsed.\n";
+    out += "# TYPE pdf_pages_parsed_total counter\n";
+    out += "pdf_pages_parsed_total " + std::to_string(pages) + "\n";
+
+    out += "# HELP http_responses_total Responses sent, by status code.\n";
+    out += "# TYPE http_responses_total counter\n";
+    for (unsigned int status = 0; status < MAX_STATUS; ++status) {
+        if (responses[status] > 0) {
+            out += "http_responses_total{code=\"" + std::to_string(status) + "\"} " + std::to_string(responses[status]) + "\n";
+        }
+    }
+
+    out += "# HELP http_response_bytes_total Response body bytes sent.\n";
+    out += "# TYPE http_response_bytes_total counter\n";
+    out += "http_response_bytes_total " + std::to_string(bytes_out) + "\n";
+}
+
+void metrics::write_value(std::string& out, const char* name, const char* type, const char* help, double value) {
+    out += std::string("# HELP ") + name + " " + help + "\n";
+    out += std::string("# TYPE ") + name + " " + type + "\n";
+    out += std::string(name) + " " + format_double(value) + "\n";
+}
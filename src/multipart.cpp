@@ -0,0 +1,111 @@
+#include "multipart.hpp"
+#include "string_utils.hpp"
+
+namespace {
+
+    const std::string_view CRLF = "\r\n";
+
+    // value of the named header in a part's header block, empty if absent
+    std::string_view find_header(std::string_view headers, std::string_view name) {
+        while (!headers.empty()) {
+            std::size_t eol = headers.find(CRLF);
+            std::string_view line = headers.substr(0, eol);
+            std::size_t colon = line.find(':');
+            if (colon != std::string_view::npos &&
+                iequals(trim_view(line.substr(0, colon)), name)) {
+                return trim_view(line.substr(colon + 1));
+            }
+            if (eol == std::string_view::npos) {
+                break;
+            }
+            headers.remove_prefix(eol + CRLF.size());
+        }
+        return {};
+    }
+
+} // namespace
+
+std::string_view multipart_boundary(std::string_view content_type) {
+    std::size_t semicolon = content_type.find(';');
+    if (semicolon == std::string_view::npos ||
+        !iequals(trim_view(content_type.substr(0, content_type.find('/'))), "multipart")) {
+        return {};
+    }
+
+    std::string_view params = content_type.substr(semicolon + 1);
+    while (!params.empty()) {
+        std::size_t next = params.find(';');
+        std::string_view param = trim_view(params.substr(0, next));
+        std::size_t equals = param.find('=');
+        if (equals != std::string_view::npos &&
+            iequals(trim_view(param.substr(0, equals)), "boundary")) {
+            std::string_view value = trim_view(param.substr(equals + 1));
+            if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+                value = value.substr(1, value.size() - 2);
+            }
+            return value;
+        }
+        if (next == std::string_view::npos) {
+            break;
+        }
+        params.remove_prefix(next + 1);
+    }
+    return {};
+}
+
+bool parse_multipart(std::string_view body, std::string_view boundary, std::vector<multipart_part>& parts) {
+    if (boundary.empty()) {
+        return false;
+    }
+
+    // the first delimiter may be preceded by a preamble, later ones by the CRLF ending the previous part
+    std::size_t pos = body.find("--");
+    while (pos != std::string_view::npos && body.substr(pos + 2, boundary.size()) != boundary) {
+        pos = body.find("--", pos + 2);
+    }
+    if (pos == std::string_view::npos) {
+        return false;
+    }
+    pos += 2 + boundary.size();
+
+    for (;;) {
+        // closing delimiter
+        if (body.substr(pos, 2) == "--") {
+            return true;
+        }
+        // skip transport padding and the CRLF ending the delimiter line
+        std::size_t line_end = body.find(CRLF, pos);
+        if (line_end == std::string_view::npos) {
+            return false;
+        }
+        pos = line_end + CRLF.size();
+
+        // headers end with an empty line, a part may have none
+        std::string_view headers;
+        std::size_t content_begin = pos + CRLF.size();
+        if (body.substr(pos, 2) != CRLF) {
+            std::size_t headers_end = body.find("\r\n\r\n", pos);
+            if (headers_end == std::string_view::npos) {
+                return false;
+            }
+            headers = body.substr(pos, headers_end + CRLF.size() - pos);
+            content_begin = headers_end + 2 * CRLF.size();
+        }
+
+        // the part ends right before CRLF "--" boundary
+        std::size_t content_end = content_begin;
+        for (;;) {
+            content_end = body.find("\r\n--", content_end);
+            if (content_end == std::string_view::npos) {
+                return false;
+            }
+            if (body.substr(content_end + 4, boundary.size()) == boundary) {
+                break;
+            }
+            content_end += 4;
+        }
+
+        parts.push_back({find_header(headers, "Content-Type"), body.substr(content_begin, content_end - content_begin)});
+        pos = content_end + 4 + boundary.size();
+    }
+}
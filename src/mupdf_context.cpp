@@ -0,0 +1,45 @@
+#include "mupdf_context.hpp"
+#include "logging.hpp"
+#include <stdexcept>
+#include <string>
+
+shared_mupdf_context::shared_mupdf_context(std::size_t store_size) {
+    locks_context_.user = this;
+    locks_context_.lock = &shared_mupdf_context::lock;
+    locks_context_.unlock = &shared_mupdf_context::unlock;
+
+    /* Create the base context, its store is shared by every clone. */
+    base_ = fz_new_context(NULL, &locks_context_, store_size);
+    if (!base_) {
+        throw std::runtime_error("cannot create mupdf context");
+    }
+
+    /* Register the default file types to handle, clones inherit them. */
+    fz_try(base_) {
+        fz_register_document_handlers(base_);
+    } fz_catch(base_) {
+        std::string message = std::string("cannot register document handlers: ") + fz_caught_message(base_);
+        fz_drop_context(base_);
+        throw std::runtime_error(message);
+    }
+}
+
+shared_mupdf_context::~shared_mupdf_context() {
+    fz_drop_context(base_);
+}
+
+fz_context* shared_mupdf_context::clone() {
+    fz_context* ctx = fz_clone_context(base_);
+    if (!ctx) {
+        LOG_ERROR << "cannot clone mupdf context";
+    }
+    return ctx;
+}
+
+void shared_mupdf_context::lock(void* user, int lock) {
+    static_cast<shared_mupdf_context*>(user)->locks_[lock].lock();
+}
+
+void shared_mupdf_context::unlock(void* user, int lock) {
+    static_cast<shared_mupdf_context*>(user)->locks_[lock].unlock();
+}
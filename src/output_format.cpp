@@ -0,0 +1,95 @@
+#include "output_format.hpp"
+#include "flat_document.hpp"
+#include "string_utils.hpp"
+#include <cstdlib>
+
+namespace {
+
+    struct media_type {
+        const char* name;
+        OUTPUT_FORMAT format;
+    };
+
+    // the first name of a format is its Content-Type
+    constexpr media_type MEDIA_TYPES[] = {
+        {"application/json", OUTPUT_FORMAT::JSON},
+        {"application/cbor", OUTPUT_FORMAT::CBOR},
+        {"application/msgpack", OUTPUT_FORMAT::MSGPACK},
+        {"application/vnd.msgpack", OUTPUT_FORMAT::MSGPACK},
+        {"application/x-msgpack", OUTPUT_FORMAT::MSGPACK},
+        {"application/vnd.pdf-section-tree", OUTPUT_FORMAT::FLAT},
+    };
+
+} // namespace
+
+std::optional<OUTPUT_FORMAT> parse_output_format(std::string_view name) {
+    if (name == "json") {
+        return OUTPUT_FORMAT::JSON;
+    }
+    if (name == "cbor") {
+        return OUTPUT_FORMAT::CBOR;
+    }
+    if (name == "msgpack") {
+        return OUTPUT_FORMAT::MSGPACK;
+    }
+    if (name == "flat") {
+        return OUTPUT_FORMAT::FLAT;
+    }
+    return std::nullopt;
+}
+
+OUTPUT_FORMAT negotiate_format(std::string_view accept) {
+    // the highest weight wins, the earlier type on a tie; wildcards keep the JSON default
+    OUTPUT_FORMAT preferred = OUTPUT_FORMAT::JSON;
+    double preferred_weight = 0;
+
+    while (!accept.empty()) {
+        std::size_t comma = accept.find(',');
+        std::string_view type = accept.substr(0, comma);
+        accept = comma == std::string_view::npos ? std::string_view() : accept.substr(comma + 1);
+
+        double weight = 1;
+        std::size_t semicolon = type.find(';');
+        if (semicolon != std::string_view::npos) {
+            std::string_view param = trim_view(type.substr(semicolon + 1));
+            if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+                weight = std::strtod(std::string(param.substr(2)).c_str(), nullptr);
+            }
+            type = type.substr(0, semicolon);
+        }
+        type = trim_view(type);
+
+        for (media_type const& known : MEDIA_TYPES) {
+            if (iequals(type, known.name) && weight > preferred_weight) {
+                preferred = known.format;
+                preferred_weight = weight;
+            }
+        }
+    }
+    return preferred;
+}
+
+const char* format_content_type(OUTPUT_FORMAT format) {
+    for (media_type const& known : MEDIA_TYPES) {
+        if (known.format == format) {
+            return known.name;
+        }
+    }
+    return "application/json";
+}
+
+std::string format_pdf_document(PDF_Section_Node& doc_root, OUTPUT_FORMAT format, bool truncated, const std::optional<std::vector<unsigned int>>& covered_pages) {
+    std::string out;
+    switch (format) {
+        case OUTPUT_FORMAT::CBOR:
+            nlohmann::json::to_cbor(pdf_document_tree_to_json(doc_root, truncated, covered_pages), out);
+            return out;
+        case OUTPUT_FORMAT::MSGPACK:
+            nlohmann::json::to_msgpack(pdf_document_tree_to_json(doc_root, truncated, covered_pages), out);
+            return out;
+        case OUTPUT_FORMAT::FLAT:
+            return format_pdf_document_flat(doc_root, truncated, covered_pages);
+        default:
+            return format_pdf_document_tree(doc_root, truncated, covered_pages);
+    }
+}
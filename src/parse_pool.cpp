@@ -0,0 +1,42 @@
+#include "parse_pool.hpp"
+
+namespace {
+
+    // Drops the context when its thread exits.
+    struct thread_context_holder {
+        fz_context* ctx = nullptr;
+        bool initialized = false;
+
+        ~thread_context_holder() {
+            if (ctx) {
+                fz_drop_context(ctx);
+            }
+        }
+    };
+
+} // namespace
+
+parse_pool::parse_pool(std::size_t num_threads, shared_mupdf_context& mupdf) :
+    num_threads_(num_threads > 0 ? num_threads : 1),
+    mupdf_(mupdf),
+    pool_(num_threads_) {
+}
+
+parse_pool::~parse_pool() {
+    join();
+}
+
+void parse_pool::join() {
+    pool_.stop();
+    pool_.join();
+}
+
+fz_context* parse_pool::thread_context(shared_mupdf_context& mupdf) {
+    thread_local thread_context_holder holder;
+    if (!holder.initialized) {
+        // a thread belongs to one pool, so it only ever clones one shared context
+        holder.initialized = true;
+        holder.ctx = mupdf.clone();
+    }
+    return holder.ctx;
+}
@@ -0,0 +1,144 @@
+#include "pdf_stream.hpp"
+#include "json_writer.hpp"
+#include "metrics.hpp"
+#include "string_utils.hpp"
+
+pdf_json_streamer::pdf_json_streamer(MODE mode, sink_t sink) :
+    mode_(mode),
+    sink_(std::move(sink)) {
+    root_section_.id = 0;
+    doc_root_.main_section = &root_section_;
+    doc_root_.parent_node = nullptr;
+    tree_builder_.emplace(doc_root_);
+}
+
+PDF_Parse_Options pdf_json_streamer::parse_options(PDF_Parse_Options options) {
+    selection_.page_ranges = options.page_ranges;
+    selection_.max_pages = options.max_pages;
+    if (mode_ == MODE::SECTIONS) {
+        options.on_section = [this](PDF_Document& document, PDF_Section& section) {
+            on_section(document, section);
+        };
+    } else {
+        options.on_page = [this](unsigned int page_number, const std::vector<TextBlockInformation>& page_blocks) {
+            on_page(page_number, page_blocks);
+        };
+    }
+    return options;
+}
+
+void pdf_json_streamer::finish(PDF_Document& document) {
+    if (mode_ == MODE::PAGES) {
+        // pages have no enclosing object, a truncated result ends with a marker element
+        std::string chunk = has_pages_ ? "" : "[";
+        if (document.truncated) {
+            chunk += has_pages_ ? ",{\"truncated\":true}" : "{\"truncated\":true}";
+        }
+        chunk += "]";
+        sink_(std::move(chunk));
+        return;
+    }
+
+    write_root(document);
+    if (top_level_node_) {
+        write_top_level_node();
+    }
+
+    // keys come out in nlohmann's sorted order: id, pages, paragraphs, subnodes, title, truncated
+    std::string chunk;
+    if (has_subnodes_) {
+        chunk += ']';
+    }
+    chunk += ",\"title\":";
+    append_json_string(chunk, document.document_info.title);
+    // pages went out before parsing, they are only wrong if it stopped early
+    if (document.covered_pages && document.covered_pages != selected_pages_) {
+        chunk += ",\"parsed_pages\":";
+        append_json_string(chunk, format_page_ranges(document.covered_pages.value()));
+    }
+    if (document.truncated) {
+        chunk += ",\"truncated\":true";
+    }
+    chunk += "}";
+    sink_(std::move(chunk));
+}
+
+void pdf_json_streamer::on_section(PDF_Document& document, PDF_Section& section) {
+    if (tree_builder_->add_section(section) > 1) {
+        return;
+    }
+
+    // every section before this one is complete, so is the previous top-level subtree
+    write_root(document);
+    if (top_level_node_) {
+        write_top_level_node();
+    }
+    top_level_node_ = &(doc_root_.sub_sections.value().back());
+}
+
+void pdf_json_streamer::on_page(unsigned int page_number, const std::vector<TextBlockInformation>& page_blocks) {
+    nlohmann::json json_pdf_page;
+    json_pdf_page["page"] = page_number + 1;
+    json_pdf_page["paragraphs"] = nlohmann::json::array();
+
+    for (const TextBlockInformation& textblock : page_blocks) {
+        if (!textblock.title_format && textblock.partial_paragraph_content.empty()) {
+            continue;
+        }
+
+        nlohmann::json json_pdf_paragraph;
+        json_pdf_paragraph["paragraph"] = textblock.partial_paragraph_content;
+        auto emphasized_word = textblock.emphasized_words.begin();
+        if (textblock.title_format) {
+            std::string_view title = *emphasized_word++;
+            // same as section titles: remove double quote inside title string
+            if (title.length() > 2 && title.front() == '"' && title.back() == '"') {
+                title = title.substr(1, title.length() - 2);
+            }
+            json_pdf_paragraph["title"] = title;
+        }
+        for (; emphasized_word != textblock.emphasized_words.end(); ++emphasized_word) {
+            json_pdf_paragraph["keywords"] += *emphasized_word;
+        }
+        json_pdf_page["paragraphs"] += json_pdf_paragraph;
+    }
+
+    std::string chunk = has_pages_ ? "," : "[";
+    has_pages_ = true;
+    {
+        stage_timer timer(METRICS_STAGE::SERIALIZE);
+        chunk += json_pdf_page.dump();
+    }
+    sink_(std::move(chunk));
+}
+
+void pdf_json_streamer::write_root(PDF_Document& document) {
+    if (root_written_) {
+        return;
+    }
+    root_written_ = true;
+
+    std::string chunk = "{\"id\":0";
+    if (document.covered_pages) {
+        selected_pages_ = selected_pages(selection_, document.document_info.page_count);
+        chunk += ",\"pages\":";
+        append_json_string(chunk, format_page_ranges(selected_pages_.value()));
+    }
+
+    // prefix content ends where the first section starts
+    if (!document.prefix_content.empty()) {
+        chunk += ",\"paragraphs\":";
+        append_json_paragraphs(chunk, document.prefix_content);
+    }
+    sink_(std::move(chunk));
+}
+
+void pdf_json_streamer::write_top_level_node() {
+    std::string chunk = has_subnodes_ ? "," : ",\"subnodes\":[";
+    has_subnodes_ = true;
+    {
+        stage_timer timer(METRICS_STAGE::SERIALIZE);
+        append_json_node(chunk, *top_level_node_, next_id_);
+    }
+    sink_(std::move(chunk));
+}
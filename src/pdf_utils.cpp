@@ -1,12 +1,33 @@
 #include "pdf_utils.hpp"
+#include "metrics.hpp"
+#include "mupdf_context.hpp"
 #include "string_utils.hpp"
+#include "text_block_builder.hpp"
+#include "text_kernels.hpp"
+#include "title_prefix.hpp"
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string_view>
 #include <vector>
-#include <regex>
-#include <sstream>
 
-PDF_Title_Format::PDF_Title_Format() :
-    title_font(nullptr) {
+PDF_Font_Identity::PDF_Font_Identity(fz_context* ctx, fz_font* font) :
+    bold(fz_font_is_bold(ctx, font)),
+    italic(fz_font_is_italic(ctx, font)),
+    serif(fz_font_is_serif(ctx, font)),
+    monospaced(fz_font_is_monospaced(ctx, font)) {
+    const char* font_name = fz_font_name(ctx, font);
+    std::strncpy(name.data(), font_name ? font_name : "", name.size() - 1);
+}
+
+PDF_Title_Format::PDF_Title_Format() {
 
 }
 
@@ -75,7 +96,7 @@ bool PDF_Title_Format::operator!=(const PDF_Title_Format& title_format) {
 }
 
 std::ostream& operator<<(std::ostream& os, const PDF_Title_Format& tf) {
-    os << "\nFont addr: " << (void*)tf.title_font
+    os << "\nFont: " << tf.title_font.name.data()
        << "\nTitle case: " << static_cast<unsigned int>(tf.title_case)
        << "\nTitle prefix: " << static_cast<unsigned int>(tf.prefix)
        << "\nEmphasize style: " << static_cast<unsigned int>(tf.emphasize_style)
@@ -85,526 +106,894 @@ std::ostream& operator<<(std::ostream& os, const PDF_Title_Format& tf) {
     return os;
 }
 
+std::string_view PDF_Text_Arena::store(std::string_view text) {
+    if (text.empty()) {
+        return std::string_view();
+    }
+    char* copy = static_cast<char*>(allocate(text.size(), 1));
+    std::memcpy(copy, text.data(), text.size());
+    return std::string_view(copy, text.size());
+}
+
+std::string_view* PDF_Text_Arena::store_words(std::size_t count) {
+    void* words = allocate(count * sizeof(std::string_view), alignof(std::string_view));
+    return new (words) std::string_view[count];
+}
+
+void PDF_Text_Arena::adopt(PDF_Text_Arena&& other) {
+    // the rest of other's current chunk is given up, new text goes on in this arena's chunk
+    chunks_.insert(chunks_.end(), std::make_move_iterator(other.chunks_.begin()), std::make_move_iterator(other.chunks_.end()));
+    other.chunks_.clear();
+    other.next_ = nullptr;
+    other.left_ = 0;
+}
+
+void* PDF_Text_Arena::allocate(std::size_t size, std::size_t align) {
+    std::size_t padding = (align - reinterpret_cast<std::uintptr_t>(next_) % align) % align;
+    if (!next_ || padding + size > left_) {
+        // a string larger than a chunk gets a chunk of its own
+        std::size_t chunk_size = std::max(next_chunk_size_, size + align);
+        chunks_.emplace_back(new char[chunk_size]);
+        next_ = chunks_.back().get();
+        left_ = chunk_size;
+        next_chunk_size_ = std::min<std::size_t>(next_chunk_size_ * 2, TEXT_ARENA_MAX_CHUNK);
+        padding = (align - reinterpret_cast<std::uintptr_t>(next_) % align) % align;
+    }
+    void* block = next_ + padding;
+    next_ += padding + size;
+    left_ -= padding + size;
+    return block;
+}
+
 std::optional<PDF_Document> parse_pdf_file(std::string file_path) {
-    unsigned int page_number, page_count = 0;
+    // one base context for the process, so its store outlives single calls
     fz_context* ctx = nullptr;
-    fz_document* doc = nullptr;
-
-    /* Create a context to hold the exception stack and various caches. */
-    ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+    try {
+        static shared_mupdf_context mupdf;
+        ctx = mupdf.clone();
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+    }
     if (!ctx) {
         fprintf(stderr, "cannot create mupdf context\n");
         return std::nullopt;
     }
 
-    /* Register the default file types to handle. */
-    fz_try(ctx) {
-        fz_register_document_handlers(ctx);
-    } fz_catch(ctx) {
-        fprintf(stderr, "cannot register document handlers: %s\n", fz_caught_message(ctx));
-        fz_drop_context(ctx);
-        return std::nullopt;
-    }
+    std::optional<PDF_Document> pdf_document = parse_pdf_file(ctx, file_path);
+
+    fz_drop_context(ctx);
+    return pdf_document;
+}
+
+// opens another handle on the document being parsed, for a helper thread's context
+using document_opener = std::function<fz_document*(fz_context* ctx)>;
+
+static std::optional<PDF_Document> parse_document(fz_context* ctx, fz_document* doc, const PDF_Parse_Options& options, const document_opener& reopen);
+
+// return nullptr if the document cannot be opened
+static fz_document* open_document_file(fz_context* ctx, const std::string& file_path) {
+    fz_document* doc = nullptr;
 
     /* Open the document. */
+    std::chrono::steady_clock::time_point open_start = std::chrono::steady_clock::now();
     fz_try(ctx) {
         doc = fz_open_document(ctx, file_path.c_str());
     } fz_catch(ctx) {
         fprintf(stderr, "cannot open document: %s\n", fz_caught_message(ctx));
-        fz_drop_context(ctx);
-        return std::nullopt;
+        return nullptr;
     }
+    metrics::observe(METRICS_STAGE::OPEN, std::chrono::steady_clock::now() - open_start);
+    return doc;
+}
 
-    /* Count the number of pages. */
+// return nullptr if the document cannot be opened
+static fz_document* open_document_buffer(fz_context* ctx, const unsigned char* data, size_t size, const char* magic) {
+    fz_stream* stream = nullptr;
+    fz_document* doc = nullptr;
+    fz_var(stream);
+
+    /* Open the document on top of the caller's memory, the data is not copied. */
+    std::chrono::steady_clock::time_point open_start = std::chrono::steady_clock::now();
     fz_try(ctx) {
-        page_count = (unsigned int)(fz_count_pages(ctx, doc));
+        stream = fz_open_memory(ctx, data, size);
+        doc = fz_open_document_with_stream(ctx, magic, stream);
+    } fz_always(ctx) {
+        // the document keeps its own reference to the stream
+        fz_drop_stream(ctx, stream);
     } fz_catch(ctx) {
-        fprintf(stderr, "cannot count number of pages: %s\n", fz_caught_message(ctx));
-        fz_drop_document(ctx, doc);
-        fz_drop_context(ctx);
+        fprintf(stderr, "cannot open document from memory: %s\n", fz_caught_message(ctx));
+        return nullptr;
+    }
+    metrics::observe(METRICS_STAGE::OPEN, std::chrono::steady_clock::now() - open_start);
+    return doc;
+}
+
+std::optional<PDF_Document> parse_pdf_file(fz_context* ctx, const std::string& file_path, const PDF_Parse_Options& options) {
+    if (!ctx) {
         return std::nullopt;
     }
 
-    std::list<TextBlockInformation> textblock_list;
+    fz_document* doc = open_document_file(ctx, file_path);
+    if (!doc) {
+        return std::nullopt;
+    }
 
-    for (page_number = 0; page_number < page_count; ++page_number) {
+    std::optional<PDF_Document> pdf_document = parse_document(ctx, doc, options, [&file_path](fz_context* helper_ctx) {
+        return open_document_file(helper_ctx, file_path);
+    });
 
-        fz_page* page = fz_load_page(ctx, doc, page_number);
-        fz_device* dev = nullptr;
-        fz_var(dev);
+    /* Clean up. */
+    fz_drop_document(ctx, doc);
+    return pdf_document;
+}
+
+std::optional<PDF_Document> parse_pdf_buffer(fz_context* ctx, const unsigned char* data, size_t size, const char* magic, const PDF_Parse_Options& options) {
+    if (!ctx) {
+        return std::nullopt;
+    }
+
+    fz_document* doc = open_document_buffer(ctx, data, size, magic);
+    if (!doc) {
+        return std::nullopt;
+    }
 
-        fz_rect mediabox;
-        fz_try(ctx) {
-            mediabox = fz_bound_page(ctx, page);
-        } fz_catch(ctx) {
-            fprintf(stderr, "cannot get mediabox of page %d: %s\n", page_number, fz_caught_message(ctx));
-            fz_drop_page(ctx, page);
-            return std::nullopt;
+    std::optional<PDF_Document> pdf_document = parse_document(ctx, doc, options, [data, size, magic](fz_context* helper_ctx) {
+        return open_document_buffer(helper_ctx, data, size, magic);
+    });
+
+    /* Clean up. */
+    fz_drop_document(ctx, doc);
+    return pdf_document;
+}
+
+namespace {
+
+    /* Whether the fonts of one document are bold or italic, asked once per font.
+     * Cached fonts are kept, so the address of a font freed meanwhile cannot come back as another one.
+     */
+    class font_attribute_cache {
+      public:
+        // disable copy constructor and copy assignment (non-copyable)
+        font_attribute_cache(font_attribute_cache const&) = delete;
+        font_attribute_cache& operator=(font_attribute_cache const&) = delete;
+
+        explicit font_attribute_cache(fz_context* ctx) :
+            ctx_(ctx) {
         }
 
-        fz_stext_page* text = nullptr;
-        fz_var(text);
-
-        fz_try(ctx) {
-            fz_stext_options stext_options;
-            stext_options.flags = 0;
-            text = fz_new_stext_page(ctx, mediabox);
-            dev = fz_new_stext_device(ctx,  text, &stext_options);
-            fz_run_page(ctx, page, dev, fz_identity, nullptr);
-            fz_close_device(ctx, dev);
-            fz_drop_device(ctx, dev);
-            dev = nullptr;
-
-            fz_stext_block* block = nullptr, *prev_block = nullptr, *next_block = nullptr;
-            fz_stext_line* line = nullptr, *prev_line = nullptr, *next_line = nullptr;
-            fz_stext_char* ch = nullptr, *prev_ch = nullptr, *next_ch = nullptr;
-            fz_font* prev_ch_font = nullptr;
-
-            for (block = text->first_block; block; block = block->next) {
-                next_block = block->next;
-
-                if (block->type == FZ_STEXT_BLOCK_TEXT) { // only text blocks have lines, image blocks do not have lines
-                    TextBlockInformation text_block_information;
-                    std::optional<std::string> title_prefix = std::nullopt;
-                    std::optional<fz_font*> title_font = std::nullopt;
-                    std::stringstream partial_paragraph_content_string_stream;
-                    std::stringstream emphasized_word_string_stream;
-                    bool parsing_emphasized_word = false;
-
-                    for (line = block->u.t.first_line; line; line = line->next) {
-                        next_line = line->next;
-
-                        for (ch = line->first_char; ch; ch = ch->next) {
-                            next_ch = ch->next;
-
-                            std::string character = UnicodeToUTF8(ch->c);
-
-                            // linhlt: temporary fix
-                            if (character.compare("“") == 0 ||
-                                character.compare("”") == 0) {
-                                character = "\"";
-                            }
+        ~font_attribute_cache() {
+            for (const entry& font : fonts_) {
+                fz_drop_font(ctx_, font.font);
+            }
+        }
 
-                            if (prev_ch_font && parsing_emphasized_word) {  // just need to compare to font of previous character
-                                if (ch->font == prev_ch_font || isspace(ch->c)) { // same as previous character, continue to add to emphasized word
-                                    emphasized_word_string_stream << character;
-                                } else {
-                                    // add emphasized word to list
-                                    std::string trimmed_string = trim_copy(emphasized_word_string_stream.str());
-                                    if (trimmed_string.length() > 0) {
-                                        text_block_information.emphasized_words.push_back(trimmed_string);
-                                    }
-                                    // reset string stream
-                                    emphasized_word_string_stream.str(std::string());
-                                    parsing_emphasized_word = false;
-
-                                    if (fz_font_is_bold(ctx, ch->font) || fz_font_is_italic(ctx, ch->font)) {
-                                        parsing_emphasized_word = true;
-                                        emphasized_word_string_stream << character;
-                                    }
-                                }
-                            } else {
-                                if (!isspace(ch->c) && (fz_font_is_bold(ctx, ch->font) || fz_font_is_italic(ctx, ch->font))) {
-                                    parsing_emphasized_word = true;
-                                    // first time this occured
-                                    if (!title_prefix) {
-                                        if (!title_font) {
-                                            title_font = ch->font;
-                                        }
-
-                                        if (!partial_paragraph_content_string_stream.str().empty() &&
-                                            text_block_information.emphasized_words.empty()) {
-                                            title_prefix = partial_paragraph_content_string_stream.str();
-                                        }
-                                    }
-                                    emphasized_word_string_stream << character;
-                                } else if (parsing_emphasized_word) { // end of parsing emphasized word
-                                    std::string trimmed_string = trim_copy(emphasized_word_string_stream.str());
-                                    if (trimmed_string.length() > 0) {
-                                        text_block_information.emphasized_words.push_back(trimmed_string);
-                                    }
-                                    emphasized_word_string_stream.str(std::string());
-                                    parsing_emphasized_word = false;
-                                }
-                            }
+        bool is_emphasized(fz_font* font) {
+            // a page uses a handful of fonts, a linear scan beats hashing
+            for (const entry& cached : fonts_) {
+                if (cached.font == font) {
+                    return cached.emphasized;
+                }
+            }
+            bool emphasized = fz_font_is_bold(ctx_, font) || fz_font_is_italic(ctx_, font);
+            fonts_.push_back({fz_keep_font(ctx_, font), emphasized});
+            return emphasized;
+        }
 
-                            // add character to partial paragraph content
-                            partial_paragraph_content_string_stream << character;
+      private:
+        struct entry {
+            fz_font* font;
+            bool emphasized;
+        };
 
-                            if (partial_paragraph_content_string_stream.str().compare(" ") == 0) {
-                                partial_paragraph_content_string_stream.str(std::string());
-                            }
+        fz_context* ctx_;
+        std::vector<entry> fonts_;
+    };
 
-                            if (!isspace(ch->c)) {
-                                prev_ch_font = ch->font;
-                            }
+    // the corner cases of the regular expressions classify_title_prefix replaced, checked by the compiler
+    constexpr std::optional<PDF_Title_Format::PREFIX> classify(std::string_view word) {
+        unsigned long numbering_level = 0;
+        return classify_title_prefix(word, numbering_level);
+    }
 
-                            prev_ch = ch;
-                        }
+    constexpr unsigned long level(std::string_view word) {
+        unsigned long numbering_level = 0;
+        classify_title_prefix(word, numbering_level);
+        return numbering_level;
+    }
 
-                        prev_line = line;
-                    }
+    static_assert(classify("•") == PDF_Title_Format::PREFIX::BULLET && classify("o") == PDF_Title_Format::PREFIX::BULLET);
+    static_assert(classify("(ii)") == PDF_Title_Format::PREFIX::ALPHABET_LOWERCASE_NUMBERING);
+    static_assert(classify("(iii)") == PDF_Title_Format::PREFIX::ROMAN_NUMBERING && !classify("(xviiiii)"));
+    static_assert(classify("(AB)") == PDF_Title_Format::PREFIX::ALPHABET_UPPERCASE_NUMBERING && !classify("(abc)") && !classify("()"));
+    static_assert(level("1") == 1 && level("1.") == 1 && level("1.20.3") == 3 && level("1.20.3.") == 3);
+    static_assert(!classify("1..2") && !classify(".1") && !classify("1a") && !classify("1.."));
+    static_assert(classify("An") == PDF_Title_Format::PREFIX::ARTICLE && !classify("THE") && !classify("oo"));
+
+} // namespace
 
-                    text_block_information.partial_paragraph_content = partial_paragraph_content_string_stream.str();
+// run one page through the stext device and classify its text blocks, return false on error
+static bool extract_page_text_blocks(fz_context* ctx, fz_document* doc, unsigned int page_number, std::vector<TextBlockInformation>& textblock_list,
+                                     PDF_Text_Arena& arena, font_attribute_cache& fonts, fz_cookie* cookie) {
+    fz_page* page = nullptr;
+    fz_device* dev = nullptr;
+    fz_var(page);
+    fz_var(dev);
 
-                    // if emphasized_word is in the end of partial_paragraph
-                    std::string trimmed_string = trim_copy(emphasized_word_string_stream.str());
-                    if (parsing_emphasized_word &&
-                        trimmed_string.length() > 0) {
-                        text_block_information.emphasized_words.push_back(trimmed_string);
+    // stage timings are taken without RAII, fz_try unwinds with longjmp
+    std::chrono::steady_clock::time_point extract_start = std::chrono::steady_clock::now();
+
+    fz_rect mediabox;
+    fz_try(ctx) {
+        page = fz_load_page(ctx, doc, page_number);
+        mediabox = fz_bound_page(ctx, page);
+    } fz_catch(ctx) {
+        fprintf(stderr, "cannot get mediabox of page %d: %s\n", page_number, fz_caught_message(ctx));
+        fz_drop_page(ctx, page);
+        return false;
+    }
+
+    fz_stext_page* text = nullptr;
+    fz_var(text);
+
+    fz_try(ctx) {
+        fz_stext_options stext_options;
+        stext_options.flags = 0;
+        text = fz_new_stext_page(ctx, mediabox);
+        dev = fz_new_stext_device(ctx,  text, &stext_options);
+        fz_run_page(ctx, page, dev, fz_identity, cookie);
+        fz_close_device(ctx, dev);
+        fz_drop_device(ctx, dev);
+        dev = nullptr;
+
+        std::chrono::steady_clock::time_point classify_start = std::chrono::steady_clock::now();
+        metrics::observe(METRICS_STAGE::EXTRACT, classify_start - extract_start);
+
+        fz_stext_block* block = nullptr, *prev_block = nullptr, *next_block = nullptr;
+        fz_stext_line* line = nullptr, *prev_line = nullptr, *next_line = nullptr;
+        fz_stext_char* next_ch = nullptr;
+        fz_font* prev_ch_font = nullptr;
+
+        // one builder per thread, its buffers are reused by every block of every page
+        thread_local text_block_builder builder;
+
+        for (block = text->first_block; block; block = block->next) {
+            next_block = block->next;
+
+            if (block->type == FZ_STEXT_BLOCK_TEXT) { // only text blocks have lines, image blocks do not have lines
+                TextBlockInformation text_block_information;
+                text_block_emphasis<fz_font*> emphasis;
+                builder.clear();
+
+                for (line = block->u.t.first_line; line; line = line->next) {
+                    next_line = line->next;
+
+                    // a run is a stretch of characters sharing one font
+                    for (fz_stext_char* run = line->first_char; run; run = next_ch) {
+                        next_ch = run->next;
+                        while (next_ch && next_ch->font == run->font) {
+                            next_ch = next_ch->next;
+                        }
+                        append_font_run(builder, emphasis, prev_ch_font, run->font, run, next_ch, [&fonts](fz_font* font) {
+                            return fonts.is_emphasized(font);
+                        });
                     }
 
-                    if (!text_block_information.emphasized_words.empty() &&
-                        text_block_information.emphasized_words.front().length() < TITLE_MAX_LENGTH) {
-                        std::smatch title_prefix_match_result;
-
-                        if (title_prefix) {
-                            // case 1: prefix is in following format: bullet/numbering space single/double quote
-                            // step 1: find first word, using regex to match, check if it is bullet or numbering
-                            unsigned int pos = 0;
-                            std::string_view title_prefix_view(title_prefix.value());;
-                            size_t p_length = title_prefix_view.length();
-                            for (unsigned int i = 0; i < p_length; ++i) {
-                                if (std::isspace(title_prefix_view[i])) {
-                                    pos = i;
-                                    break;
-                                }
-                            }
+                    prev_line = line;
+                }
 
-                            if (pos > 0) {
-                                std::string first_word_title_prefix_view(title_prefix_view.substr(0, pos));
-                                PDF_Title_Format title_format;
-                                bool has_title_format = true;
-
-                                // bullet match
-                                if (std::regex_match(first_word_title_prefix_view, title_prefix_match_result, std::regex("|o|•|[\\*\\+\\-]"))) {
-                                    title_format.prefix = PDF_Title_Format::PREFIX::BULLET;
-                                } // numbering using latin characters (a) (b) (c)
-                                else if (std::regex_match(first_word_title_prefix_view, title_prefix_match_result, std::regex("\\([a-z]{1,2}\\)"))) {
-                                    title_format.prefix = PDF_Title_Format::PREFIX::ALPHABET_LOWERCASE_NUMBERING;
-                                }  // numbering using latin characters (A) (B) (C)
-                                else if (std::regex_match(first_word_title_prefix_view, title_prefix_match_result, std::regex("\\([A-Z]{1,2}\\)"))) {
-                                    title_format.prefix = PDF_Title_Format::PREFIX::ALPHABET_UPPERCASE_NUMBERING;
-                                } // numbering using roman numerals (i), longest presentation might be (xviii)
-                                else if (std::regex_match(first_word_title_prefix_view, title_prefix_match_result, std::regex("\\([ivx]{1,6}\\)"))) {
-                                    title_format.prefix = PDF_Title_Format::PREFIX::ROMAN_NUMBERING;
-                                } // numbering using number with dots ex 1 2 3 or 1. 2. 3. or 1.1 1.2 1.3 or 1.1. 1.2. 1.3.
-                                else if (std::regex_match(first_word_title_prefix_view, title_prefix_match_result, std::regex("\\d+(\\.\\d+)*\\.?"))) {
-                                    title_format.prefix = PDF_Title_Format::PREFIX::NUMBER_DOT_NUMBERING;
-                                } // article numbering A/a/An/an/The/the
-                                else if (std::regex_match(first_word_title_prefix_view, title_prefix_match_result, std::regex("[Aa]n?|[Tt]he"))) {
-                                    title_format.prefix = PDF_Title_Format::PREFIX::ARTICLE;
-                                } else { // not bullet or numbering
-                                    has_title_format = false;
-                                }
+                // if emphasized_word is in the end of partial_paragraph
+                if (emphasis.parsing_emphasized_word) {
+                    builder.end_word();
+                }
 
-                                // check if the rest is single/double quouted
-                                std::string_view the_rest_title_prefix_view(title_prefix_view.substr(pos + 1, p_length - pos));
-                                if (the_rest_title_prefix_view.empty()) {
-                                    title_format.emphasize_style = PDF_Title_Format::EMPHASIZE_STYLE::NONE;
-                                } else if (the_rest_title_prefix_view.compare("'") == 0 &&
-                                           text_block_information.partial_paragraph_content[text_block_information.emphasized_words.front().length() + title_prefix_view.length()] == '\'') {
-                                    title_format.emphasize_style = PDF_Title_Format::EMPHASIZE_STYLE::SINGLE_QUOTE;
-                                } else if (the_rest_title_prefix_view.compare("\"") == 0 &&
-                                           text_block_information.partial_paragraph_content[text_block_information.emphasized_words.front().length() + title_prefix_view.length()] == '\"') {
-                                    title_format.emphasize_style = PDF_Title_Format::EMPHASIZE_STYLE::DOUBLE_QUOTE;
-                                } else {
-                                    has_title_format = false;
-                                }
+                // the title logic below only narrows the view, the text is copied to the arena once
+                std::string_view block_content = builder.content();
+                std::string_view paragraph_content = block_content;
+                std::string_view first_word = builder.word_count() > 0 ? builder.word(0) : std::string_view();
+                // past the end reads as '\0', like std::string
+                auto content_at = [&paragraph_content](std::size_t i) {
+                    return i < paragraph_content.size() ? paragraph_content[i] : '\0';
+                };
+
+                if (builder.word_count() > 0 &&
+                    first_word.length() < TITLE_MAX_LENGTH) {
+                    if (emphasis.title_prefix_length) {
+                        // case 1: prefix is in following format: bullet/numbering space single/double quote
+                        // step 1: find first word, check if it is bullet or numbering
+                        unsigned int pos = 0;
+                        std::string_view title_prefix_view = builder.content().substr(0, emphasis.title_prefix_length.value());
+                        size_t p_length = title_prefix_view.length();
+                        for (unsigned int i = 0; i < p_length; ++i) {
+                            if (std::isspace(title_prefix_view[i])) {
+                                pos = i;
+                                break;
+                            }
+                        }
 
-                                if (has_title_format) {
-                                    text_block_information.title_format = std::move(title_format);
-                                }
-                            } else { // no space in prefix
-                                if (title_prefix_view.compare("'") == 0 &&
-                                    text_block_information.partial_paragraph_content[text_block_information.emphasized_words.front().length() + 1] == '\'') {
-                                    PDF_Title_Format title_format;
-                                    title_format.prefix = PDF_Title_Format::PREFIX::NONE;
-                                    title_format.emphasize_style = PDF_Title_Format::EMPHASIZE_STYLE::SINGLE_QUOTE;
-                                    text_block_information.title_format = std::move(title_format);
-                                } else if (title_prefix_view.compare("\"") == 0 &&
-                                           text_block_information.partial_paragraph_content[text_block_information.emphasized_words.front().length() + 1] == '\"') {
-                                    PDF_Title_Format title_format;
-                                    title_format.prefix = PDF_Title_Format::PREFIX::NONE;
-                                    title_format.emphasize_style = PDF_Title_Format::EMPHASIZE_STYLE::DOUBLE_QUOTE;
-                                    text_block_information.title_format = std::move(title_format);
-                                }
+                        if (pos > 0) {
+                            PDF_Title_Format title_format;
+                            std::optional<PDF_Title_Format::PREFIX> prefix = classify_title_prefix(title_prefix_view.substr(0, pos), title_format.numbering_level);
+                            bool has_title_format = prefix.has_value();
+                            if (prefix) {
+                                title_format.prefix = prefix.value();
                             }
 
-                            if (text_block_information.title_format) {
-                                text_block_information.partial_paragraph_content.erase(0, text_block_information.emphasized_words.front().length() + title_prefix_view.length());
-                                if (text_block_information.title_format->emphasize_style > PDF_Title_Format::EMPHASIZE_STYLE::NONE) {
-                                    text_block_information.partial_paragraph_content.erase(0, 1); // single or double quote, so remove extra one more character
-                                }
+                            // check if the rest is single/double quouted
+                            std::string_view the_rest_title_prefix_view(title_prefix_view.substr(pos + 1, p_length - pos));
+                            if (the_rest_title_prefix_view.empty()) {
+                                title_format.emphasize_style = PDF_Title_Format::EMPHASIZE_STYLE::NONE;
+                            } else if (the_rest_title_prefix_view.compare("'") == 0 &&
+                                       content_at(first_word.length() + title_prefix_view.length()) == '\'') {
+                                title_format.emphasize_style = PDF_Title_Format::EMPHASIZE_STYLE::SINGLE_QUOTE;
+                            } else if (the_rest_title_prefix_view.compare("\"") == 0 &&
+                                       content_at(first_word.length() + title_prefix_view.length()) == '\"') {
+                                title_format.emphasize_style = PDF_Title_Format::EMPHASIZE_STYLE::DOUBLE_QUOTE;
+                            } else {
+                                has_title_format = false;
                             }
-                        }  else {
-                            // case 2: no prefix: first emphasize word is in begining of the block, the character after first emphasized word must be colon or space
-                            size_t pos = text_block_information.emphasized_words.front().length();
-                            size_t p_length = text_block_information.partial_paragraph_content.length();
-                            if (pos == p_length) {
+
+                            if (has_title_format) {
+                                text_block_information.title_format = std::move(title_format);
+                            }
+                        } else { // no space in prefix
+                            if (title_prefix_view.compare("'") == 0 &&
+                                content_at(first_word.length() + 1) == '\'') {
                                 PDF_Title_Format title_format;
                                 title_format.prefix = PDF_Title_Format::PREFIX::NONE;
-                                title_format.emphasize_style = PDF_Title_Format::EMPHASIZE_STYLE::NONE;
-                                title_format.same_line_with_content = false;
+                                title_format.emphasize_style = PDF_Title_Format::EMPHASIZE_STYLE::SINGLE_QUOTE;
                                 text_block_information.title_format = std::move(title_format);
-
-                                // cut title out of content
-                                text_block_information.partial_paragraph_content = "";
-                            } else if (pos < p_length &&
-                                       (text_block_information.partial_paragraph_content[pos] == ' ' ||
-                                        text_block_information.partial_paragraph_content[pos] == ':' ||
-                                        text_block_information.partial_paragraph_content[pos] == '.')) {
+                            } else if (title_prefix_view.compare("\"") == 0 &&
+                                       content_at(first_word.length() + 1) == '\"') {
                                 PDF_Title_Format title_format;
                                 title_format.prefix = PDF_Title_Format::PREFIX::NONE;
-                                title_format.emphasize_style = PDF_Title_Format::EMPHASIZE_STYLE::NONE;
+                                title_format.emphasize_style = PDF_Title_Format::EMPHASIZE_STYLE::DOUBLE_QUOTE;
                                 text_block_information.title_format = std::move(title_format);
+                            }
+                        }
 
-                                // cut title out of content
-                                text_block_information.partial_paragraph_content.erase(0, pos + 1);
+                        if (text_block_information.title_format) {
+                            paragraph_content.remove_prefix(std::min(paragraph_content.size(), first_word.length() + title_prefix_view.length()));
+                            if (text_block_information.title_format->emphasize_style > PDF_Title_Format::EMPHASIZE_STYLE::NONE) {
+                                paragraph_content.remove_prefix(std::min<std::size_t>(paragraph_content.size(), 1)); // single or double quote, so remove extra one more character
                             }
                         }
+                    }  else {
+                        // case 2: no prefix: first emphasize word is in begining of the block, the character after first emphasized word must be colon or space
+                        size_t pos = first_word.length();
+                        size_t p_length = paragraph_content.length();
+                        if (pos == p_length) {
+                            PDF_Title_Format title_format;
+                            title_format.prefix = PDF_Title_Format::PREFIX::NONE;
+                            title_format.emphasize_style = PDF_Title_Format::EMPHASIZE_STYLE::NONE;
+                            title_format.same_line_with_content = false;
+                            text_block_information.title_format = std::move(title_format);
+
+                            // cut title out of content
+                            paragraph_content = paragraph_content.substr(p_length);
+                        } else if (pos < p_length &&
+                                   (paragraph_content[pos] == ' ' ||
+                                    paragraph_content[pos] == ':' ||
+                                    paragraph_content[pos] == '.')) {
+                            PDF_Title_Format title_format;
+                            title_format.prefix = PDF_Title_Format::PREFIX::NONE;
+                            title_format.emphasize_style = PDF_Title_Format::EMPHASIZE_STYLE::NONE;
+                            text_block_information.title_format = std::move(title_format);
+
+                            // cut title out of content
+                            paragraph_content.remove_prefix(pos + 1);
+                        }
                     }
-                    trim(text_block_information.partial_paragraph_content);
-
-                    if (text_block_information.title_format) {
-                        // indent
-                        if (is_all_upper_case(text_block_information.emphasized_words.front())) {
-                            text_block_information.title_format.value().indent = 0;
-                        } else {
-                            // first character which is not space
-                            bool has_indent = false;
-                            for (fz_stext_line* l = block->u.t.first_line; l; l = l->next) {
-                                for (fz_stext_char* c = l->first_char; c; c = c->next) {
-                                    if (!isspace(c->c)) {
-                                        text_block_information.title_format.value().indent = (double)(c->origin.x);
-                                        has_indent = true;
-                                        break;
-                                    }
-                                }
-                                if (has_indent) {
+                }
+                paragraph_content = trim_view(paragraph_content);
+
+                if (text_block_information.title_format) {
+                    // indent
+                    if (is_all_upper_case(first_word)) {
+                        text_block_information.title_format.value().indent = 0;
+                    } else {
+                        // first character which is not space
+                        bool has_indent = false;
+                        for (fz_stext_line* l = block->u.t.first_line; l; l = l->next) {
+                            for (fz_stext_char* c = l->first_char; c; c = c->next) {
+                                if (!isspace(c->c)) {
+                                    text_block_information.title_format.value().indent = (double)(c->origin.x);
+                                    has_indent = true;
                                     break;
                                 }
                             }
-                        }
-
-                        // case
-                        if (is_all_upper_case(text_block_information.emphasized_words.front())) {
-                            text_block_information.title_format->title_case = PDF_Title_Format::CASE::ALL_UPPER;
-                            text_block_information.title_format->same_line_with_content = false;
-                        }
-
-                        // numbering level
-                        if (text_block_information.title_format->prefix == PDF_Title_Format::PREFIX::NUMBER_DOT_NUMBERING) {
-                            // count number of number groups
-                            std::stringstream title_prefix_stringstream(title_prefix.value());
-                            std::string segment;
-                            unsigned int number_of_segments = 0;
-
-                            while (std::getline(title_prefix_stringstream, segment, '.')) {
-                                if (segment[0] != ' ') {
-                                    number_of_segments++;
-                                }
+                            if (has_indent) {
+                                break;
                             }
-
-                            text_block_information.title_format->numbering_level = number_of_segments;
                         }
+                    }
 
-                        // title font
-                        text_block_information.title_format->title_font = title_font.value();
+                    // case
+                    if (is_all_upper_case(first_word)) {
+                        text_block_information.title_format->title_case = PDF_Title_Format::CASE::ALL_UPPER;
+                        text_block_information.title_format->same_line_with_content = false;
                     }
 
-                    text_block_information.page = page_number;
-                    text_block_information.bbox = block->bbox;
-                    textblock_list.push_back(text_block_information);
+                    // title font
+                    text_block_information.title_format->title_font = PDF_Font_Identity(ctx, emphasis.title_font.value());
                 }
 
-                prev_block = block;
+                text_block_information.page = page_number;
+                text_block_information.bbox = block->bbox;
+                std::string_view stored = arena.store(block_content);
+                text_block_information.partial_paragraph_content = stored.substr(paragraph_content.data() - block_content.data(), paragraph_content.size());
+                text_block_information.emphasized_words = builder.store_words(arena, stored);
+                textblock_list.push_back(std::move(text_block_information));
             }
 
-        } fz_always(ctx) {
-            fz_drop_device(ctx, dev);
-            fz_drop_stext_page(ctx, text);
-        } fz_catch(ctx) {
-            fprintf(stderr, "render page %d error: %s\n", page_number, fz_caught_message(ctx));
-            fz_drop_page(ctx, page);
-            fz_rethrow(ctx);
-            return std::nullopt;
+            prev_block = block;
         }
 
+        metrics::observe(METRICS_STAGE::CLASSIFY, std::chrono::steady_clock::now() - classify_start);
+    } fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+        fz_drop_stext_page(ctx, text);
+    } fz_catch(ctx) {
+        // the context outlives this document, so do not rethrow out of it
+        fprintf(stderr, "render page %d error: %s\n", page_number, fz_caught_message(ctx));
         fz_drop_page(ctx, page);
+        return false;
     }
 
-    PDF_Document pdf_document;
-    PDF_Section pdf_section;
-    for (TextBlockInformation& textblock : textblock_list) {
-        PDF_Paragraph p;
-        if (textblock.title_format) {
-            if (pdf_section.title.length() > 0) { // save old section
-                pdf_document.sections.push_back(pdf_section);
-            }
-
-            pdf_section.title = textblock.emphasized_words.front();
-
-            // linhlt: remove double quote inside title string
-            if (pdf_section.title.length() > 2 && pdf_section.title[0] == '"' && pdf_section.title[pdf_section.title.length() - 1] == '"') {
-                pdf_section.title.pop_back();
-                pdf_section.title.erase(pdf_section.title.begin());
-
-                textblock.title_format.value().emphasize_style = PDF_Title_Format::EMPHASIZE_STYLE::DOUBLE_QUOTE;
-            }
-
-            pdf_section.title_format = textblock.title_format.value();
-            textblock.emphasized_words.pop_front();
-            p.emphasized_words = textblock.emphasized_words;
-            pdf_section.paragraphs.clear();
-            if (textblock.partial_paragraph_content.length() > 0) {
-                p.paragraph = textblock.partial_paragraph_content;
-                pdf_section.paragraphs.push_back(p);
-            }
-        } else if (pdf_section.title.length() > 0) {
-            p.emphasized_words = textblock.emphasized_words;
-            if (textblock.partial_paragraph_content.length() > 0) {
-                p.paragraph = textblock.partial_paragraph_content;
-                pdf_section.paragraphs.push_back(p);
-            }
-        } else {
-            p.emphasized_words = textblock.emphasized_words;
-            if (textblock.partial_paragraph_content.length() > 0) {
-                p.paragraph = textblock.partial_paragraph_content;
-                pdf_document.prefix_content.push_back(p);
-            }
-        }
-    }
+    fz_drop_page(ctx, page);
 
-    if (pdf_section.title.length() > 0) { // last one
-        pdf_document.sections.push_back(pdf_section);
-    }
+    return true;
+}
 
-    // add pdf document information
+// read the document information dictionary
+static void read_document_info(fz_context* ctx, fz_document* doc, PDF_Document_Info& document_info) {
     char meta_format[200];
     if (fz_lookup_metadata(ctx, doc, FZ_META_FORMAT, meta_format, sizeof(meta_format)) > 0) {
-        pdf_document.document_info.format = meta_format;
+        document_info.format = meta_format;
     }
 
     char meta_encryption[200];
     if (fz_lookup_metadata(ctx, doc, FZ_META_ENCRYPTION, meta_encryption, sizeof(meta_encryption)) > 0) {
-        pdf_document.document_info.encryption = meta_encryption;
+        document_info.encryption = meta_encryption;
     }
 
     char meta_title[200];
     if (fz_lookup_metadata(ctx, doc, FZ_META_INFO_TITLE, meta_title, sizeof(meta_title)) > 0) {
-        pdf_document.document_info.title = meta_title;
+        document_info.title = meta_title;
     }
 
     char meta_author[200];
     if (fz_lookup_metadata(ctx, doc, FZ_META_INFO_AUTHOR, meta_author, sizeof(meta_author)) > 0) {
-        pdf_document.document_info.author = meta_author;
+        document_info.author = meta_author;
     }
 
     char meta_subject[200];
     if (fz_lookup_metadata(ctx, doc, "info:Subject", meta_subject, sizeof(meta_subject)) > 0) {
-        pdf_document.document_info.subject = meta_subject;
+        document_info.subject = meta_subject;
     }
 
     char meta_keywords[200];
     if (fz_lookup_metadata(ctx, doc, "info:Keywords", meta_keywords, sizeof(meta_keywords)) > 0) {
-        pdf_document.document_info.keywords = meta_keywords;
+        document_info.keywords = meta_keywords;
     }
 
     char meta_creator[200];
     if (fz_lookup_metadata(ctx, doc, "info:Creator", meta_creator, sizeof(meta_creator)) > 0) {
-        pdf_document.document_info.creator = meta_creator;
+        document_info.creator = meta_creator;
     }
 
     char meta_producer[200];
     if (fz_lookup_metadata(ctx, doc, "info:Producer", meta_producer, sizeof(meta_producer)) > 0) {
-        pdf_document.document_info.producer = meta_producer;
+        document_info.producer = meta_producer;
     }
 
     char meta_creation_date[200];
     if (fz_lookup_metadata(ctx, doc, "info:CreationDate", meta_creation_date, sizeof(meta_creation_date)) > 0) {
-        pdf_document.document_info.create_date = meta_creation_date;
+        document_info.create_date = meta_creation_date;
     }
 
     char meta_modification_date[200];
     if (fz_lookup_metadata(ctx, doc, "info:ModDate", meta_modification_date, sizeof(meta_modification_date)) > 0) {
-        pdf_document.document_info.modified_date = meta_modification_date;
+        document_info.modified_date = meta_modification_date;
     }
+}
 
-    /* Clean up. */
-    fz_drop_document(ctx, doc);
-    fz_drop_context(ctx);
-    return pdf_document;
+// append the text blocks of one page to the document, starting a new section at every title block
+static void add_text_blocks(PDF_Document& pdf_document, std::vector<TextBlockInformation>& textblock_list, const PDF_Parse_Options& options) {
+    for (TextBlockInformation& textblock : textblock_list) {
+        PDF_Paragraph p;
+        p.page = textblock.page;
+        p.bbox = textblock.bbox;
+        p.paragraph = textblock.partial_paragraph_content;
+        if (textblock.title_format) {
+            // the previous section, if any, is complete from here on
+            pdf_document.sections.emplace_back();
+            PDF_Section& pdf_section = pdf_document.sections.back();
+
+            pdf_section.title = textblock.emphasized_words.front();
+
+            // linhlt: remove double quote inside title string
+            if (pdf_section.title.length() > 2 && pdf_section.title.front() == '"' && pdf_section.title.back() == '"') {
+                pdf_section.title = pdf_section.title.substr(1, pdf_section.title.length() - 2);
+
+                textblock.title_format.value().emphasize_style = PDF_Title_Format::EMPHASIZE_STYLE::DOUBLE_QUOTE;
+            }
+
+            pdf_section.title_format = textblock.title_format.value();
+            p.emphasized_words = textblock.emphasized_words.tail();
+            if (!p.paragraph.empty()) {
+                pdf_section.paragraphs.push_back(p);
+            }
+
+            if (options.on_section) {
+                options.on_section(pdf_document, pdf_section);
+            }
+        } else if (!pdf_document.sections.empty()) {
+            p.emphasized_words = textblock.emphasized_words;
+            if (!p.paragraph.empty()) {
+                pdf_document.sections.back().paragraphs.push_back(p);
+            }
+        } else {
+            p.emphasized_words = textblock.emphasized_words;
+            if (!p.paragraph.empty()) {
+                pdf_document.prefix_content.push_back(p);
+            }
+        }
+    }
 }
 
-TextBlockInformation::TextBlockInformation() {
+std::vector<unsigned int> selected_pages(const PDF_Parse_Options& options, unsigned int page_count) {
+    std::vector<unsigned int> pages;
+    for (unsigned int page_number = 0; page_number < page_count; ++page_number) {
+        if (options.max_pages && pages.size() >= options.max_pages.value()) {
+            break;
+        }
+        if (options.page_ranges.empty() ||
+            std::any_of(options.page_ranges.begin(), options.page_ranges.end(), [page_number](const std::pair<unsigned int, unsigned int>& range) {
+                return range.first <= page_number && page_number <= range.second;
+            })) {
+            pages.push_back(page_number);
+        }
+    }
+    return pages;
+}
 
+unsigned int count_selected_pages(const PDF_Parse_Options& options, unsigned int page_count) {
+    return static_cast<unsigned int>(selected_pages(options, page_count).size());
 }
 
-TextBlockInformation::TextBlockInformation(const TextBlockInformation& text_block_information) :
-    emphasized_words(text_block_information.emphasized_words),
-    partial_paragraph_content(text_block_information.partial_paragraph_content),
-    page(text_block_information.page),
-    bbox(text_block_information.bbox) {
-    if (text_block_information.title_format) {
-        title_format = text_block_information.title_format.value();
+// add the extracted blocks of the next page in order, return false if parsing was cancelled
+static bool add_page(PDF_Document& pdf_document, unsigned int page_number, std::vector<TextBlockInformation>& textblock_list, const PDF_Parse_Options& options) {
+    // nobody is waiting for the result anymore, fz_run_page may also have stopped halfway
+    if (options.cookie && options.cookie->abort) {
+        fprintf(stderr, "parsing cancelled at page %d\n", page_number);
+        return false;
+    }
+
+    if (options.on_page) {
+        options.on_page(page_number, textblock_list);
     }
+
+    add_text_blocks(pdf_document, textblock_list, options);
+    metrics::count_pages(1);
+    ++pdf_document.parsed_page_count;
+    if (pdf_document.covered_pages) {
+        pdf_document.covered_pages->push_back(page_number);
+    }
+    return true;
 }
 
-TextBlockInformation::TextBlockInformation(TextBlockInformation&& text_block_information) :
-    emphasized_words(std::move(text_block_information.emphasized_words)),
-    partial_paragraph_content(std::move(text_block_information.partial_paragraph_content)),
-    page(text_block_information.page),
-    bbox(text_block_information.bbox) {
-    if (text_block_information.title_format) {
-        title_format = text_block_information.title_format.value();
+// parse the pages one after another on the calling thread, return false on error or cancellation
+static bool parse_pages(fz_context* ctx, fz_document* doc, const std::vector<unsigned int>& pages, PDF_Document& pdf_document, const PDF_Parse_Options& options) {
+    std::vector<TextBlockInformation> textblock_list;
+    font_attribute_cache fonts(ctx);
+    for (unsigned int page_number : pages) {
+        // out of budget: keep what was parsed so far
+        if (options.deadline && std::chrono::steady_clock::now() >= options.deadline.value()) {
+            pdf_document.truncated = true;
+            break;
+        }
+
+        textblock_list.clear();
+        if (!extract_page_text_blocks(ctx, doc, page_number, textblock_list, pdf_document.text, fonts, options.cookie)) {
+            return false;
+        }
+        if (!add_page(pdf_document, page_number, textblock_list, options)) {
+            return false;
+        }
     }
+    return true;
 }
 
-PDF_Section_Node construct_document_tree(PDF_Document& document, PDF_Section& root_section) {
-    PDF_Section_Node doc_root;
-    doc_root.main_section = &root_section;
-    doc_root.parent_node = nullptr;
-    std::list<PDF_Title_Format> title_format_stack;
-    PDF_Section_Node* current_node = &doc_root;
+namespace {
+
+    // how often the parsing thread checks for an abort while helpers extract its pages
+    constexpr std::chrono::milliseconds ABORT_POLL_INTERVAL{10};
+
+    /* Pages of one document shared by the parsing thread and its helpers.
+     * Pages are claimed in order, so every page before `next` is being or has been extracted.
+     * Helpers may start after the parse is over, they must then leave without touching anything else.
+     */
+    struct parallel_pages {
+        std::mutex mutex;
+        std::condition_variable changed;
+
+        std::vector<unsigned int> pages;
+        std::vector<std::vector<TextBlockInformation>> blocks;
+        std::vector<PDF_Text_Arena> texts;      // text of each page, adopted by the document in page order
+        std::vector<char> done;
+
+        std::size_t next = 0;           // first page nobody claimed
+        std::size_t limit = 0;          // pages from here on are not claimed anymore
+        bool failed = false;
+        bool truncated = false;
+        bool closed = false;
+        unsigned int active_helpers = 0;
+
+        std::optional<std::chrono::steady_clock::time_point> deadline;
+        fz_cookie* cookie = nullptr;
+        const document_opener* reopen = nullptr;
+
+        // cookies of the helpers, aborted along with the request's one
+        std::vector<fz_cookie*> page_cookies;
+
+        // pass an abort of the request on to pages being extracted by helpers, called with mutex held
+        void forward_abort() {
+            if (cookie && cookie->abort) {
+                for (fz_cookie* page_cookie : page_cookies) {
+                    page_cookie->abort = 1;
+                }
+            }
+        }
 
-    for (PDF_Section& section : document.sections) {
+        // index of the next page to extract, nullopt once there is none, called with mutex held
+        std::optional<std::size_t> claim() {
+            forward_abort();
+            if (next < limit && cookie && cookie->abort) {
+                limit = next;
+            }
+            if (next < limit && deadline && std::chrono::steady_clock::now() >= deadline.value()) {
+                truncated = true;
+                limit = next;
+            }
+            if (next >= limit) {
+                return std::nullopt;
+            }
+            return next++;
+        }
 
-        // if this section's title format hasn't appear in title_format_stack
-        std::list<PDF_Title_Format>::iterator it = std::find(title_format_stack.begin(), title_format_stack.end(), section.title_format);
+        // extract one claimed page and publish it, called without mutex held
+        void extract(fz_context* ctx, fz_document* doc, std::size_t index, font_attribute_cache& fonts, fz_cookie* page_cookie) {
+            std::vector<TextBlockInformation> textblock_list;
+            PDF_Text_Arena text;
+            bool ok = extract_page_text_blocks(ctx, doc, pages[index], textblock_list, text, fonts, page_cookie);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            blocks[index] = std::move(textblock_list);
+            texts[index] = std::move(text);
+            done[index] = 1;
+            if (!ok) {
+                failed = true;
+                limit = next;
+            }
+            changed.notify_all();
+        }
 
-        // create subnode
-        PDF_Section_Node node;
-        node.main_section = &section;
+        // run on a helper thread with its own context and document handle
+        void help(fz_context* ctx) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (closed || !ctx) {
+                    return;
+                }
+                ++active_helpers;
+            }
 
-        if (it == title_format_stack.end()) { // not exist yet, create a subnode to add it to current node
-            // add to current node
-            if (!current_node->sub_sections) {
-                current_node->sub_sections = std::list<PDF_Section_Node>();
+            fz_document* doc = (*reopen)(ctx);
+            if (doc) {
+                // mupdf writes progress into the cookie, so every thread has its own
+                fz_cookie page_cookie{};
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    page_cookies.push_back(&page_cookie);
+                }
+                font_attribute_cache fonts(ctx);
+                for (;;) {
+                    std::optional<std::size_t> index;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        index = claim();
+                    }
+                    if (!index) {
+                        break;
+                    }
+                    extract(ctx, doc, index.value(), fonts, &page_cookie);
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    page_cookies.erase(std::find(page_cookies.begin(), page_cookies.end(), &page_cookie));
+                }
+                fz_drop_document(ctx, doc);
             }
-            node.parent_node = current_node;
-            current_node->sub_sections.value().push_back(std::move(node));
 
-            current_node = &(current_node->sub_sections.value().front());
-            title_format_stack.push_back(section.title_format);
-        } else {
-            // Up until this title_format is the last element
-            // save the iterator
-            std::list<PDF_Title_Format>::iterator tmp_it = it;
-            // it modified
-            while (it != title_format_stack.end()) {
-                current_node = current_node->parent_node;
-                ++it;
+            std::lock_guard<std::mutex> lock(mutex);
+            --active_helpers;
+            changed.notify_all();
+        }
+    };
+
+} // namespace
+
+// extract pages on helper threads too and add them in page order, return false on error or cancellation
+static bool parse_pages_parallel(fz_context* ctx, fz_document* doc, const std::vector<unsigned int>& pages, PDF_Document& pdf_document,
+                                 const PDF_Parse_Options& options, const document_opener& reopen, unsigned int helpers) {
+    std::shared_ptr<parallel_pages> state = std::make_shared<parallel_pages>();
+    state->pages = pages;
+    state->blocks.resize(pages.size());
+    state->texts.resize(pages.size());
+    state->done.resize(pages.size(), 0);
+    state->limit = pages.size();
+    state->deadline = options.deadline;
+    state->cookie = options.cookie;
+    state->reopen = &reopen;
+
+    for (unsigned int i = 0; i < helpers; ++i) {
+        options.spawn([state](fz_context* helper_ctx) {
+            state->help(helper_ctx);
+        });
+    }
+
+    // helpers use reopen and the cookie, both owned by the caller, so wait for them before returning
+    struct close_on_exit {
+        parallel_pages& state;
+        ~close_on_exit() {
+            std::unique_lock<std::mutex> lock(state.mutex);
+            state.closed = true;
+            state.limit = state.next;
+            state.changed.wait(lock, [this]() {
+                return state.active_helpers == 0;
+            });
+        }
+    } close{*state};
+
+    font_attribute_cache fonts(ctx);
+    for (std::size_t i = 0; i < pages.size(); ++i) {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        while (!state->done[i]) {
+            if (state->failed) {
+                return false;
+            }
+            if (i >= state->limit) {
+                // not claimed: out of budget, or cancelled which add_page reports below
+                pdf_document.truncated = state->truncated;
+                return !(options.cookie && options.cookie->abort);
             }
-            // it = end() here
-            ++tmp_it;
-            title_format_stack.erase(tmp_it, it);
+            // extract ahead instead of waiting while pages are left
+            std::optional<std::size_t> index = state->claim();
+            if (index) {
+                lock.unlock();
+                state->extract(ctx, doc, index.value(), fonts, options.cookie);
+                lock.lock();
+            } else if (!state->done[i]) {
+                // nothing signals an abort of the request, look for one now and then
+                state->changed.wait_for(lock, ABORT_POLL_INTERVAL);
+                state->forward_abort();
+            }
+        }
+        if (state->failed) {
+            return false;
+        }
+        std::vector<TextBlockInformation> textblock_list = std::move(state->blocks[i]);
+        pdf_document.text.adopt(std::move(state->texts[i]));
+        lock.unlock();
+
+        if (!add_page(pdf_document, pages[i], textblock_list, options)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::optional<PDF_Document> parse_pdf_document(fz_context* ctx, fz_document* doc, const PDF_Parse_Options& options) {
+    // without a way to reopen the document helpers cannot get their own handle
+    return parse_document(ctx, doc, options, nullptr);
+}
+
+static std::optional<PDF_Document> parse_document(fz_context* ctx, fz_document* doc, const PDF_Parse_Options& options, const document_opener& reopen) {
+    unsigned int page_count = 0;
+
+    /* Count the number of pages. */
+    fz_try(ctx) {
+        page_count = (unsigned int)(fz_count_pages(ctx, doc));
+    } fz_catch(ctx) {
+        fprintf(stderr, "cannot count number of pages: %s\n", fz_caught_message(ctx));
+        return std::nullopt;
+    }
 
-            node.parent_node = current_node;
+    PDF_Document pdf_document;
 
-            current_node->sub_sections.value().push_back(std::move(node));
-            current_node = &(current_node->sub_sections.value().back());
+    // add pdf document information
+    read_document_info(ctx, doc, pdf_document.document_info);
+    pdf_document.document_info.page_count = page_count;
+    if (options.on_start) {
+        options.on_start(pdf_document);
+    }
+
+    // with a page selection, skipped pages are never loaded
+    if (!options.page_ranges.empty() || options.max_pages) {
+        pdf_document.covered_pages.emplace();
+    }
+    std::vector<unsigned int> pages = selected_pages(options, page_count);
+
+    // one helper per PARALLEL_PAGES_PER_THREAD pages beyond the first batch
+    unsigned int helpers = 0;
+    if (options.spawn && reopen) {
+        helpers = std::min<unsigned int>(options.max_helpers, static_cast<unsigned int>(pages.size() / PARALLEL_PAGES_PER_THREAD));
+        helpers = helpers > 0 ? helpers - 1 : 0;
+    }
+
+    bool ok = helpers > 0 ?
+              parse_pages_parallel(ctx, doc, pages, pdf_document, options, reopen, helpers) :
+              parse_pages(ctx, doc, pages, pdf_document, options);
+    if (!ok) {
+        return std::nullopt;
+    }
+    return pdf_document;
+}
+
+PDF_Section_Tree_Builder::PDF_Section_Tree_Builder(PDF_Section_Node& doc_root) :
+    current_node(&doc_root) {
+
+}
+
+unsigned long PDF_Section_Tree_Builder::add_section(PDF_Section& section) {
+    // if this section's title format hasn't appear in title_format_stack
+    std::list<PDF_Title_Format>::iterator it = std::find(title_format_stack.begin(), title_format_stack.end(), section.title_format);
+
+    // create subnode
+    PDF_Section_Node node;
+    node.main_section = &section;
+
+    if (it == title_format_stack.end()) { // not exist yet, create a subnode to add it to current node
+        // add to current node
+        if (!current_node->sub_sections) {
+            current_node->sub_sections = std::list<PDF_Section_Node>();
+        }
+        node.parent_node = current_node;
+        current_node->sub_sections.value().push_back(std::move(node));
+
+        current_node = &(current_node->sub_sections.value().front());
+        title_format_stack.push_back(section.title_format);
+    } else {
+        // Up until this title_format is the last element
+        // save the iterator
+        std::list<PDF_Title_Format>::iterator tmp_it = it;
+        // it modified
+        while (it != title_format_stack.end()) {
+            current_node = current_node->parent_node;
+            ++it;
         }
+        // it = end() here
+        ++tmp_it;
+        title_format_stack.erase(tmp_it, it);
+
+        node.parent_node = current_node;
+
+        current_node->sub_sections.value().push_back(std::move(node));
+        current_node = &(current_node->sub_sections.value().back());
+    }
+
+    // current_node is the new node, one title format per level above it
+    return title_format_stack.size();
+}
+
+PDF_Section_Node construct_document_tree(PDF_Document& document, PDF_Section& root_section) {
+    PDF_Section_Node doc_root;
+    doc_root.main_section = &root_section;
+    doc_root.parent_node = nullptr;
+    PDF_Section_Tree_Builder tree_builder(doc_root);
+
+    for (PDF_Section& section : document.sections) {
+        tree_builder.add_section(section);
     }
 
     return doc_root;
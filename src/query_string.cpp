@@ -0,0 +1,124 @@
+#include "query_string.hpp"
+#include <algorithm>
+#include <charconv>
+#include <limits>
+
+namespace {
+
+    int hex_value(char c) {
+        if (c >= '0' && c <= '9') {
+            return c - '0';
+        }
+        if (c >= 'a' && c <= 'f') {
+            return c - 'a' + 10;
+        }
+        if (c >= 'A' && c <= 'F') {
+            return c - 'A' + 10;
+        }
+        return -1;
+    }
+
+} // namespace
+
+query_string::query_string(std::string_view target) {
+    std::size_t question_mark = target.find('?');
+    if (question_mark == std::string_view::npos) {
+        return;
+    }
+    std::string_view query = target.substr(question_mark + 1);
+
+    while (!query.empty()) {
+        std::size_t ampersand = query.find('&');
+        std::string_view param = query.substr(0, ampersand);
+        query = ampersand == std::string_view::npos ? std::string_view() : query.substr(ampersand + 1);
+
+        std::size_t equals = param.find('=');
+        if (equals == 0 || equals == std::string_view::npos) {
+            continue;
+        }
+        if (size_ == params_.size()) {
+            overflow_ = true;
+            return;
+        }
+        params_[size_++] = {param.substr(0, equals), param.substr(equals + 1)};
+    }
+}
+
+std::optional<std::string_view> query_string::find(std::string_view key) const {
+    // few parameters, a backwards scan beats any index and finds the last value first
+    for (std::size_t i = size_; i > 0; --i) {
+        if (params_[i - 1].first == key) {
+            return params_[i - 1].second;
+        }
+    }
+    return std::nullopt;
+}
+
+bool url_decode(std::string_view in, std::string& out) {
+    out.clear();
+    out.reserve(in.size());
+    for (std::size_t i = 0; i < in.size(); ++i) {
+        if (in[i] == '%') {
+            int high = i + 2 < in.size() ? hex_value(in[i + 1]) : -1;
+            int low = high >= 0 ? hex_value(in[i + 2]) : -1;
+            if (low < 0) {
+                return false;
+            }
+            out += static_cast<char>(high * 16 + low);
+            i += 2;
+        } else if (in[i] == '+') {
+            out += ' ';
+        } else {
+            out += in[i];
+        }
+    }
+    return true;
+}
+
+std::optional<unsigned long> parse_unsigned(std::string_view value) {
+    unsigned long number = 0;
+    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), number);
+    if (value.empty() || ec != std::errc() || end != value.data() + value.size()) {
+        return std::nullopt;
+    }
+    return number;
+}
+
+bool parse_page_ranges(std::string_view value, std::vector<std::pair<unsigned int, unsigned int>>& ranges) {
+    ranges.clear();
+    while (!value.empty()) {
+        std::size_t comma = value.find(',');
+        std::string_view range = value.substr(0, comma);
+        value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1);
+
+        std::size_t dash = range.find('-');
+        std::optional<unsigned long> first = parse_unsigned(range.substr(0, dash));
+        std::optional<unsigned long> last = first;
+        if (dash != std::string_view::npos) {
+            last = dash + 1 == range.size() ? std::numeric_limits<unsigned int>::max() : parse_unsigned(range.substr(dash + 1));
+        }
+        if (!first || !last || first.value() == 0 || last.value() < first.value() ||
+            last.value() > std::numeric_limits<unsigned int>::max()) {
+            return false;
+        }
+        ranges.emplace_back(static_cast<unsigned int>(first.value() - 1), static_cast<unsigned int>(last.value() - 1));
+    }
+    return !ranges.empty();
+}
+
+std::string canonical_page_ranges(std::vector<std::pair<unsigned int, unsigned int>> ranges) {
+    std::sort(ranges.begin(), ranges.end());
+    std::string canonical;
+    for (std::size_t i = 0; i < ranges.size();) {
+        // merge overlapping and adjacent ranges, they select the same pages
+        std::pair<unsigned int, unsigned int> merged = ranges[i];
+        for (++i; i < ranges.size() && (ranges[i].first <= merged.second || ranges[i].first == merged.second + 1); ++i) {
+            merged.second = std::max(merged.second, ranges[i].second);
+        }
+        if (!canonical.empty()) {
+            canonical += ',';
+        }
+        canonical += std::to_string(merged.first) + "-" + std::to_string(merged.second);
+    }
+    return canonical;
+}
@@ -0,0 +1,129 @@
+#include "reactor.hpp"
+#include "admission.hpp"
+#include "body_pool.hpp"
+#include "http_server.hpp"
+#include "logging.hpp"
+#include "parse_pool.hpp"
+#include <atomic>
+#include <future>
+#include <list>
+#include <memory>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+    using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+    void pin_current_thread(unsigned int cpu) {
+#ifdef __linux__
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpu, &cpu_set);
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+        if (error) {
+            LOG_WARNING << "Cannot pin thread to cpu " << cpu << ": error " << error;
+        }
+#else
+        LOG_WARNING << "Cannot pin thread to cpu " << cpu << ": not supported on this platform";
+#endif
+    }
+
+    void run_reactor(boost::asio::ip::tcp::endpoint endpoint, int num_workers, std::size_t num_parse_threads,
+                     std::size_t body_memory_cap, job_store& jobs, result_cache& results, result_store& stored, reactor_registry& registry, shared_mupdf_context& mupdf, std::vector<unsigned int> const& cpus,
+                     std::promise<void>& listening) {
+        std::optional<parse_pool> parser;
+        bool started = false;
+        try {
+            if (!cpus.empty()) {
+                pin_current_thread(cpus.front());
+            }
+
+            // everything below is first touched by this, possibly pinned, thread
+            parser.emplace(num_parse_threads, mupdf);
+            if (!cpus.empty()) {
+                // each job holds its thread until all have started, so every thread runs exactly one and gets its own cpu
+                std::shared_ptr<std::promise<void>> pinned = std::make_shared<std::promise<void>>();
+                std::shared_ptr<std::atomic<std::size_t>> remaining = std::make_shared<std::atomic<std::size_t>>(parser->size());
+                std::shared_ptr<std::atomic<std::size_t>> next_cpu = std::make_shared<std::atomic<std::size_t>>(0);
+                for (std::size_t i = 0; i < parser->size(); ++i) {
+                    parser->post([cpus, pinned, remaining, next_cpu](fz_context*) {
+                        pin_current_thread(cpus[(*next_cpu)++ % cpus.size()]);
+                        if (--*remaining == 0) {
+                            pinned->set_value();
+                        }
+                        while (*remaining > 0) {
+                            std::this_thread::yield();
+                        }
+                    });
+                }
+                pinned->get_future().wait();
+            }
+            body_buffer_pool bodies{body_memory_cap};
+            admission_controller admission{parser->size(), 2 * parser->size()};
+            reactor_registry::registration registered{registry, admission, bodies};
+            http_server_context context{parser.value(), bodies, admission, jobs, results, stored, registry};
+
+            boost::asio::io_context ioc{1};
+            boost::asio::ip::tcp::acceptor acceptor{ioc};
+            acceptor.open(endpoint.protocol());
+            acceptor.set_option(boost::asio::socket_base::reuse_address(true));
+            acceptor.set_option(reuse_port(true));
+            acceptor.bind(endpoint);
+            acceptor.listen();
+
+            std::list<http_worker> workers;
+            for (int i = 0; i < num_workers; ++i) {
+                workers.emplace_back(acceptor, context);
+                workers.back().start();
+            }
+            listening.set_value();
+            started = true;
+
+            ioc.run();
+
+            // workers must not be called back after they are destroyed
+            parser->join();
+        } catch (const std::exception& e) {
+            if (parser) {
+                parser->join();
+            }
+            // the constructor is gone once the reactor started, only report to it before
+            if (started) {
+                LOG_ERROR << "Reactor stopped: " << e.what();
+            } else {
+                listening.set_exception(std::current_exception());
+            }
+        }
+    }
+
+} // namespace
+
+reactor::reactor(boost::asio::ip::tcp::endpoint endpoint, int num_workers, std::size_t num_parse_threads,
+                 std::size_t body_memory_cap, job_store& jobs, result_cache& results, result_store& stored, reactor_registry& registry, shared_mupdf_context& mupdf, std::vector<unsigned int> cpus) {
+    std::promise<void> listening;
+    std::future<void> started = listening.get_future();
+    thread_ = std::thread([=, &jobs, &results, &stored, &registry, &mupdf, &listening]() {
+        run_reactor(endpoint, num_workers, num_parse_threads, body_memory_cap, jobs, results, stored, registry, mupdf, cpus, listening);
+    });
+
+    try {
+        started.get();
+    } catch (...) {
+        thread_.join();
+        throw;
+    }
+}
+
+reactor::~reactor() {
+    join();
+}
+
+void reactor::join() {
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
@@ -0,0 +1,48 @@
+#include "reactor_registry.hpp"
+
+reactor_registry::registration::registration(reactor_registry& registry, admission_controller& admission, body_buffer_pool& bodies) :
+    registry_(registry), admission_(admission), bodies_(bodies) {
+    std::lock_guard<std::mutex> lock(registry_.mutex_);
+    position_ = registry_.reactors_.insert(registry_.reactors_.end(), this);
+}
+
+reactor_registry::registration::~registration() {
+    std::lock_guard<std::mutex> lock(registry_.mutex_);
+    registry_.reactors_.erase(position_);
+}
+
+admission_controller::statistics reactor_registry::admission_stats() const {
+    admission_controller::statistics sum;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (registration* reactor : reactors_) {
+        admission_controller::statistics stats = reactor->admission_.stats();
+        sum.limit += stats.limit;
+        sum.in_flight += stats.in_flight;
+        sum.queue_depth += stats.queue_depth;
+        sum.queue_capacity += stats.queue_capacity;
+        sum.admitted += stats.admitted;
+        sum.shed_queue_full += stats.shed_queue_full;
+        sum.shed_timeout += stats.shed_timeout;
+        sum.page_latency_ms += stats.page_latency_ms;
+    }
+    if (!reactors_.empty()) {
+        sum.page_latency_ms /= reactors_.size();
+    }
+    return sum;
+}
+
+body_buffer_pool::statistics reactor_registry::body_stats() const {
+    body_buffer_pool::statistics sum;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (registration* reactor : reactors_) {
+        body_buffer_pool::statistics stats = reactor->bodies_.stats();
+        sum.memory_cap += stats.memory_cap;
+        sum.reserved_bytes += stats.reserved_bytes;
+        sum.in_use_bytes += stats.in_use_bytes;
+        sum.peak_in_use_bytes += stats.peak_in_use_bytes;
+        sum.acquired += stats.acquired;
+        sum.reused += stats.reused;
+        sum.rejected += stats.rejected;
+    }
+    return sum;
+}
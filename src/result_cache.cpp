@@ -0,0 +1,178 @@
+#include "result_cache.hpp"
+#include <functional>
+#include <mupdf/fitz.h>
+#include <sys/stat.h>
+
+namespace {
+
+    // identities end here, the variant follows
+    constexpr char VARIANT_SEPARATOR = '\n';
+
+    // file identities continue after the path with the inode, size and mtime
+    constexpr char PATH_END = '\0';
+
+    constexpr char HEX_DIGITS[] = "0123456789abcdef";
+
+} // namespace
+
+result_cache::result_cache(std::size_t memory_cap, std::chrono::seconds ttl) :
+    shard_memory_cap_(memory_cap / RESULT_CACHE_SHARDS),
+    ttl_(ttl),
+    shards_(RESULT_CACHE_SHARDS) {
+}
+
+std::optional<std::string> result_cache::file_identity(std::string const& path) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        return std::nullopt;
+    }
+    std::string identity = document_identity(path);
+    identity += PATH_END;
+    identity += std::to_string(st.st_ino) + ":" + std::to_string(st.st_size) + ":" +
+                std::to_string(st.st_mtim.tv_sec) + "." + std::to_string(st.st_mtim.tv_nsec);
+    return identity;
+}
+
+std::optional<std::string> result_cache::upload_identity(const void* data, std::size_t size) {
+#if RESULT_CACHE_HASH_UPLOADS
+    // uploads come from any client, a hash anyone can collide would serve one client's document to another
+    return "u:" + digest(data, size) + ":" + std::to_string(size);
+#else
+    (void)data;
+    (void)size;
+    return std::nullopt;
+#endif
+}
+
+std::string result_cache::digest(const void* data, std::size_t size) {
+    unsigned char hash[32];
+    fz_sha256 state;
+    fz_sha256_init(&state);
+    fz_sha256_update(&state, static_cast<const unsigned char*>(data), size);
+    fz_sha256_final(&state, hash);
+
+    std::string hex;
+    hex.reserve(2 * sizeof(hash));
+    for (unsigned char byte : hash) {
+        hex += HEX_DIGITS[byte >> 4];
+        hex += HEX_DIGITS[byte & 0xf];
+    }
+    return hex;
+}
+
+std::string result_cache::make_key(std::string const& identity, std::string_view variant) {
+    std::string key = identity;
+    key += VARIANT_SEPARATOR;
+    key += variant;
+    return key;
+}
+
+std::string_view result_cache::document_of(std::string_view key) {
+    if (key.substr(0, 2) == "f:") {
+        return key.substr(0, key.find(PATH_END));
+    }
+    return key.substr(0, key.find(VARIANT_SEPARATOR));
+}
+
+std::string result_cache::document_identity(std::string const& path) {
+    return "f:" + path;
+}
+
+std::shared_ptr<const result_cache::result> result_cache::find(std::string const& key) {
+    shard& s = shard_of(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto found = s.index.find(key);
+    if (found == s.index.end()) {
+        ++s.stats.misses;
+        return nullptr;
+    }
+    if (found->second->expires <= std::chrono::steady_clock::now()) {
+        erase(s, found->second);
+        ++s.stats.expirations;
+        ++s.stats.misses;
+        return nullptr;
+    }
+    s.lru.splice(s.lru.begin(), s.lru, found->second);
+    ++s.stats.hits;
+    return found->second->value;
+}
+
+void result_cache::insert(std::string const& key, std::shared_ptr<const result> value) {
+    std::size_t memory_bytes = key.size() + value->body.size() + sizeof(entry);
+    if (memory_bytes > shard_memory_cap_) {
+        return;
+    }
+
+    shard& s = shard_of(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto found = s.index.find(key);
+    if (found != s.index.end()) {
+        // parsed twice concurrently, keep the newer one
+        erase(s, found->second);
+    }
+    while (s.memory_bytes + memory_bytes > shard_memory_cap_ && !s.lru.empty()) {
+        erase(s, std::prev(s.lru.end()));
+        ++s.stats.evictions;
+    }
+
+    s.lru.push_front(entry{key, std::move(value), std::chrono::steady_clock::now() + ttl_, memory_bytes});
+    s.index.emplace(s.lru.front().key, s.lru.begin());
+    s.memory_bytes += memory_bytes;
+    ++s.stats.insertions;
+}
+
+std::size_t result_cache::invalidate(std::string const& path) {
+    std::string document = document_identity(path);
+    shard& s = shard_of(document);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    std::size_t removed = 0;
+    for (auto it = s.lru.begin(); it != s.lru.end();) {
+        auto current = it++;
+        if (document_of(current->key) == document) {
+            erase(s, current);
+            ++removed;
+        }
+    }
+    s.stats.invalidations += removed;
+    return removed;
+}
+
+std::size_t result_cache::clear() {
+    std::size_t removed = 0;
+    for (shard& s : shards_) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        removed += s.lru.size();
+        s.stats.invalidations += s.lru.size();
+        s.index.clear();
+        s.lru.clear();
+        s.memory_bytes = 0;
+    }
+    return removed;
+}
+
+result_cache::statistics result_cache::stats() {
+    statistics total;
+    for (shard& s : shards_) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        total.entries += s.lru.size();
+        total.memory_bytes += s.memory_bytes;
+        total.hits += s.stats.hits;
+        total.misses += s.stats.misses;
+        total.insertions += s.stats.insertions;
+        total.evictions += s.stats.evictions;
+        total.expirations += s.stats.expirations;
+        total.invalidations += s.stats.invalidations;
+    }
+    return total;
+}
+
+result_cache::shard& result_cache::shard_of(std::string_view key) {
+    std::size_t hash = std::hash<std::string_view>{}(document_of(key));
+    return shards_[hash & (RESULT_CACHE_SHARDS - 1)];
+}
+
+void result_cache::erase(shard& s, std::list<entry>::iterator it) {
+    s.memory_bytes -= it->memory_bytes;
+    s.index.erase(it->key);
+    s.lru.erase(it);
+}
@@ -0,0 +1,392 @@
+#include "result_store.hpp"
+#include "logging.hpp"
+#include "result_cache.hpp"
+#include <boost/filesystem.hpp>
+#include <mupdf/fitz.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unordered_set>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+    struct index_header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t record_size;
+    };
+
+    // version 1 named objects by a 64-bit FNV hash, its indexes are ignored and its files removed
+    constexpr index_header INDEX_HEADER = {{'P', 'D', 'F', 'R', 'S', 'I', 'D', 'X'}, 2, 72};
+
+    constexpr std::uint64_t DOCUMENT_SEED = 0x6a09e667f3bcc908ULL;
+
+    constexpr char HEX_DIGITS[] = "0123456789abcdef";
+
+    // keys and bodies may come from any client, so a collision must be infeasible to construct
+    std::array<std::uint8_t, 32> sha256(std::string_view data) {
+        std::array<std::uint8_t, 32> digest;
+        fz_sha256 state;
+        fz_sha256_init(&state);
+        fz_sha256_update(&state, reinterpret_cast<const unsigned char*>(data.data()), data.size());
+        fz_sha256_final(&state, digest.data());
+        return digest;
+    }
+
+    // FNV-1a with a splitmix64 finalizer, stable across builds unlike std::hash; only groups keys for invalidation
+    std::uint64_t hash64(std::string_view data, std::uint64_t seed) {
+        std::uint64_t h = 0xcbf29ce484222325ULL ^ seed;
+        for (unsigned char c : data) {
+            h ^= c;
+            h *= 0x100000001b3ULL;
+        }
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+        return h;
+    }
+
+    bool write_file(std::string const& path, std::string_view data) {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        while (!data.empty()) {
+            ssize_t written = ::write(fd, data.data(), data.size());
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                ::close(fd);
+                return false;
+            }
+            data.remove_prefix(static_cast<std::size_t>(written));
+        }
+        return ::close(fd) == 0;
+    }
+
+} // namespace
+
+result_store::result_store(std::string directory, std::uint64_t disk_cap) :
+    directory_(std::move(directory)),
+    disk_cap_(disk_cap) {
+    if (directory_.empty()) {
+        return;
+    }
+
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(directory_ + "/objects", ec);
+    if (!ec) {
+        boost::filesystem::create_directories(directory_ + "/tmp", ec);
+    }
+    if (ec) {
+        LOG_ERROR << "Result store disabled, cannot create " << directory_ << ": " << ec.message();
+        return;
+    }
+
+    // replayed once, then rewritten with only the live records
+    std::string index_path = directory_ + "/index";
+    if (!load(index_path) || !compact(index_path)) {
+        LOG_ERROR << "Result store disabled, cannot use " << index_path << ": " << std::strerror(errno);
+        entries_.clear();
+        order_.clear();
+        objects_.clear();
+        disk_bytes_ = 0;
+        return;
+    }
+    remove_orphans();
+    LOG_INFO << "Result store " << directory_ << ": " << entries_.size() << " results, " << disk_bytes_ << " bytes";
+}
+
+result_store::~result_store() {
+    if (index_fd_ >= 0) {
+        ::close(index_fd_);
+    }
+}
+
+std::optional<result_store::hit> result_store::find(std::string const& key) {
+    if (!enabled()) {
+        return std::nullopt;
+    }
+
+    record r{};
+    set_key(r, key);
+    key_t hashed{r.key[0], r.key[1]};
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = entries_.find(hashed);
+    if (found == entries_.end()) {
+        ++stats_.misses;
+        return std::nullopt;
+    }
+
+    // opened under the lock, so it cannot be deleted in between; once open it stays readable
+    record const& stored = found->second.stored;
+    std::string path = object_path(object_name(stored));
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) != 0 || static_cast<std::uint64_t>(st.st_size) != stored.size) {
+        LOG_WARNING << "Dropping damaged stored result " << path;
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        erase(found);
+        ++stats_.misses;
+        return std::nullopt;
+    }
+    ++stats_.hits;
+    return hit{fd, stored.size, static_cast<CONTENT_ENCODING>(stored.encoding), static_cast<OUTPUT_FORMAT>(stored.format)};
+}
+
+void result_store::insert(std::string const& key, std::string_view body, CONTENT_ENCODING encoding, OUTPUT_FORMAT format) {
+    if (!enabled() || body.empty() || body.size() > disk_cap_) {
+        return;
+    }
+
+    record r{};
+    set_key(r, key);
+    r.document = hash64(result_cache::document_of(key), DOCUMENT_SEED);
+    r.object = sha256(body);
+    r.size = body.size();
+    r.encoding = static_cast<std::uint32_t>(encoding);
+    r.format = static_cast<std::uint32_t>(format);
+
+    std::string name = object_name(r);
+    {
+        // an equal body is already stored for another variant or document
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (objects_.count(name)) {
+            commit(r);
+            return;
+        }
+    }
+
+    // written outside the lock, renamed in under it so a concurrent eviction cannot miss it
+    std::string temporary = directory_ + "/tmp/" + std::to_string(temporary_++);
+    bool written = write_file(temporary, body);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!written || ::rename(temporary.c_str(), object_path(name).c_str()) != 0) {
+        LOG_WARNING << "Cannot store result of " << body.size() << " bytes in " << directory_ << ": " << std::strerror(errno);
+        ::unlink(temporary.c_str());
+        ++stats_.write_errors;
+        return;
+    }
+    commit(r);
+}
+
+std::size_t result_store::invalidate(std::string const& path) {
+    if (!enabled()) {
+        return 0;
+    }
+
+    std::uint64_t document = hash64(result_cache::document_identity(path), DOCUMENT_SEED);
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::size_t removed = 0;
+    for (auto it = entries_.begin(); it != entries_.end();) {
+        auto current = it++;
+        if (current->second.stored.document == document) {
+            erase(current);
+            ++removed;
+        }
+    }
+    stats_.invalidations += removed;
+    return removed;
+}
+
+std::size_t result_store::clear() {
+    if (!enabled()) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::size_t removed = entries_.size();
+    while (!entries_.empty()) {
+        remove(entries_.begin(), true);
+    }
+    // start the log over with just the header
+    if (::ftruncate(index_fd_, 0) != 0 || ::write(index_fd_, &INDEX_HEADER, sizeof(index_header)) != static_cast<ssize_t>(sizeof(index_header))) {
+        LOG_WARNING << "Cannot truncate result store index in " << directory_ << ": " << std::strerror(errno);
+        ++stats_.write_errors;
+    }
+    stats_.invalidations += removed;
+    return removed;
+}
+
+result_store::statistics result_store::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    statistics current = stats_;
+    current.entries = entries_.size();
+    current.disk_bytes = disk_bytes_;
+    return current;
+}
+
+bool result_store::load(std::string const& index_path) {
+    int fd = ::open(index_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno == ENOENT;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    std::size_t size = static_cast<std::size_t>(st.st_size);
+    if (size >= sizeof(index_header)) {
+        void* mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            return false;
+        }
+        ::madvise(mapped, size, MADV_SEQUENTIAL);
+
+        const char* data = static_cast<const char*>(mapped);
+        if (std::memcmp(data, &INDEX_HEADER, sizeof(index_header)) == 0) {
+            // a record cut short by a crash is ignored
+            for (std::size_t offset = sizeof(index_header); offset + sizeof(record) <= size; offset += sizeof(record)) {
+                record r;
+                std::memcpy(&r, data + offset, sizeof(record));
+                if (r.encoding <= static_cast<std::uint32_t>(CONTENT_ENCODING::DEFLATE) && r.format <= static_cast<std::uint32_t>(OUTPUT_FORMAT::FLAT)) {
+                    add(r, false);
+                }
+            }
+        } else {
+            LOG_WARNING << "Ignoring result store index " << index_path << " of another format";
+        }
+        ::munmap(mapped, size);
+    }
+    ::close(fd);
+    return true;
+}
+
+bool result_store::compact(std::string const& index_path) {
+    // oldest first, so replaying it restores the eviction order
+    std::string data(reinterpret_cast<const char*>(&INDEX_HEADER), sizeof(index_header));
+    data.reserve(sizeof(index_header) + entries_.size() * sizeof(record));
+    for (auto const& [sequence, key] : order_) {
+        record const& r = entries_.at(key).stored;
+        data.append(reinterpret_cast<const char*>(&r), sizeof(record));
+    }
+
+    std::string temporary = directory_ + "/tmp/index";
+    if (!write_file(temporary, data) || ::rename(temporary.c_str(), index_path.c_str()) != 0) {
+        return false;
+    }
+    int fd = ::open(index_path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    index_fd_ = fd;
+    return true;
+}
+
+void result_store::remove_orphans() {
+    std::unordered_set<std::string> referenced;
+    for (auto const& [name, o] : objects_) {
+        referenced.insert(object_path(name));
+    }
+
+    boost::system::error_code ec;
+    std::size_t removed = 0;
+    for (boost::filesystem::directory_iterator it(directory_ + "/objects", ec), end; !ec && it != end; it.increment(ec)) {
+        if (!referenced.count(it->path().string())) {
+            boost::filesystem::remove(it->path(), ec);
+            ++removed;
+        }
+    }
+    for (boost::filesystem::directory_iterator it(directory_ + "/tmp", ec), end; !ec && it != end; it.increment(ec)) {
+        boost::filesystem::remove(it->path(), ec);
+    }
+    if (removed) {
+        LOG_INFO << "Removed " << removed << " unreferenced result files from " << directory_;
+    }
+}
+
+std::string result_store::object_name(record const& r) {
+    std::string name;
+    name.reserve(2 * r.object.size() + 17);
+    for (std::uint8_t byte : r.object) {
+        name += HEX_DIGITS[byte >> 4];
+        name += HEX_DIGITS[byte & 0xf];
+    }
+    char size[20];
+    std::snprintf(size, sizeof(size), "-%llx", static_cast<unsigned long long>(r.size));
+    return name + size;
+}
+
+std::string result_store::object_path(std::string const& name) const {
+    return directory_ + "/objects/" + name;
+}
+
+void result_store::set_key(record& r, std::string const& key) {
+    std::array<std::uint8_t, 32> digest = sha256(key);
+    std::memcpy(r.key, digest.data(), sizeof(r.key));
+}
+
+void result_store::add(record const& r, bool delete_objects) {
+    // referenced before the old record is released, so rewriting a key with the same body keeps the file
+    if (r.size != 0) {
+        object& o = objects_[object_name(r)];
+        if (o.references++ == 0) {
+            o.size = r.size;
+            disk_bytes_ += r.size;
+        }
+    }
+
+    key_t key{r.key[0], r.key[1]};
+    auto found = entries_.find(key);
+    if (found != entries_.end()) {
+        remove(found, delete_objects);
+    }
+    if (r.size != 0) {
+        entries_.emplace(key, entry{r, ++sequence_});
+        order_.emplace(sequence_, key);
+    }
+}
+
+void result_store::remove(std::unordered_map<key_t, entry, key_hash>::iterator it, bool delete_objects) {
+    record const& r = it->second.stored;
+    auto o = objects_.find(object_name(r));
+    if (o != objects_.end() && --o->second.references == 0) {
+        disk_bytes_ -= o->second.size;
+        if (delete_objects) {
+            ::unlink(object_path(o->first).c_str());
+        }
+        objects_.erase(o);
+    }
+    order_.erase(it->second.sequence);
+    entries_.erase(it);
+}
+
+void result_store::erase(std::unordered_map<key_t, entry, key_hash>::iterator it) {
+    record removal{};
+    removal.key[0] = it->first.first;
+    removal.key[1] = it->first.second;
+    append(removal);
+    remove(it, true);
+}
+
+void result_store::commit(record const& r) {
+    add(r, true);
+    append(r);
+    ++stats_.writes;
+
+    while (disk_bytes_ > disk_cap_ && !order_.empty()) {
+        erase(entries_.find(order_.begin()->second));
+        ++stats_.evictions;
+    }
+}
+
+void result_store::append(record const& r) {
+    // records are far below PIPE_BUF, an O_APPEND write of one is never interleaved
+    if (::write(index_fd_, &r, sizeof(record)) != static_cast<ssize_t>(sizeof(record))) {
+        LOG_WARNING << "Cannot append to result store index in " << directory_ << ": " << std::strerror(errno);
+        ++stats_.write_errors;
+    }
+}
@@ -1,6 +1,17 @@
 #include "string_utils.hpp"
+#include "json_writer.hpp"
 
 
+nlohmann::json add_json_paragraph(PDF_Paragraph &paragraph)
+{
+    nlohmann::json json_pdf_paragraph;
+    json_pdf_paragraph["paragraph"] = paragraph.paragraph;
+    for (std::string_view emphasized_word : paragraph.emphasized_words) {
+        json_pdf_paragraph["keywords"] += emphasized_word;
+    }
+    return json_pdf_paragraph;
+}
+
 nlohmann::json add_json_node(PDF_Section_Node &current_node, unsigned int &id)
 {
     nlohmann::json json_pdf_section;
@@ -11,12 +22,7 @@ nlohmann::json add_json_node(PDF_Section_Node &current_node, unsigned int &id)
         json_pdf_section["parent_id"] = current_node.parent_node->main_section->id;
     }
     for (PDF_Paragraph& paragraph : current_node.main_section->paragraphs) {
-        nlohmann::json json_pdf_paragraph;
-        json_pdf_paragraph["paragraph"] = paragraph.paragraph;
-        for (std::string& emphasized_word : paragraph.emphasized_words) {
-            json_pdf_paragraph["keywords"] += emphasized_word;
-        }
-        json_pdf_section["paragraphs"] += json_pdf_paragraph;
+        json_pdf_section["paragraphs"] += add_json_paragraph(paragraph);
     }
 
     if(current_node.sub_sections) {
@@ -28,10 +34,42 @@ nlohmann::json add_json_node(PDF_Section_Node &current_node, unsigned int &id)
     return json_pdf_section;
 }
 
-std::string format_pdf_document_tree(PDF_Section_Node &doc_root)
+std::string format_page_ranges(const std::vector<unsigned int>& pages)
+{
+    std::string ranges;
+    for (std::size_t i = 0; i < pages.size(); ++i) {
+        std::size_t last = i;
+        while (last + 1 < pages.size() && pages[last + 1] == pages[last] + 1) {
+            ++last;
+        }
+        ranges += ranges.empty() ? "" : ",";
+        ranges += std::to_string(pages[i] + 1);
+        if (last > i) {
+            ranges += "-" + std::to_string(pages[last] + 1);
+        }
+        i = last;
+    }
+    return ranges;
+}
+
+nlohmann::json pdf_document_tree_to_json(PDF_Section_Node &doc_root, bool truncated, const std::optional<std::vector<unsigned int>>& covered_pages)
 {
     // present as tree
     unsigned int start_id = 0;
     nlohmann::json json_pdf_document = add_json_node(doc_root, start_id);
-    return json_pdf_document.dump();
+    if (truncated) {
+        json_pdf_document["truncated"] = true;
+    }
+    if (covered_pages) {
+        json_pdf_document["pages"] = format_page_ranges(covered_pages.value());
+    }
+    return json_pdf_document;
+}
+
+std::string format_pdf_document_tree(PDF_Section_Node &doc_root, bool truncated, const std::optional<std::vector<unsigned int>>& covered_pages)
+{
+    // written directly, the DOM of a large document takes several times the memory of its text
+    std::string json;
+    append_json_document(json, doc_root, truncated, covered_pages);
+    return json;
 }
@@ -0,0 +1,292 @@
+#include "text_kernels.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TEXT_KERNELS_X86 1
+#include <immintrin.h>
+#else
+#define TEXT_KERNELS_X86 0
+#endif
+
+namespace {
+
+    constexpr bool is_ascii_space(char c) {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    constexpr bool in_range(char c, char lo, char hi) {
+        return c >= lo && c <= hi;
+    }
+
+    // ---- scalar
+
+    void append_utf8_scalar(std::string& out, const int* codepoints, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            append_utf8(out, codepoints[i]);
+        }
+    }
+
+    std::size_t find_first_not_space_scalar(const char* s, std::size_t size) {
+        std::size_t i = 0;
+        while (i < size && is_ascii_space(s[i])) {
+            ++i;
+        }
+        return i;
+    }
+
+    std::size_t find_last_not_space_scalar(const char* s, std::size_t size) {
+        while (size > 0 && is_ascii_space(s[size - 1])) {
+            --size;
+        }
+        return size;
+    }
+
+    bool has_range_scalar(const char* s, std::size_t size, char lo, char hi) {
+        return std::any_of(s, s + size, [lo, hi](char c) {
+            return in_range(c, lo, hi);
+        });
+    }
+
+#if TEXT_KERNELS_X86
+
+    // ---- SSE4.2, 16 bytes or codepoints at a time
+
+    // the ASCII spaces as a PCMPESTRI set
+    const char space_set[16] = {' ', '\t', '\n', '\v', '\f', '\r'};
+    constexpr int space_set_size = 6;
+
+    // a bit set for each of the 4 codepoints that is ASCII
+    __attribute__((target("sse4.2")))
+    inline unsigned int ascii_lanes_sse42(__m128i codepoints) {
+        __m128i high = _mm_and_si128(codepoints, _mm_set1_epi32(~0x7f));
+        return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(high, _mm_setzero_si128())));
+    }
+
+    __attribute__((target("sse4.2")))
+    void append_utf8_sse42(std::string& out, const int* codepoints, std::size_t count) {
+        std::size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            const __m128i* p = reinterpret_cast<const __m128i*>(codepoints + i);
+            __m128i a = _mm_loadu_si128(p), b = _mm_loadu_si128(p + 1), c = _mm_loadu_si128(p + 2), d = _mm_loadu_si128(p + 3);
+            // one bit per ASCII codepoint, in order
+            unsigned int ascii = ascii_lanes_sse42(a) | ascii_lanes_sse42(b) << 4 | ascii_lanes_sse42(c) << 8 | ascii_lanes_sse42(d) << 12;
+
+            // bytes past the first non-ASCII codepoint are saturated garbage, only the prefix is kept
+            __m128i bytes = _mm_packus_epi16(_mm_packus_epi32(a, b), _mm_packus_epi32(c, d));
+            char buffer[16];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(buffer), bytes);
+            if (ascii == 0xffff) {
+                out.append(buffer, 16);
+                continue;
+            }
+            // non-ASCII text tends to go on, so the rest of the window is encoded one by one
+            std::size_t prefix = __builtin_ctz(~ascii);
+            out.append(buffer, prefix);
+            append_utf8_scalar(out, codepoints + i + prefix, 16 - prefix);
+        }
+        append_utf8_scalar(out, codepoints + i, count - i);
+    }
+
+    __attribute__((target("sse4.2")))
+    std::size_t find_first_not_space_sse42(const char* s, std::size_t size) {
+        const __m128i set = _mm_loadu_si128(reinterpret_cast<const __m128i*>(space_set));
+        std::size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+            int index = _mm_cmpestri(set, space_set_size, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_NEGATIVE_POLARITY);
+            if (index < 16) {
+                return i + index;
+            }
+        }
+        return i + find_first_not_space_scalar(s + i, size - i);
+    }
+
+    __attribute__((target("sse4.2")))
+    std::size_t find_last_not_space_sse42(const char* s, std::size_t size) {
+        const __m128i set = _mm_loadu_si128(reinterpret_cast<const __m128i*>(space_set));
+        for (; size >= 16; size -= 16) {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + size - 16));
+            int index = _mm_cmpestri(set, space_set_size, chunk, 16,
+                                     _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_NEGATIVE_POLARITY | _SIDD_MOST_SIGNIFICANT);
+            if (index < 16) {
+                return size - 16 + index + 1;
+            }
+        }
+        return find_last_not_space_scalar(s, size);
+    }
+
+    __attribute__((target("sse4.2")))
+    bool has_range_sse42(const char* s, std::size_t size, char lo, char hi) {
+        // shift the range to start at -128 so one signed compare tests both ends
+        const __m128i shift = _mm_set1_epi8(static_cast<char>(0x80 - lo));
+        const __m128i bound = _mm_set1_epi8(static_cast<char>(-128 + (hi - lo) + 1));
+        std::size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            __m128i chunk = _mm_add_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i)), shift);
+            if (_mm_movemask_epi8(_mm_cmpgt_epi8(bound, chunk))) {
+                return true;
+            }
+        }
+        return has_range_scalar(s + i, size - i, lo, hi);
+    }
+
+    // ---- AVX2, 32 bytes or 16 codepoints at a time
+
+    // a bit set for each of the 8 codepoints that is ASCII
+    __attribute__((target("avx2")))
+    inline unsigned int ascii_lanes_avx2(__m256i codepoints) {
+        __m256i high = _mm256_and_si256(codepoints, _mm256_set1_epi32(~0x7f));
+        return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(high, _mm256_setzero_si256())));
+    }
+
+    __attribute__((target("avx2")))
+    void append_utf8_avx2(std::string& out, const int* codepoints, std::size_t count) {
+        std::size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            const __m256i* p = reinterpret_cast<const __m256i*>(codepoints + i);
+            __m256i a = _mm256_loadu_si256(p), b = _mm256_loadu_si256(p + 1);
+            unsigned int ascii = ascii_lanes_avx2(a) | ascii_lanes_avx2(b) << 8;
+
+            // packs work per 128-bit lane, the permutes put the bytes back in order
+            __m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xd8);
+            __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), 0x08);
+            char buffer[16];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(buffer), _mm256_castsi256_si128(bytes));
+            if (ascii == 0xffff) {
+                out.append(buffer, 16);
+                continue;
+            }
+            std::size_t prefix = __builtin_ctz(~ascii);
+            out.append(buffer, prefix);
+            append_utf8_scalar(out, codepoints + i + prefix, 16 - prefix);
+        }
+        append_utf8_scalar(out, codepoints + i, count - i);
+    }
+
+    __attribute__((target("avx2")))
+    bool has_range_avx2(const char* s, std::size_t size, char lo, char hi) {
+        const __m256i shift = _mm256_set1_epi8(static_cast<char>(0x80 - lo));
+        const __m256i bound = _mm256_set1_epi8(static_cast<char>(-128 + (hi - lo) + 1));
+        std::size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+            __m256i chunk = _mm256_add_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i)), shift);
+            if (_mm256_movemask_epi8(_mm256_cmpgt_epi8(bound, chunk))) {
+                return true;
+            }
+        }
+        // the tail is SSE code, which stalls on dirty upper halves; the compiler leaves them dirty on a tail call
+        _mm256_zeroupper();
+        return has_range_sse42(s + i, size - i, lo, hi);
+    }
+
+#endif
+
+    struct kernels {
+        const char* name;
+        bool (*supported)();
+        void (*append_utf8)(std::string&, const int*, std::size_t);
+        std::size_t (*find_first_not_space)(const char*, std::size_t);
+        std::size_t (*find_last_not_space)(const char*, std::size_t);
+        bool (*has_range)(const char*, std::size_t, char, char);
+    };
+
+    // best first
+    const kernels kernel_sets[] = {
+#if TEXT_KERNELS_X86
+        // trimming only scans the ends of a string, 16 bytes at a time is plenty
+        {"avx2", []() { __builtin_cpu_init(); return __builtin_cpu_supports("avx2") != 0; },
+         append_utf8_avx2, find_first_not_space_sse42, find_last_not_space_sse42, has_range_avx2},
+        {"sse4.2", []() { __builtin_cpu_init(); return __builtin_cpu_supports("sse4.2") != 0; },
+         append_utf8_sse42, find_first_not_space_sse42, find_last_not_space_sse42, has_range_sse42},
+#endif
+        {"scalar", []() { return true; },
+         append_utf8_scalar, find_first_not_space_scalar, find_last_not_space_scalar, has_range_scalar},
+    };
+
+    kernels select_kernels() {
+        for (const kernels& set : kernel_sets) {
+            if (set.supported()) {
+                return set;
+            }
+        }
+        return kernel_sets[std::size(kernel_sets) - 1];
+    }
+
+    kernels selected = select_kernels();
+
+    struct normalization {
+        int codepoint;
+        const char* replacement;
+    };
+
+    // sorted by codepoint
+    constexpr normalization normalizations[] = {
+#if NORMALIZE_PUNCTUATION
+        {0x2010, "-"}, {0x2011, "-"}, {0x2012, "-"}, {0x2013, "-"}, {0x2014, "-"}, {0x2015, "-"},
+        {0x2018, "'"}, {0x2019, "'"},
+#endif
+        {0x201c, "\""}, {0x201d, "\""},
+#if NORMALIZE_PUNCTUATION
+        {0xfb00, "ff"}, {0xfb01, "fi"}, {0xfb02, "fl"}, {0xfb03, "ffi"}, {0xfb04, "ffl"},
+#endif
+    };
+
+} // namespace
+
+void append_utf8(std::string& out, const int* codepoints, std::size_t count) {
+    selected.append_utf8(out, codepoints, count);
+}
+
+std::size_t find_first_not_space(const char* s, std::size_t size) {
+    return selected.find_first_not_space(s, size);
+}
+
+std::size_t find_last_not_space(const char* s, std::size_t size) {
+    return selected.find_last_not_space(s, size);
+}
+
+bool has_ascii_lower(const char* s, std::size_t size) {
+    return selected.has_range(s, size, 'a', 'z');
+}
+
+bool has_ascii_upper(const char* s, std::size_t size) {
+    return selected.has_range(s, size, 'A', 'Z');
+}
+
+const char* text_kernels_name() {
+    return selected.name;
+}
+
+bool use_text_kernels(const char* name) {
+    for (const kernels& set : kernel_sets) {
+        if (std::strcmp(set.name, name) == 0 && set.supported()) {
+            selected = set;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::size_t normalize_codepoint(int codepoint, int* out) {
+    // nearly all text never reaches the table
+    if (codepoint < normalizations[0].codepoint) {
+        out[0] = codepoint;
+        return 1;
+    }
+    const normalization* end = normalizations + sizeof(normalizations) / sizeof(normalizations[0]);
+    const normalization* found = std::lower_bound(normalizations, end, codepoint, [](const normalization& n, int c) {
+        return n.codepoint < c;
+    });
+    if (found == end || found->codepoint != codepoint) {
+        out[0] = codepoint;
+        return 1;
+    }
+    std::size_t count = std::strlen(found->replacement);
+    for (std::size_t i = 0; i < count; ++i) {
+        out[i] = found->replacement[i];
+    }
+    return count;
+}
@@ -0,0 +1,64 @@
+// admission_controller with one slot: queued jobs are shed once they waited
+// ADMISSION_QUEUE_TIMEOUT (built as 1 second) while the running job never
+// completes, a full queue refuses, and queue waits reach the histogram.
+
+#include "admission.hpp"
+#include "metrics.hpp"
+#include "test_check.hpp"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+namespace {
+
+    struct job_state {
+        bool started = false;
+        bool shed = false;
+    };
+
+    bool submit(admission_controller& admission, job_state& job) {
+        return admission.submit([&job]() {
+            job.started = true;
+        }, [&job]() {
+            job.shed = true;
+        });
+    }
+
+} // namespace
+
+int main() {
+    admission_controller admission(1, 1, 2);
+    job_state a, b, c, d, e, f;
+
+    check(submit(admission, a) && a.started, "free slot starts right away");
+    check(submit(admission, b) && !b.started && !b.shed, "busy slot queues");
+
+    std::chrono::steady_clock::time_point submitted = std::chrono::steady_clock::now();
+    std::optional<std::chrono::steady_clock::time_point> next = admission.expire();
+    check(!b.shed && next && next.value() > submitted && next.value() <= submitted + std::chrono::seconds(ADMISSION_QUEUE_TIMEOUT), "next timeout reported");
+
+    // nothing completes, the timeout alone sheds
+    std::this_thread::sleep_until(next.value_or(submitted));
+    check(!admission.expire() && b.shed && !b.started, "timed out job shed without a completion");
+    check(admission.stats().shed_timeout == 1 && admission.stats().queue_depth == 0, "timeout counted");
+
+    // a later submit also sheds what timed out before queueing itself
+    check(submit(admission, c), "queued again");
+    std::this_thread::sleep_for(std::chrono::seconds(ADMISSION_QUEUE_TIMEOUT));
+    check(submit(admission, d) && c.shed && !d.shed && !d.started, "submit sheds timed out jobs");
+
+    check(submit(admission, e) && !submit(admission, f) && !f.started && !f.shed, "full queue refuses");
+    check(admission.stats().shed_queue_full == 1 && admission.stats().queue_depth == 2, "queue full counted");
+
+    admission.complete(std::chrono::milliseconds(10), 1, true);
+    check(d.started && !e.started && admission.stats().in_flight == 1, "completion starts the next job");
+
+    // a and d were admitted, one right away and one after waiting
+    std::string out;
+    metrics::write_prometheus(out);
+    check(out.find("pdf_parse_queue_wait_seconds_count 2\n") != std::string::npos, "queue waits observed");
+    check(out.find("pdf_parse_queue_wait_seconds_bucket{le=\"0.0005\"} 1\n") != std::string::npos, "immediate start is a zero wait");
+
+    return report();
+}
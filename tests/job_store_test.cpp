@@ -0,0 +1,44 @@
+// job_store: results are shared rather than copied, memory is accounted
+// for uploads and results, and a result over the cap fails the job.
+
+#include "job_store.hpp"
+#include "test_check.hpp"
+#include <memory>
+#include <string>
+
+int main() {
+    job_store jobs(4, 1000);
+
+    std::shared_ptr<job_store::job> job = jobs.create(std::string(100, 'u'));
+    check(job && jobs.stats().memory_bytes == 100, "upload accounted");
+    std::shared_ptr<const std::string> result;
+    check(jobs.result(job->id, result)->state == job_store::STATE::QUEUED && !result, "no result while queued");
+
+    jobs.start(*job);
+    check(jobs.find(job->id)->state == job_store::STATE::RUNNING && jobs.stats().running == 1, "running");
+    jobs.finish(*job, std::string(300, 'r'), "");
+    check(job->upload.empty() && jobs.stats().memory_bytes == 300 && jobs.stats().running == 0, "result replaces the upload");
+
+    std::shared_ptr<const std::string> first, second;
+    check(jobs.result(job->id, first)->state == job_store::STATE::DONE && jobs.result(job->id, second), "done");
+    check(first && first == second && *first == std::string(300, 'r'), "result shared, not copied");
+
+    // the result outlives the job it was fetched from
+    check(jobs.remove(job->id) && !jobs.find(job->id) && jobs.stats().memory_bytes == 0, "removed");
+    check(first->size() == 300, "fetched result still valid");
+
+    std::shared_ptr<job_store::job> large = jobs.create("");
+    jobs.start(*large);
+    jobs.finish(*large, std::string(2000, 'r'), "");
+    std::optional<job_store::status> status = jobs.result(large->id, result);
+    check(status->state == job_store::STATE::FAILED && status->error == "result too large to store" && !result, "result over the cap fails");
+
+    std::shared_ptr<job_store::job> failed = jobs.create("");
+    jobs.start(*failed);
+    jobs.finish(*failed, std::nullopt, "cannot parse document");
+    check(jobs.find(failed->id)->error == "cannot parse document" && jobs.stats().memory_bytes == 0, "error kept");
+
+    check(jobs.create(std::string(2000, 'u')) == nullptr && jobs.stats().rejected == 1, "upload over the cap refused");
+
+    return report();
+}
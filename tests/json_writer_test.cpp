@@ -0,0 +1,138 @@
+// The streaming JSON writer against nlohmann::json::dump() of the DOM it
+// replaced: strings with every escape and invalid UTF-8, then whole trees.
+
+#include "json_writer.hpp"
+#include "string_utils.hpp"
+#include "test_check.hpp"
+#include <cstdio>
+#include <deque>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+    // letters with control characters, quotes, backslashes, DEL, 2 to 4 byte
+    // codepoints and, if allowed, stray continuation bytes
+    std::string random_string(std::mt19937& random, int length, bool invalid) {
+        std::string s;
+        for (int i = 0; i < length; ++i) {
+            switch (random() % 20) {
+                case 12: s += static_cast<char>(random() % 0x20); break;
+                case 13: s += random() % 2 ? '"' : '\\'; break;
+                case 14: s += "\xc3\xa9"; break;
+                case 15: s += "\xe2\x80\x9c"; break;
+                case 16: s += "\xf0\x9f\x98\x80"; break;
+                case 17: s += '\x7f'; break;
+                case 18: s += invalid ? static_cast<char>(0x80 + random() % 0x80) : ' '; break;
+                case 19: s += ' '; break;
+                default: s += static_cast<char>('a' + random() % 26);
+            }
+        }
+        return s;
+    }
+
+    // same bytes as the DOM, or both refuse the string
+    bool same_as_dom(std::string const& s) {
+        std::string written, dumped;
+        bool write_failed = false, dump_failed = false;
+        try {
+            append_json_string(written, s);
+        } catch (std::invalid_argument&) {
+            write_failed = true;
+        }
+        try {
+            dumped = nlohmann::json(s).dump();
+        } catch (nlohmann::json::type_error&) {
+            dump_failed = true;
+        }
+        return write_failed == dump_failed && (write_failed || written == dumped);
+    }
+
+    // a random section tree, its text kept alive in deques
+    struct tree {
+        std::deque<PDF_Section> sections;
+        std::deque<std::string> texts;
+        std::deque<std::vector<std::string_view>> keywords;
+        std::mt19937& random;
+        PDF_Section_Node root;
+
+        explicit tree(std::mt19937& r) : random(r) {
+            build(root, nullptr, 4);
+        }
+
+        std::string_view text(int length) {
+            texts.push_back(random_string(random, length, false));
+            return texts.back();
+        }
+
+        void build(PDF_Section_Node& node, PDF_Section_Node* parent, int depth) {
+            sections.emplace_back();
+            node.main_section = &sections.back();
+            node.parent_node = parent;
+            node.main_section->title = text(random() % 12);
+            for (int p = random() % 4; p > 0; --p) {
+                PDF_Paragraph paragraph{};
+                paragraph.paragraph = text(random() % 200);
+                keywords.emplace_back();
+                for (int k = random() % 3; k > 0; --k) {
+                    keywords.back().push_back(text(random() % 8));
+                }
+                paragraph.emphasized_words = PDF_Word_List{keywords.back().data(), keywords.back().size()};
+                node.main_section->paragraphs.push_back(paragraph);
+            }
+            // leaves with and without an empty list of subsections
+            if (depth > 0 && random() % 3) {
+                node.sub_sections.emplace();
+                for (int c = random() % 4; c > 0; --c) {
+                    node.sub_sections->emplace_back();
+                    build(node.sub_sections->back(), &node, depth - 1);
+                }
+            }
+        }
+    };
+
+} // namespace
+
+int main() {
+    std::mt19937 random(25);
+
+    std::size_t strings = 0;
+    for (int i = 0; i < 300000; ++i) {
+        strings += !same_as_dom(random_string(random, random() % 24, true));
+    }
+    // every lead byte with every second byte, cut after 1 to 4 bytes
+    for (int lead = 0x80; lead < 0x100; ++lead) {
+        for (int second = 0; second < 0x100; ++second) {
+            for (int third : {0x41, 0x80, 0x9f, 0xa0, 0xbf, 0xc0}) {
+                std::string s = {static_cast<char>(lead), static_cast<char>(second), static_cast<char>(third), '\x80'};
+                for (std::size_t length = 1; length <= s.size(); ++length) {
+                    strings += !same_as_dom(s.substr(0, length));
+                }
+            }
+        }
+    }
+    check(strings == 0, "strings match the DOM");
+
+    std::size_t trees = 0;
+    for (int i = 0; i < 3000; ++i) {
+        tree t(random);
+        bool truncated = random() % 2;
+        std::optional<std::vector<unsigned int>> pages;
+        if (random() % 2) {
+            pages = std::vector<unsigned int>{0, 1, 2, 7};
+        }
+        trees += format_pdf_document_tree(t.root, truncated, pages) != pdf_document_tree_to_json(t.root, truncated, pages).dump();
+
+        unsigned int written_id = 1, dumped_id = 1;
+        std::string written;
+        append_json_node(written, t.root, written_id);
+        trees += written != add_json_node(t.root, dumped_id).dump() || written_id != dumped_id;
+    }
+    check(trees == 0, "trees match the DOM");
+
+    std::printf("%zu strings, %zu trees differ\n", strings, trees);
+    return report();
+}
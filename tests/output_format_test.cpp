@@ -0,0 +1,172 @@
+// Every output format against the JSON output: CBOR and MessagePack decoded
+// with nlohmann, FLAT opened in place and walked. Malformed and truncated
+// FLAT buffers must be refused or stay in bounds when walked.
+
+#include "flat_document.hpp"
+#include "output_format.hpp"
+#include "string_utils.hpp"
+#include "test_check.hpp"
+#include <cstdio>
+#include <deque>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+    // a random section tree, its text kept alive in deques
+    struct tree {
+        std::deque<PDF_Section> sections;
+        std::deque<std::string> texts;
+        std::deque<std::vector<std::string_view>> keywords;
+        std::mt19937 random{24};
+        PDF_Section_Node root;
+
+        explicit tree(int depth) {
+            build(root, nullptr, depth);
+        }
+
+        // words with the characters JSON escapes and multi-byte UTF-8 now and then
+        std::string_view text(int words) {
+            static const char* const SPECIAL[] = {"\"quoted\"", "back\\slash", "tab\there", "line\nbreak", "caf\xc3\xa9", "\xe6\x96\x87\xe6\x9b\xb8", "\x01"};
+            std::string s;
+            for (int i = 0; i < words; ++i) {
+                if (!s.empty()) {
+                    s += ' ';
+                }
+                if (random() % 10 == 0) {
+                    s += SPECIAL[random() % (sizeof(SPECIAL) / sizeof(SPECIAL[0]))];
+                } else {
+                    for (int n = 1 + random() % 8; n > 0; --n) {
+                        s += static_cast<char>('a' + random() % 26);
+                    }
+                }
+            }
+            texts.push_back(std::move(s));
+            return texts.back();
+        }
+
+        void build(PDF_Section_Node& node, PDF_Section_Node* parent, int depth) {
+            sections.emplace_back();
+            node.main_section = &sections.back();
+            node.parent_node = parent;
+            node.main_section->title = text(1 + random() % 4);
+            for (int p = random() % 4; p > 0; --p) {
+                PDF_Paragraph paragraph{};
+                paragraph.paragraph = text(random() % 40);
+                keywords.emplace_back();
+                for (int k = random() % 3; k > 0; --k) {
+                    keywords.back().push_back(text(1));
+                }
+                paragraph.emphasized_words = PDF_Word_List{keywords.back().data(), keywords.back().size()};
+                node.main_section->paragraphs.push_back(paragraph);
+            }
+            if (depth > 0) {
+                node.sub_sections.emplace();
+                for (int c = random() % 4; c > 0; --c) {
+                    node.sub_sections->emplace_back();
+                    build(node.sub_sections->back(), &node, depth - 1);
+                }
+            }
+        }
+    };
+
+    // the JSON value of a flat section, as add_json_node builds it
+    nlohmann::json flat_node(PDF_Flat_Document const& document, std::uint32_t id) {
+        PDF_Flat_Section const& section = document.section(id);
+        nlohmann::json json_section;
+        json_section["id"] = section.id;
+        json_section["title"] = document.text(section.title);
+        if (section.parent_id != PDF_FLAT_NONE) {
+            json_section["parent_id"] = section.parent_id;
+        }
+        for (std::uint32_t p = section.first_paragraph; p < section.first_paragraph + section.paragraph_count; ++p) {
+            PDF_Flat_Paragraph const& paragraph = document.paragraph(p);
+            nlohmann::json json_paragraph;
+            json_paragraph["paragraph"] = document.text(paragraph.text);
+            for (std::uint32_t k = paragraph.first_keyword; k < paragraph.first_keyword + paragraph.keyword_count; ++k) {
+                json_paragraph["keywords"] += document.text(document.keyword(k));
+            }
+            json_section["paragraphs"] += json_paragraph;
+        }
+        std::uint32_t child = id + 1;
+        for (std::uint32_t n = 0; n < section.child_count; ++n) {
+            json_section["subnodes"] += flat_node(document, child);
+            child = document.section(child).next_sibling;
+        }
+        return json_section;
+    }
+
+    nlohmann::json flat_document(PDF_Flat_Document const& document) {
+        nlohmann::json json_document = flat_node(document, 0);
+        if (document.header().flags & PDF_FLAT_HAS_PAGES) {
+            json_document["pages"] = document.text(document.header().pages);
+        }
+        if (document.header().flags & PDF_FLAT_TRUNCATED) {
+            json_document["truncated"] = true;
+        }
+        return json_document;
+    }
+
+    void check_round_trip(tree& t, bool truncated, std::optional<std::vector<unsigned int>> const& pages) {
+        nlohmann::json expected = nlohmann::json::parse(format_pdf_document(t.root, OUTPUT_FORMAT::JSON, truncated, pages));
+        check(nlohmann::json::from_cbor(format_pdf_document(t.root, OUTPUT_FORMAT::CBOR, truncated, pages)) == expected, "CBOR round trip");
+        check(nlohmann::json::from_msgpack(format_pdf_document(t.root, OUTPUT_FORMAT::MSGPACK, truncated, pages)) == expected, "MessagePack round trip");
+
+        std::string flat = format_pdf_document(t.root, OUTPUT_FORMAT::FLAT, truncated, pages);
+        std::optional<PDF_Flat_Document> document = PDF_Flat_Document::open(flat);
+        check(document && flat_document(document.value()) == expected, "FLAT round trip");
+    }
+
+    void check_malformed(tree& t) {
+        std::string flat = format_pdf_document(t.root, OUTPUT_FORMAT::FLAT, false, std::vector<unsigned int>{0, 1, 2});
+
+        // every truncation is refused; the string tail is the only part open cannot miss
+        std::size_t refused = 0;
+        for (std::size_t size = 0; size < flat.size(); ++size) {
+            refused += !PDF_Flat_Document::open(std::string(flat, 0, size)).has_value();
+        }
+        check(refused == flat.size(), "truncated buffers refused");
+
+        std::string misaligned = " " + flat;
+        check(!PDF_Flat_Document::open(std::string_view(misaligned).substr(1)), "misaligned buffer refused");
+        std::string wrong_magic = flat;
+        wrong_magic[0] = 'X';
+        check(!PDF_Flat_Document::open(wrong_magic), "wrong magic refused");
+
+        // flipped bits are refused, or open a document a full walk reads in bounds
+        std::mt19937 random(7);
+        for (int i = 0; i < 20000; ++i) {
+            std::string damaged = flat;
+            for (int flips = 1 + random() % 3; flips > 0; --flips) {
+                damaged[random() % damaged.size()] ^= static_cast<char>(1 << random() % 8);
+            }
+            if (std::optional<PDF_Flat_Document> document = PDF_Flat_Document::open(damaged)) {
+                flat_document(document.value()).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+            }
+        }
+    }
+
+} // namespace
+
+int main() {
+    for (int depth = 0; depth < 5; ++depth) {
+        tree t(depth);
+        check_round_trip(t, false, std::nullopt);
+        check_round_trip(t, true, std::vector<unsigned int>{0, 1, 2, 4, 9});
+    }
+    tree t(4);
+    check_malformed(t);
+
+    check(parse_output_format("cbor") == OUTPUT_FORMAT::CBOR && !parse_output_format("xml"), "format parameter");
+    check(negotiate_format("application/cbor") == OUTPUT_FORMAT::CBOR, "Accept one type");
+    check(negotiate_format("Application/MsgPack ; q=0.9, application/json;q=0.5") == OUTPUT_FORMAT::MSGPACK, "Accept weights and case");
+    check(negotiate_format("application/vnd.pdf-section-tree;q=0, application/cbor;q=0.1") == OUTPUT_FORMAT::CBOR, "Accept refusal");
+    check(negotiate_format("text/html, */*") == OUTPUT_FORMAT::JSON, "Accept nothing known");
+
+    check(iequals("Content-Type", "content-type") && !iequals("gzip", "gzip2"), "iequals");
+    check(trim_view(" \tgzip \r\n") == "gzip", "trim_view");
+
+    return report();
+}
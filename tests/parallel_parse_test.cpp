@@ -0,0 +1,165 @@
+// Pages extracted by helper threads against one thread extracting them all:
+// a generated document whose headings share a bold font across pages must
+// give the same tree, with and without a page selection, and an aborted
+// cookie must stop both.
+
+#include "mupdf_context.hpp"
+#include "pdf_utils.hpp"
+#include "string_utils.hpp"
+#include "test_check.hpp"
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    // page contents: a bold heading now and then, paragraphs with bold words
+    std::string page_content(int page) {
+        std::string content;
+        int y = 720;
+        if (page % 3 == 0) {
+            content += "BT /F2 18 Tf 72 " + std::to_string(y) + " Td (Chapter " + std::to_string(page / 3 + 1) + ") Tj ET\n";
+            y -= 40;
+        }
+        for (int p = 0; p < 4; ++p, y -= 60) {
+            content += "BT /F1 11 Tf 14 TL 72 " + std::to_string(y) + " Td (Paragraph " + std::to_string(p) + " of page " + std::to_string(page) +
+                       " has ) Tj /F2 11 Tf (bold words) Tj /F1 11 Tf ( inside it.) Tj T* (A second line ends the paragraph.) Tj ET\n";
+        }
+        return content;
+    }
+
+    // a document with the standard Helvetica fonts, every page in objects 5 + 2 * page and 6 + 2 * page
+    std::string make_pdf(int page_count) {
+        std::string pdf = "%PDF-1.4\n";
+        std::vector<std::size_t> offsets;
+        auto add_object = [&pdf, &offsets](std::string const& body) {
+            offsets.push_back(pdf.size());
+            pdf += std::to_string(offsets.size()) + " 0 obj\n" + body + "\nendobj\n";
+        };
+
+        std::string kids;
+        for (int page = 0; page < page_count; ++page) {
+            kids += std::to_string(5 + 2 * page) + " 0 R ";
+        }
+        add_object("<</Type/Catalog/Pages 2 0 R>>");
+        add_object("<</Type/Pages/Kids[" + kids + "]/Count " + std::to_string(page_count) + ">>");
+        add_object("<</Type/Font/Subtype/Type1/BaseFont/Helvetica/Encoding/WinAnsiEncoding>>");
+        add_object("<</Type/Font/Subtype/Type1/BaseFont/Helvetica-Bold/Encoding/WinAnsiEncoding>>");
+        for (int page = 0; page < page_count; ++page) {
+            add_object("<</Type/Page/Parent 2 0 R/MediaBox[0 0 612 792]/Resources<</Font<</F1 3 0 R/F2 4 0 R>>>>/Contents " + std::to_string(6 + 2 * page) + " 0 R>>");
+            std::string content = page_content(page);
+            add_object("<</Length " + std::to_string(content.size()) + ">>\nstream\n" + content + "\nendstream");
+        }
+
+        std::size_t xref = pdf.size();
+        pdf += "xref\n0 " + std::to_string(offsets.size() + 1) + "\n0000000000 65535 f \n";
+        for (std::size_t offset : offsets) {
+            char entry[24];
+            std::snprintf(entry, sizeof(entry), "%010zu 00000 n \n", offset);
+            pdf += entry;
+        }
+        pdf += "trailer\n<</Size " + std::to_string(offsets.size() + 1) + "/Root 1 0 R>>\nstartxref\n" + std::to_string(xref) + "\n%%EOF\n";
+        return pdf;
+    }
+
+    // helper tasks each run on a thread of their own, joined once the parse returned
+    struct helper_threads {
+        shared_mupdf_context& mupdf;
+        std::mutex mutex;
+        std::vector<std::thread> threads;
+
+        void spawn(std::function<void(fz_context* ctx)> task) {
+            std::lock_guard<std::mutex> lock(mutex);
+            threads.emplace_back([this, task = std::move(task)]() {
+                fz_context* ctx = mupdf.clone();
+                task(ctx);
+                if (ctx) {
+                    fz_drop_context(ctx);
+                }
+            });
+        }
+
+        void join() {
+            for (std::thread& thread : threads) {
+                thread.join();
+            }
+            threads.clear();
+        }
+    };
+
+    // the parsed document as the server sends it, nullopt if it was not parsed
+    std::optional<std::string> parse_to_json(fz_context* ctx, std::string const& pdf, PDF_Parse_Options const& options, unsigned int* parsed_pages = nullptr) {
+        std::optional<PDF_Document> document = parse_pdf_buffer(ctx, reinterpret_cast<const unsigned char*>(pdf.data()), pdf.size(), "application/pdf", options);
+        if (!document) {
+            return std::nullopt;
+        }
+        if (parsed_pages) {
+            *parsed_pages = document->parsed_page_count;
+        }
+        PDF_Section root_section;
+        root_section.id = 0;
+        root_section.title = document->document_info.title;
+        root_section.paragraphs = std::move(document->prefix_content);
+        PDF_Section_Node doc_root = construct_document_tree(document.value(), root_section);
+        return format_pdf_document_tree(doc_root, document->truncated, document->covered_pages);
+    }
+
+} // namespace
+
+int main() {
+    shared_mupdf_context mupdf;
+    fz_context* ctx = mupdf.clone();
+    if (!ctx) {
+        std::fprintf(stderr, "cannot create a mupdf context\n");
+        return 1;
+    }
+    helper_threads helpers{mupdf, {}, {}};
+
+    // enough pages for every helper to get a share
+    const int PAGE_COUNT = 5 * PARALLEL_PAGES_PER_THREAD;
+    std::string pdf = make_pdf(PAGE_COUNT);
+
+    unsigned int sequential_pages = 0;
+    std::optional<std::string> sequential = parse_to_json(ctx, pdf, {}, &sequential_pages);
+    check(sequential && sequential_pages == PAGE_COUNT, "document parsed");
+    check(sequential && sequential->find("Chapter 2") != std::string::npos && sequential->find("bold words") != std::string::npos, "headings and text found");
+
+    for (unsigned int max_helpers : {2u, 4u, 8u}) {
+        PDF_Parse_Options options;
+        options.max_helpers = max_helpers;
+        options.spawn = [&helpers](std::function<void(fz_context* ctx)> task) {
+            helpers.spawn(std::move(task));
+        };
+        unsigned int parallel_pages = 0;
+        std::optional<std::string> parallel = parse_to_json(ctx, pdf, options, &parallel_pages);
+        helpers.join();
+        check(parallel == sequential && parallel_pages == sequential_pages, "helpers give the same tree");
+
+        options.page_ranges = {{1, 40}, {70, 150}};
+        options.max_pages = 100;
+        PDF_Parse_Options selection;
+        selection.page_ranges = options.page_ranges;
+        selection.max_pages = options.max_pages;
+        parallel = parse_to_json(ctx, pdf, options);
+        helpers.join();
+        check(parallel && parallel == parse_to_json(ctx, pdf, selection), "helpers give the same tree for a page selection");
+
+        // an aborted parse is no result, whichever thread notices first
+        fz_cookie cookie = {};
+        cookie.abort = 1;
+        options.cookie = &cookie;
+        options.page_ranges.clear();
+        options.max_pages.reset();
+        check(!parse_to_json(ctx, pdf, options), "aborted parse with helpers");
+        helpers.join();
+        selection = {};
+        selection.cookie = &cookie;
+        check(!parse_to_json(ctx, pdf, selection), "aborted parse");
+    }
+
+    fz_drop_context(ctx);
+    return report();
+}
@@ -0,0 +1,157 @@
+// pdf_json_streamer in SECTIONS mode against the buffered output: random
+// section trees fed through the parse hooks, with and without a page
+// selection, must stream as soon as a top-level section is complete and
+// concatenate to format_pdf_document_tree.
+
+#include "pdf_stream.hpp"
+#include "string_utils.hpp"
+#include "test_check.hpp"
+#include <cstdio>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+    std::string random_text(std::mt19937& random) {
+        static const char* const WORDS[] = {"scope", "Terms", "\"quoted\"", "caf\xc3\xa9", "a\\b", "line\nbreak", " "};
+        std::string text;
+        for (int n = random() % 6; n > 0; --n) {
+            text += WORDS[random() % (sizeof(WORDS) / sizeof(WORDS[0]))];
+            text += ' ';
+        }
+        return text;
+    }
+
+    PDF_Paragraph random_paragraph(PDF_Document& document, std::mt19937& random) {
+        PDF_Paragraph paragraph{};
+        paragraph.paragraph = document.text.store(random_text(random));
+        std::size_t count = random() % 3;
+        std::string_view* words = document.text.store_words(count);
+        for (std::size_t w = 0; w < count; ++w) {
+            words[w] = document.text.store(random_text(random));
+        }
+        paragraph.emphasized_words = PDF_Word_List{words, count};
+        return paragraph;
+    }
+
+    // one streamed parse: the chunks, how many came before finish, and the buffered output
+    struct streamed {
+        std::vector<std::string> chunks;
+        std::size_t chunks_before_finish = 0;
+        std::size_t top_level_sections = 0;
+        std::string buffered;
+        PDF_Document document;
+    };
+
+    void stream_document(streamed& result, std::mt19937& random, PDF_Parse_Options selection, bool stop_early) {
+        pdf_json_streamer streamer(pdf_json_streamer::MODE::SECTIONS, [&result](std::string&& chunk) {
+            result.chunks.push_back(std::move(chunk));
+        });
+        PDF_Parse_Options options = streamer.parse_options(selection);
+
+        // what parse_pdf_buffer fills in before the first page
+        PDF_Document& document = result.document;
+        document.document_info.title = random_text(random);
+        document.document_info.page_count = 1 + random() % 20;
+        std::vector<unsigned int> pages = selected_pages(selection, document.document_info.page_count);
+        if (!selection.page_ranges.empty() || selection.max_pages) {
+            document.covered_pages.emplace();
+        }
+        if (stop_early && !pages.empty()) {
+            pages.resize(random() % pages.size());
+            document.truncated = true;
+        }
+        for (int p = random() % 3; p > 0; --p) {
+            document.prefix_content.push_back(random_paragraph(document, random));
+        }
+
+        // three title formats, a section one level below its predecessor at most
+        PDF_Title_Format formats[3];
+        for (unsigned long level = 0; level < 3; ++level) {
+            formats[level].numbering_level = level;
+        }
+        unsigned long level = 0;
+        for (int s = random() % 30; s > 0; --s) {
+            level = random() % (level + 2) % 3;
+            document.sections.emplace_back();
+            PDF_Section& section = document.sections.back();
+            section.id = static_cast<unsigned int>(document.sections.size());
+            section.title = document.text.store(random_text(random));
+            section.title_format = formats[level];
+            for (int p = random() % 3; p > 0; --p) {
+                section.paragraphs.push_back(random_paragraph(document, random));
+            }
+            options.on_section(document, section);
+        }
+        if (document.covered_pages) {
+            document.covered_pages = pages;
+        }
+        result.chunks_before_finish = result.chunks.size();
+        streamer.finish(document);
+
+        PDF_Section root_section;
+        root_section.id = 0;
+        root_section.title = document.document_info.title;
+        root_section.paragraphs = document.prefix_content;
+        PDF_Section_Node doc_root = construct_document_tree(document, root_section);
+        result.top_level_sections = doc_root.sub_sections ? doc_root.sub_sections->size() : 0;
+        result.buffered = format_pdf_document_tree(doc_root, document.truncated, document.covered_pages);
+    }
+
+    std::string joined(std::vector<std::string> const& chunks) {
+        std::string out;
+        for (std::string const& chunk : chunks) {
+            out += chunk;
+        }
+        return out;
+    }
+
+} // namespace
+
+int main() {
+    std::mt19937 random(5);
+    std::size_t differ = 0, late = 0, truncated = 0;
+    for (int i = 0; i < 3000; ++i) {
+        PDF_Parse_Options selection;
+        if (random() % 2) {
+            unsigned int first = random() % 5;
+            selection.page_ranges = {{first, first + random() % 10}};
+        }
+        if (random() % 3 == 0) {
+            selection.max_pages = static_cast<unsigned int>(random() % 8);
+        }
+        bool has_selection = !selection.page_ranges.empty() || selection.max_pages;
+        bool stop_early = has_selection && random() % 4 == 0;
+
+        streamed result;
+        stream_document(result, random, selection, stop_early);
+        std::string out = joined(result.chunks);
+
+        // every complete top-level section went out before the parse ended, whatever the selection
+        late += result.top_level_sections > 0 && result.chunks_before_finish < result.top_level_sections;
+
+        if (!stop_early || !result.document.truncated) {
+            differ += out != result.buffered;
+            continue;
+        }
+
+        // stopped early: pages announce the selection, parsed_pages what was covered
+        ++truncated;
+        nlohmann::json streamed_json = nlohmann::json::parse(out);
+        nlohmann::json buffered_json = nlohmann::json::parse(result.buffered);
+        bool same = streamed_json["pages"] == format_page_ranges(selected_pages(selection, result.document.document_info.page_count)) &&
+                    streamed_json["parsed_pages"] == buffered_json["pages"] && streamed_json["truncated"] == true;
+        streamed_json.erase("pages");
+        streamed_json.erase("parsed_pages");
+        buffered_json.erase("pages");
+        differ += !same || streamed_json != buffered_json;
+    }
+    check(differ == 0, "streamed output matches the buffered output");
+    check(late == 0, "sections streamed while parsing");
+    check(truncated > 0, "early stops covered");
+
+    std::printf("%zu outputs differ, %zu held back, %zu stopped early\n", differ, late, truncated);
+    return report();
+}
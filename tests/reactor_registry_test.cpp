@@ -0,0 +1,40 @@
+// reactor_registry: /metrics sums the admission controllers and body
+// pools of every registered reactor, and a stopped reactor drops out.
+
+#include "reactor_registry.hpp"
+#include "test_check.hpp"
+#include <cstddef>
+#include <optional>
+
+int main() {
+    reactor_registry registry;
+    admission_controller first_admission(1, 2, 4), second_admission(2, 4, 8);
+    body_buffer_pool first_bodies(1 << 20), second_bodies(2 << 20);
+
+    reactor_registry::registration first{registry, first_admission, first_bodies};
+    std::size_t capacity = 0;
+    char* body = first_bodies.acquire(100, capacity);
+    check(body && registry.body_stats().in_use_bytes == capacity, "one reactor reported");
+
+    {
+        reactor_registry::registration second{registry, second_admission, second_bodies};
+        second_admission.submit([]() {}, []() {});
+        second_admission.submit([]() {}, []() {});
+        second_admission.submit([]() {}, []() {});
+
+        admission_controller::statistics admission = registry.admission_stats();
+        check(admission.limit == 3 && admission.in_flight == 2 && admission.queue_depth == 1, "admission summed");
+        check(admission.queue_capacity == 12 && admission.admitted == 2, "admission totals summed");
+        check(registry.body_stats().memory_cap == 3 << 20 && registry.body_stats().in_use_bytes == capacity, "bodies summed");
+
+        second_admission.complete(std::chrono::milliseconds(1), 1, true);
+        second_admission.complete(std::chrono::milliseconds(1), 1, true);
+        second_admission.complete(std::chrono::milliseconds(1), 1, true);
+    }
+
+    check(registry.admission_stats().limit == 1 && registry.body_stats().memory_cap == 1 << 20, "stopped reactor dropped");
+    first_bodies.release(body, capacity);
+    check(registry.body_stats().in_use_bytes == 0, "release reported");
+
+    return report();
+}
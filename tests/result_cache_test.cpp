@@ -0,0 +1,128 @@
+// result_cache: identities and keys, hits and misses, LRU eviction within
+// the memory cap, expiry, invalidation of a file, and concurrent use.
+
+#include "query_string.hpp"
+#include "result_cache.hpp"
+#include "test_check.hpp"
+#include <atomic>
+#include <boost/filesystem.hpp>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    std::shared_ptr<const result_cache::result> make_result(std::string body) {
+        return std::make_shared<const result_cache::result>(result_cache::result{std::move(body), CONTENT_ENCODING::IDENTITY, OUTPUT_FORMAT::JSON});
+    }
+
+    void write_file(std::string const& path, std::string const& content) {
+        std::FILE* file = std::fopen(path.c_str(), "wb");
+        std::fwrite(content.data(), 1, content.size(), file);
+        std::fclose(file);
+    }
+
+    std::vector<std::pair<unsigned int, unsigned int>> ranges_of(std::string_view value) {
+        std::vector<std::pair<unsigned int, unsigned int>> ranges;
+        parse_page_ranges(value, ranges);
+        return ranges;
+    }
+
+} // namespace
+
+int main() {
+    check(result_cache::digest("", 0) == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855", "SHA-256 of nothing");
+    check(result_cache::digest("abc", 3) == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", "SHA-256 of abc");
+    check(result_cache::upload_identity("abc", 3) == result_cache::upload_identity("abc", 3) &&
+          result_cache::upload_identity("abc", 3) != result_cache::upload_identity("abd", 3), "uploads identified by content");
+
+    // spellings of one page selection are one variant
+    check(canonical_page_ranges(ranges_of("1-3")) == canonical_page_ranges(ranges_of("3,1,2")) &&
+          canonical_page_ranges(ranges_of("1-3")) == canonical_page_ranges(ranges_of("2-3,1-2")) &&
+          canonical_page_ranges(ranges_of("1-3")) == "0-2", "page selections merged");
+    check(canonical_page_ranges(ranges_of("1,3")) == "0-0,2-2" && canonical_page_ranges(ranges_of("5-,2")) == "1-1,4-4294967294", "gaps kept");
+
+    // a changed file is another document version, a path may hold the separators of a key
+    std::string directory = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("result_cache_test_%%%%%%%%")).string();
+    boost::filesystem::create_directory(directory);
+    std::string path = directory + "/a\nb.pdf";
+    write_file(path, "one");
+    std::optional<std::string> identity = result_cache::file_identity(path);
+    write_file(path, "two!");
+    check(identity && result_cache::file_identity(path) != identity, "file identity follows changes");
+    check(!result_cache::file_identity(directory + "/missing.pdf"), "missing file");
+    identity = result_cache::file_identity(path);
+    check(result_cache::document_of(result_cache::make_key(identity.value(), "pages=")) == result_cache::document_identity(path), "document of a file key");
+
+    {
+        result_cache cache(RESULT_CACHE_SHARDS * 1000, std::chrono::seconds(60));
+        std::string k1 = result_cache::make_key(identity.value(), "v1");
+        std::string k2 = result_cache::make_key(identity.value(), "v2");
+        std::string upload = result_cache::make_key(result_cache::upload_identity("abc", 3).value(), "v1");
+        check(!cache.find(k1), "empty cache misses");
+        cache.insert(k1, make_result("body one"));
+        cache.insert(k2, make_result("body two"));
+        cache.insert(upload, make_result("upload"));
+        std::shared_ptr<const result_cache::result> hit = cache.find(k1);
+        check(hit && hit->body == "body one", "hit");
+        cache.insert(k1, make_result("body one again"));
+        check(cache.find(k1)->body == "body one again" && hit->body == "body one", "newer result replaces, older stays alive");
+
+        check(cache.invalidate(path) == 2 && !cache.find(k1) && !cache.find(k2) && cache.find(upload), "invalidate drops the file's variants only");
+        result_cache::statistics stats = cache.stats();
+        check(stats.entries == 1 && stats.hits == 3 && stats.misses == 3 && stats.insertions == 4 && stats.invalidations == 2, "counters");
+
+        // variants of one file share a shard, its cap evicts the least recently used first
+        for (int i = 0; i < 20; ++i) {
+            cache.insert(result_cache::make_key(identity.value(), "v" + std::to_string(i)), make_result(std::string(200, 'x')));
+            cache.find(result_cache::make_key(identity.value(), "v0"));
+        }
+        check(cache.find(result_cache::make_key(identity.value(), "v0")) && cache.find(result_cache::make_key(identity.value(), "v19")) &&
+              !cache.find(result_cache::make_key(identity.value(), "v1")), "least recently used evicted");
+        check(cache.stats().evictions > 0 && cache.stats().memory_bytes <= RESULT_CACHE_SHARDS * 1000, "capped");
+
+        std::string big = result_cache::make_key(identity.value(), "big");
+        cache.insert(big, make_result(std::string(1000, 'x')));
+        check(!cache.find(big), "larger than a shard not kept");
+        std::size_t entries = cache.stats().entries;
+        check(cache.clear() == entries && cache.stats().entries == 0 && cache.stats().memory_bytes == 0, "clear");
+    }
+
+    {
+        result_cache cache(RESULT_CACHE_SHARDS * 1000, std::chrono::seconds(0));
+        std::string key = result_cache::make_key(identity.value(), "v1");
+        cache.insert(key, make_result("body"));
+        check(!cache.find(key) && cache.stats().expirations == 1 && cache.stats().entries == 0, "expired");
+    }
+
+    {
+        // readers, writers and invalidations at once, for the sanitizers
+        result_cache cache(RESULT_CACHE_SHARDS * 4096, std::chrono::seconds(60));
+        std::atomic<std::size_t> damaged{0};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&cache, &damaged, t]() {
+                for (int i = 0; i < 20000; ++i) {
+                    std::string key = result_cache::make_key(result_cache::document_identity("/doc" + std::to_string(i % 64)), std::to_string(i % 3));
+                    if ((i + t) % 3 == 0) {
+                        cache.insert(key, make_result(std::string(i % 300, 'x')));
+                    } else if (std::shared_ptr<const result_cache::result> found = cache.find(key)) {
+                        damaged += found->body != std::string(found->body.size(), 'x');
+                    }
+                    if (i % 1000 == 0) {
+                        cache.invalidate("/doc" + std::to_string(i % 64));
+                    }
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        check(damaged == 0, "concurrent hits intact");
+        check(cache.stats().memory_bytes <= RESULT_CACHE_SHARDS * 4096, "capped under concurrent use");
+    }
+
+    boost::filesystem::remove_all(directory);
+    return report();
+}
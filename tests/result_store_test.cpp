@@ -0,0 +1,101 @@
+// result_store in a scratch directory: lookups, shared objects, invalidation,
+// eviction, replay after a restart, and indexes of an older layout.
+
+#include "result_cache.hpp"
+#include "result_store.hpp"
+#include "test_check.hpp"
+#include <boost/filesystem.hpp>
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+    std::string read_hit(std::optional<result_store::hit> const& found) {
+        if (!found) {
+            return std::string();
+        }
+        std::string body(found->size, '\0');
+        ssize_t n = ::pread(found->fd, body.data(), body.size(), 0);
+        ::close(found->fd);
+        return n == static_cast<ssize_t>(body.size()) ? body : std::string();
+    }
+
+    std::size_t object_files(std::string const& directory) {
+        std::size_t count = 0;
+        for (boost::filesystem::directory_iterator it(directory + "/objects"), end; it != end; ++it) {
+            ++count;
+        }
+        return count;
+    }
+
+} // namespace
+
+int main() {
+    std::string directory = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("result_store_test_%%%%%%%%")).string();
+    std::string file = result_cache::document_identity("/a.pdf") + std::string(1, '\0') + "1:2:3";
+    std::string k1 = result_cache::make_key(file, "pages=&max_pages=&format=0&encoding=1");
+    std::string k2 = result_cache::make_key(file, "pages=&max_pages=&format=0&encoding=0");
+    std::string k3 = result_cache::make_key("u:" + result_cache::digest("upload", 6) + ":6", "pages=&max_pages=&format=0&encoding=0");
+
+    {
+        result_store store(directory, 100);
+        check(store.enabled(), "store enabled");
+        check(!store.find(k1), "empty store misses");
+        store.insert(k1, "hello world", CONTENT_ENCODING::GZIP, OUTPUT_FORMAT::JSON);
+        store.insert(k2, "hello world", CONTENT_ENCODING::IDENTITY, OUTPUT_FORMAT::JSON);
+        store.insert(k3, "other", CONTENT_ENCODING::IDENTITY, OUTPUT_FORMAT::CBOR);
+
+        std::optional<result_store::hit> found = store.find(k1);
+        check(found && found->encoding == CONTENT_ENCODING::GZIP && found->format == OUTPUT_FORMAT::JSON, "hit keeps its coding");
+        check(found && read_hit(found) == "hello world", "hit reads back the body");
+        found = store.find(k3);
+        check(found && found->format == OUTPUT_FORMAT::CBOR && read_hit(found) == "other", "second document");
+
+        // equal bodies share one file
+        check(store.stats().entries == 3 && store.stats().disk_bytes == 16, "shared objects counted once");
+        check(object_files(directory) == 2, "shared objects stored once");
+    }
+
+    {
+        result_store store(directory, 100);
+        check(store.stats().entries == 3 && store.stats().disk_bytes == 16, "replayed after restart");
+        check(store.invalidate("/a.pdf") == 2, "invalidate drops every variant of a file");
+        check(store.stats().entries == 1 && object_files(directory) == 1, "invalidated object deleted");
+
+        // same size, other content: a different object
+        store.insert(k1, "HELLO WORLD", CONTENT_ENCODING::IDENTITY, OUTPUT_FORMAT::JSON);
+        store.insert(k2, "hello world", CONTENT_ENCODING::IDENTITY, OUTPUT_FORMAT::JSON);
+        check(read_hit(store.find(k1)) == "HELLO WORLD" && read_hit(store.find(k2)) == "hello world", "equal sizes do not share");
+
+        for (int i = 0; i < 20; ++i) {
+            store.insert(result_cache::make_key("u:" + std::to_string(i), ""), std::string(10, static_cast<char>('a' + i)), CONTENT_ENCODING::IDENTITY, OUTPUT_FORMAT::JSON);
+        }
+        check(store.stats().disk_bytes <= 100 && store.stats().evictions > 0, "evicted past the cap");
+        check(!store.find(k3), "oldest evicted first");
+    }
+
+    {
+        result_store store(directory, 100);
+        std::optional<result_store::hit> found = store.find(result_cache::make_key("u:19", ""));
+        check(found && read_hit(found) == std::string(10, 't'), "newest kept across restart");
+        std::size_t entries = store.stats().entries;
+        check(store.clear() == entries && store.stats().entries == 0 && object_files(directory) == 0, "clear");
+    }
+
+    {
+        // an index of another layout is ignored, and the files it named are removed
+        std::FILE* index = std::fopen((directory + "/index").c_str(), "wb");
+        const char old_header[16] = {'P', 'D', 'F', 'R', 'S', 'I', 'D', 'X', 1, 0, 0, 0, 48, 0, 0, 0};
+        std::fwrite(old_header, 1, sizeof(old_header), index);
+        std::fclose(index);
+        std::FILE* object = std::fopen((directory + "/objects/0123456789abcdef-5").c_str(), "wb");
+        std::fclose(object);
+
+        result_store store(directory, 100);
+        check(store.enabled() && store.stats().entries == 0 && object_files(directory) == 0, "older index ignored");
+    }
+
+    boost::filesystem::remove_all(directory);
+    return report();
+}
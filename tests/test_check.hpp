@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+
+// failed checks of the test, reported once at the end
+inline std::size_t failures = 0;
+
+inline void check(bool ok, const char* what) {
+    if (!ok) {
+        std::fprintf(stderr, "failed: %s\n", what);
+        ++failures;
+    }
+}
+
+// print the failure count, return the exit status of the test
+inline int report() {
+    std::printf("%zu failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+// PDF_Text_Arena: every view stays valid and unchanged while more text is
+// stored, after a move and after page arenas are adopted and destroyed.
+
+#include "pdf_utils.hpp"
+#include "test_check.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+    struct stored {
+        std::string_view view;
+        std::string expected;
+    };
+
+    // sizes around the chunk sizes, so strings straddle, fill and outgrow chunks
+    std::size_t random_size(std::mt19937& random) {
+        unsigned int r = random() % 256;
+        if (r == 0) {
+            return TEXT_ARENA_MAX_CHUNK + random() % 1000;
+        }
+        if (r < 16) {
+            return 0;
+        }
+        if (r < 48) {
+            return TEXT_ARENA_MIN_CHUNK - 1 + random() % 3;
+        }
+        return random() % 200;
+    }
+
+    // store random text, and now and then an array of views on it
+    void fill(PDF_Text_Arena& arena, std::vector<stored>& texts, std::vector<std::pair<std::string_view*, std::vector<std::string_view>>>& word_lists, std::mt19937& random, int count) {
+        for (int i = 0; i < count; ++i) {
+            std::string text(random_size(random), static_cast<char>('a' + random() % 26));
+            std::string_view view = arena.store(text);
+            texts.push_back({view, std::move(text)});
+
+            if (random() % 4 == 0) {
+                std::size_t n = random() % 8;
+                std::string_view* words = arena.store_words(n);
+                check(reinterpret_cast<std::uintptr_t>(words) % alignof(std::string_view) == 0, "word arrays aligned");
+                std::vector<std::string_view> expected;
+                for (std::size_t w = 0; w < n; ++w) {
+                    words[w] = view.substr(0, w);
+                    expected.push_back(words[w]);
+                }
+                word_lists.emplace_back(words, std::move(expected));
+            }
+        }
+    }
+
+    bool unchanged(std::vector<stored> const& texts, std::vector<std::pair<std::string_view*, std::vector<std::string_view>>> const& word_lists) {
+        for (stored const& s : texts) {
+            if (s.view != s.expected) {
+                return false;
+            }
+        }
+        for (auto const& list : word_lists) {
+            for (std::size_t w = 0; w < list.second.size(); ++w) {
+                if (list.first[w].data() != list.second[w].data() || list.first[w].size() != list.second[w].size()) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+} // namespace
+
+int main() {
+    std::mt19937 random(20);
+    std::vector<stored> texts;
+    std::vector<std::pair<std::string_view*, std::vector<std::string_view>>> word_lists;
+
+    PDF_Text_Arena arena;
+    check(arena.store("").empty(), "empty text");
+    fill(arena, texts, word_lists, random, 2000);
+    check(unchanged(texts, word_lists), "views unchanged while storing");
+
+    PDF_Text_Arena moved(std::move(arena));
+    fill(moved, texts, word_lists, random, 200);
+    check(unchanged(texts, word_lists), "views unchanged after a move");
+
+    // pages extracted into arenas of their own, adopted in page order and then destroyed
+    PDF_Document document;
+    document.text.adopt(std::move(moved));
+    for (int page = 0; page < 50; ++page) {
+        PDF_Text_Arena page_arena;
+        fill(page_arena, texts, word_lists, random, 40);
+        document.text.adopt(std::move(page_arena));
+        fill(page_arena, texts, word_lists, random, 5);
+        document.text.adopt(std::move(page_arena));
+        fill(document.text, texts, word_lists, random, 5);
+    }
+    check(unchanged(texts, word_lists), "views unchanged after adoption");
+
+    PDF_Document moved_document(std::move(document));
+    check(unchanged(texts, word_lists), "views unchanged after the document moved");
+
+    std::printf("%zu texts, %zu word lists\n", texts.size(), word_lists.size());
+    return report();
+}
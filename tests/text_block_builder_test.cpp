@@ -0,0 +1,265 @@
+// text_block_builder against the stringstreams it replaced, over random
+// sequences of characters and emphasized word boundaries, one builder
+// reused for every block as the parsing threads do. Then whole blocks
+// built run by run with append_font_run against the per-character loop
+// it replaced.
+
+#include "text_block_builder.hpp"
+#include "test_check.hpp"
+#include <cctype>
+#include <cstdio>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+    std::string reference_trim(std::string const& s) {
+        const char* SPACE = " \t\n\v\f\r";
+        std::size_t first = s.find_first_not_of(SPACE);
+        return first == std::string::npos ? std::string() : s.substr(first, s.find_last_not_of(SPACE) - first + 1);
+    }
+
+    // the previous text of a block: a stringstream for the content, one for the emphasized word
+    struct reference_block {
+        std::stringstream content;
+        std::stringstream word;
+        std::vector<std::string> words;
+
+        void append(int c, bool in_word) {
+            std::string character;
+            append_utf8(character, c);
+            if (character == "\xe2\x80\x9c" || character == "\xe2\x80\x9d") {
+                character = "\"";
+            }
+            if (in_word) {
+                word << character;
+            }
+            content << character;
+            if (content.str().compare(" ") == 0) {
+                content.str(std::string());
+            }
+        }
+
+        void end_word() {
+            std::string trimmed = reference_trim(word.str());
+            if (trimmed.length() > 0) {
+                words.push_back(trimmed);
+            }
+            word.str(std::string());
+        }
+    };
+
+    // spaces and quotes are the characters the builder treats specially
+    int random_codepoint(std::mt19937& random) {
+        static const int CODEPOINTS[] = {' ', ' ', '\t', '\n', 'a', 'B', '.', '1', 0x201c, 0x201d, 0x2018, 0xe9, 0x2022, 0x1f600};
+        return CODEPOINTS[random() % (sizeof(CODEPOINTS) / sizeof(CODEPOINTS[0]))];
+    }
+
+    // a character of the stext model: fonts are numbers, 0 is none, 3 and up are bold or italic
+    struct model_char {
+        int c;
+        int font;
+        const model_char* next;
+    };
+
+    bool model_emphasized(int font) {
+        return font >= 3;
+    }
+
+    struct block_result {
+        std::string content;
+        std::vector<std::string> words;
+        std::optional<std::string> title_prefix;
+        std::optional<int> title_font;
+
+        bool operator==(block_result const& other) const {
+            return content == other.content && words == other.words && title_prefix == other.title_prefix && title_font == other.title_font;
+        }
+    };
+
+    // the previous character loop of extract_page_text_blocks, asking for every character's font
+    block_result reference_loop(std::vector<std::vector<model_char>> const& lines, int& prev_ch_font) {
+        block_result result;
+        std::stringstream partial_paragraph_content_string_stream, emphasized_word_string_stream;
+        bool parsing_emphasized_word = false;
+        auto end_word = [&]() {
+            std::string trimmed_string = reference_trim(emphasized_word_string_stream.str());
+            if (trimmed_string.length() > 0) {
+                result.words.push_back(trimmed_string);
+            }
+            emphasized_word_string_stream.str(std::string());
+            parsing_emphasized_word = false;
+        };
+
+        for (std::vector<model_char> const& line : lines) {
+            for (model_char const& ch : line) {
+                std::string character;
+                append_utf8(character, ch.c);
+                if (character == "\xe2\x80\x9c" || character == "\xe2\x80\x9d") {
+                    character = "\"";
+                }
+
+                if (prev_ch_font && parsing_emphasized_word) {
+                    if (ch.font == prev_ch_font || isspace(ch.c)) {
+                        emphasized_word_string_stream << character;
+                    } else {
+                        end_word();
+                        if (model_emphasized(ch.font)) {
+                            parsing_emphasized_word = true;
+                            emphasized_word_string_stream << character;
+                        }
+                    }
+                } else if (!isspace(ch.c) && model_emphasized(ch.font)) {
+                    parsing_emphasized_word = true;
+                    if (!result.title_prefix) {
+                        if (!result.title_font) {
+                            result.title_font = ch.font;
+                        }
+                        if (!partial_paragraph_content_string_stream.str().empty() && result.words.empty()) {
+                            result.title_prefix = partial_paragraph_content_string_stream.str();
+                        }
+                    }
+                    emphasized_word_string_stream << character;
+                } else if (parsing_emphasized_word) {
+                    end_word();
+                }
+
+                partial_paragraph_content_string_stream << character;
+                if (partial_paragraph_content_string_stream.str().compare(" ") == 0) {
+                    partial_paragraph_content_string_stream.str(std::string());
+                }
+                if (!isspace(ch.c)) {
+                    prev_ch_font = ch.font;
+                }
+            }
+        }
+
+        result.content = partial_paragraph_content_string_stream.str();
+        if (parsing_emphasized_word) {
+            end_word();
+        }
+        return result;
+    }
+
+    // the runs of each line through append_font_run, as extract_page_text_blocks does
+    block_result run_loop(std::vector<std::vector<model_char>> const& lines, int& prev_ch_font, text_block_builder& builder, std::size_t& font_queries) {
+        text_block_emphasis<int> emphasis;
+        builder.clear();
+        for (std::vector<model_char> const& line : lines) {
+            const model_char* next_ch = nullptr;
+            for (const model_char* run = line.empty() ? nullptr : &line[0]; run; run = next_ch) {
+                next_ch = run->next;
+                while (next_ch && next_ch->font == run->font) {
+                    next_ch = next_ch->next;
+                }
+                append_font_run(builder, emphasis, prev_ch_font, run->font, run, next_ch, [&font_queries](int font) {
+                    ++font_queries;
+                    return model_emphasized(font);
+                });
+            }
+        }
+        if (emphasis.parsing_emphasized_word) {
+            builder.end_word();
+        }
+
+        block_result result;
+        result.content = builder.content();
+        for (std::size_t i = 0; i < builder.word_count(); ++i) {
+            result.words.emplace_back(builder.word(i));
+        }
+        if (emphasis.title_prefix_length) {
+            result.title_prefix = std::string(builder.content().substr(0, emphasis.title_prefix_length.value()));
+        }
+        result.title_font = emphasis.title_font;
+        return result;
+    }
+
+} // namespace
+
+int main() {
+    std::mt19937 random(18);
+    text_block_builder builder;
+    PDF_Text_Arena arena;
+
+    std::size_t mismatches = 0;
+    for (int block = 0; block < 200000; ++block) {
+        reference_block reference;
+        builder.clear();
+        bool in_word = false;
+
+        for (int n = random() % 24; n > 0; --n) {
+            switch (random() % 6) {
+                case 0:
+                    if (!in_word) {
+                        builder.begin_word();
+                        in_word = true;
+                    }
+                    break;
+                case 1:
+                    if (in_word) {
+                        builder.end_word();
+                        reference.end_word();
+                        in_word = false;
+                    }
+                    break;
+                default: {
+                    int c = random_codepoint(random);
+                    builder.append(c);
+                    reference.append(c, in_word);
+                }
+            }
+            // asking for the size flushes pending codepoints midway, the content must not change
+            if (random() % 4 == 0) {
+                mismatches += builder.size() != reference.content.str().size();
+            }
+        }
+        if (in_word) {
+            builder.end_word();
+            reference.end_word();
+        }
+
+        std::string_view stored = arena.store(builder.content());
+        PDF_Word_List words = builder.store_words(arena, stored);
+        bool same = stored == reference.content.str() && builder.word_count() == reference.words.size() && words.count == reference.words.size();
+        for (std::size_t i = 0; same && i < reference.words.size(); ++i) {
+            same = builder.word(i) == reference.words[i] && words.words[i] == reference.words[i] &&
+                   words.words[i].data() >= stored.data() && words.words[i].data() + words.words[i].size() <= stored.data() + stored.size();
+        }
+        mismatches += !same;
+    }
+    check(mismatches == 0, "blocks match the stringstreams");
+
+    // the previous font carries over from block to block, as on a page
+    std::size_t block_mismatches = 0, font_queries = 0, runs = 0;
+    int reference_prev_font = 0, run_prev_font = 0;
+    for (int block = 0; block < 200000; ++block) {
+        if (block % 50 == 0) {
+            reference_prev_font = run_prev_font = 0;
+        }
+        std::vector<std::vector<model_char>> lines(1 + random() % 3);
+        for (std::vector<model_char>& line : lines) {
+            int font = 1 + random() % 4;
+            for (int n = random() % 12; n > 0; --n) {
+                if (random() % 3 == 0) {
+                    font = 1 + random() % 4;
+                }
+                line.push_back({random_codepoint(random), font, nullptr});
+            }
+            for (std::size_t i = 0; i + 1 < line.size(); ++i) {
+                line[i].next = &line[i + 1];
+                runs += line[i].font != line[i + 1].font;
+            }
+            runs += !line.empty();
+        }
+        block_mismatches += !(reference_loop(lines, reference_prev_font) == run_loop(lines, run_prev_font, builder, font_queries)) ||
+                            reference_prev_font != run_prev_font;
+    }
+    check(block_mismatches == 0, "font runs match the per-character loop");
+    check(font_queries <= runs, "fonts asked at most once per run");
+
+    std::printf("%zu mismatches, %zu blocks differ, %zu font queries for %zu runs\n", mismatches, block_mismatches, font_queries, runs);
+    return report();
+}
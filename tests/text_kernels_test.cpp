@@ -0,0 +1,99 @@
+// Every text kernel set this CPU runs against the C-locale code it replaced,
+// on random strings and codepoints biased towards the SIMD edge cases.
+
+#include "text_kernels.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+    // the per-codepoint encoding the batch kernels must match
+    std::string reference_utf8(const std::vector<int>& codepoints) {
+        std::string out;
+        for (int codepoint : codepoints) {
+            append_utf8(out, codepoint);
+        }
+        return out;
+    }
+
+    std::size_t reference_first_not_space(const std::string& s) {
+        return std::find_if(s.begin(), s.end(), [](unsigned char ch) {
+            return !std::isspace(ch);
+        }) - s.begin();
+    }
+
+    std::size_t reference_last_not_space(const std::string& s) {
+        return std::find_if(s.rbegin(), s.rend(), [](unsigned char ch) {
+            return !std::isspace(ch);
+        }).base() - s.begin();
+    }
+
+    bool reference_has(const std::string& s, int (*predicate)(int)) {
+        return std::any_of(s.begin(), s.end(), [predicate](unsigned char ch) {
+            return predicate(ch) != 0;
+        });
+    }
+
+    // mostly ASCII with runs of 2, 3 and 4 byte codepoints, so windows split at every lane
+    int random_codepoint(std::mt19937& random) {
+        unsigned int r = random() % 100;
+        if (r < 70) {
+            return static_cast<int>(random() % 0x80);
+        }
+        if (r < 80) {
+            return 0x80 + static_cast<int>(random() % 0x780);
+        }
+        if (r < 95) {
+            return 0x800 + static_cast<int>(random() % 0xf800);
+        }
+        return 0x10000 + static_cast<int>(random() % 0x100000);
+    }
+
+    std::size_t check(std::mt19937& random) {
+        const char alphabet[] = " \t\n\v\f\raAzZmM09\x80\xe2\xff.";
+        std::size_t failures = 0;
+        for (int iteration = 0; iteration < 100000; ++iteration) {
+            std::string s;
+            for (int n = random() % 80; n > 0; --n) {
+                s += alphabet[random() % (sizeof(alphabet) - 1)];
+            }
+            if (find_first_not_space(s.data(), s.size()) != reference_first_not_space(s) ||
+                find_last_not_space(s.data(), s.size()) != reference_last_not_space(s) ||
+                has_ascii_lower(s.data(), s.size()) != reference_has(s, std::islower) ||
+                has_ascii_upper(s.data(), s.size()) != reference_has(s, std::isupper)) {
+                ++failures;
+            }
+
+            std::vector<int> codepoints;
+            for (int n = random() % 70; n > 0; --n) {
+                codepoints.push_back(random_codepoint(random));
+            }
+            std::string encoded;
+            append_utf8(encoded, codepoints.data(), codepoints.size());
+            if (encoded != reference_utf8(codepoints)) {
+                ++failures;
+            }
+        }
+        return failures;
+    }
+
+} // namespace
+
+int main() {
+    std::size_t failures = 0;
+    for (const char* name : {"avx2", "sse4.2", "scalar"}) {
+        if (!use_text_kernels(name)) {
+            std::printf("%-8s not supported, skipped\n", name);
+            continue;
+        }
+        std::mt19937 random(19);
+        std::size_t failed = check(random);
+        std::printf("%-8s %zu failures\n", name, failed);
+        failures += failed;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+// classify_title_prefix against the six regular expressions it replaced,
+// over every short word of a prefix alphabet and a batch of longer random ones.
+
+#include "title_prefix.hpp"
+#include <cstdio>
+#include <optional>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+    using PREFIX = PDF_Title_Format::PREFIX;
+
+    // the previous title prefix matching of extract_page_text_blocks
+    struct regex_classifier {
+        std::regex bullet{"|o|•|[\\*\\+\\-]"};
+        std::regex lowercase{"\\([a-z]{1,2}\\)"};
+        std::regex uppercase{"\\([A-Z]{1,2}\\)"};
+        std::regex roman{"\\([ivx]{1,6}\\)"};
+        std::regex number_dot{"\\d+(\\.\\d+)*\\.?"};
+        std::regex article{"[Aa]n?|[Tt]he"};
+
+        std::optional<PREFIX> classify(const std::string& word, unsigned long& numbering_level) const {
+            if (std::regex_match(word, bullet)) {
+                return PREFIX::BULLET;
+            }
+            if (std::regex_match(word, lowercase)) {
+                return PREFIX::ALPHABET_LOWERCASE_NUMBERING;
+            }
+            if (std::regex_match(word, uppercase)) {
+                return PREFIX::ALPHABET_UPPERCASE_NUMBERING;
+            }
+            if (std::regex_match(word, roman)) {
+                return PREFIX::ROMAN_NUMBERING;
+            }
+            if (std::regex_match(word, number_dot)) {
+                // the number groups of the prefix, which went on with a space after the word
+                std::stringstream title_prefix_stringstream(word + " ");
+                std::string segment;
+                numbering_level = 0;
+                while (std::getline(title_prefix_stringstream, segment, '.')) {
+                    if (segment[0] != ' ') {
+                        numbering_level++;
+                    }
+                }
+                return PREFIX::NUMBER_DOT_NUMBERING;
+            }
+            if (std::regex_match(word, article)) {
+                return PREFIX::ARTICLE;
+            }
+            return std::nullopt;
+        }
+    };
+
+    const std::vector<std::string> ALPHABET = {
+        "(", ")", "0", "1", "9", ".", "a", "A", "Z", "i", "v", "x", "o", "T", "h", "e", "n", "*", "+", "-", "•", " "
+    };
+
+    std::vector<std::string> corpus() {
+        // every word of up to four symbols
+        std::vector<std::string> words = {""};
+        std::size_t begin = 0;
+        for (int length = 1; length <= 4; ++length) {
+            std::size_t end = words.size();
+            for (std::size_t i = begin; i < end; ++i) {
+                for (const std::string& symbol : ALPHABET) {
+                    words.push_back(words[i] + symbol);
+                }
+            }
+            begin = end;
+        }
+
+        // longer words, fixed seed so failures reproduce
+        std::mt19937 random(17);
+        std::uniform_int_distribution<std::size_t> symbol(0, ALPHABET.size() - 1);
+        std::uniform_int_distribution<int> length(5, 12);
+        for (int i = 0; i < 100000; ++i) {
+            std::string word;
+            for (int n = length(random); n > 0; --n) {
+                word += ALPHABET[symbol(random)];
+            }
+            words.push_back(word);
+        }
+
+        for (const char* word : {"(xviii)", "(xviiii)", "(xviiiii)", "(xx)", "(XX)", "The", "the", "An", "1.2.3.4", "12.345.", "10.20.30.40.50.60"}) {
+            words.push_back(word);
+        }
+        return words;
+    }
+
+    int prefix_value(std::optional<PREFIX> prefix) {
+        return prefix ? static_cast<int>(prefix.value()) : -1;
+    }
+
+} // namespace
+
+int main() {
+    regex_classifier reference;
+    std::vector<std::string> words = corpus();
+
+    std::size_t mismatches = 0;
+    for (const std::string& word : words) {
+        unsigned long expected_level = 0, level = 0;
+        std::optional<PREFIX> expected = reference.classify(word, expected_level);
+        std::optional<PREFIX> prefix = classify_title_prefix(word, level);
+        if (prefix != expected || level != expected_level) {
+            if (mismatches++ < 20) {
+                std::fprintf(stderr, "'%s': prefix %d, level %lu, expected prefix %d, level %lu\n",
+                             word.c_str(), prefix_value(prefix), level, prefix_value(expected), expected_level);
+            }
+        }
+    }
+
+    std::printf("%zu words, %zu mismatches\n", words.size(), mismatches);
+    return mismatches == 0 ? 0 : 1;
+}